@@ -20,46 +20,118 @@
 #include <config.h>
 #include "Cache.h"
 
+Cache::Cache(const ResType *s,const ResType *e)
+   : res_max_size(s), res_enable(e), chain_tail(0), curr(0),
+     size(0), count(0), hits(0), misses(0), evictions(0), chain(0)
+{
+}
+
+void Cache::Unlink(CacheEntry *e)
+{
+   if(e->prev)
+      e->prev->next=e->next;
+   else
+      chain=e->next;
+   if(e->next)
+      e->next->prev=e->prev;
+   else
+      chain_tail=e->prev;
+   e->next=e->prev=0;
+}
+void Cache::LinkFirst(CacheEntry *e)
+{
+   e->prev=0;
+   e->next=chain;
+   if(chain)
+      chain->prev=e;
+   else
+      chain_tail=e;
+   chain=e;
+}
+
+void Cache::AddCacheEntry(CacheEntry *e,const xstring& key)
+{
+   e->key.set(key);
+   e->size=e->EstimateSize();
+   size+=e->size;
+   count++;
+   CacheEntry *&first=index.lookup_Lv(key);
+   e->same_key=first;
+   first=e;
+   LinkFirst(e);
+}
+void Cache::Delete(CacheEntry *e)
+{
+   if(curr==e)
+      curr=e->next;
+   Unlink(e);
+   CacheEntry **scan=&index.lookup_Lv(e->key);
+   while(*scan!=e)
+      scan=&scan[0]->same_key;
+   *scan=e->same_key;
+   if(!index.lookup(e->key))
+      index.remove(e->key);
+   size-=e->size;
+   count--;
+   delete e;
+}
+
+void Cache::Hit(CacheEntry *e)
+{
+   hits++;
+   if(chain==e)
+      return;
+   Unlink(e);
+   LinkFirst(e);
+}
+void Cache::SizeChanged(CacheEntry *e)
+{
+   long new_size=e->EstimateSize();
+   size+=new_size-e->size;
+   e->size=new_size;
+}
+
 void Cache::Trim()
 {
    long sizelimit=res_max_size->Query(0);
 
-   long size=0;
-   CacheEntry **scan=&chain;
-   while(scan[0])
+   // expired entries usually sit at the least recently used end.
+   while(chain_tail && chain_tail->Stopped())
+      Delete(chain_tail);
+   while(chain_tail && size>sizelimit)
    {
-      if(scan[0]->Stopped())
-	 delete replace_value(scan[0],scan[0]->next);
-      else
-      {
-	 size+=scan[0]->EstimateSize();
-	 scan=&scan[0]->next;
-      }
+      evictions++;
+      Delete(chain_tail);
    }
-// printf("Cache::Trim size=%ld, limit=%ld\n",size,sizelimit);
-   while(chain && size>sizelimit)
+}
+void Cache::Expire()
+{
+   CacheEntry *e=chain;
+   while(e)
    {
-      size-=chain->EstimateSize();
-      delete replace_value(chain,chain->next);
+      CacheEntry *next=e->next;
+      if(e->Stopped())
+	 Delete(e);
+      e=next;
    }
 }
 void Cache::Flush()
 {
    while(chain)
-      delete replace_value(chain,chain->next);
+      Delete(chain);
 }
 CacheEntry *Cache::IterateFirst()
 {
-   curr=&chain;
-   return *curr;
+   curr=chain;
+   return curr;
 }
 CacheEntry *Cache::IterateNext()
 {
-   curr=&curr[0]->next;
-   return *curr;
+   curr=curr->next;
+   return curr;
 }
 CacheEntry *Cache::IterateDelete()
 {
-   delete replace_value(curr[0],curr[0]->next);
-   return *curr;
+   Delete(curr);  // advances curr
+   return curr;
 }
@@ -21,42 +21,69 @@
 #define CACHE_H
 
 #include "Timer.h"
+#include "xmap.h"
 
 class CacheEntry : public Timer
 {
    friend class Cache;
-   CacheEntry *next;
+   CacheEntry *next;	 // towards less recently used
+   CacheEntry *prev;
+   CacheEntry *same_key; // next entry in the index with the same key
+   xstring key;
+   long size;		 // as accounted in Cache::size
 public:
-   CacheEntry() { next=0; }
+   CacheEntry() : next(0), prev(0), same_key(0), size(0) {}
    virtual int EstimateSize() const { return 1; }
    virtual ~CacheEntry() {}
+   CacheEntry *NextSameKey() const { return same_key; }
 };
+/* Entries are kept in LRU order and indexed by a key string which the
+   subclass makes from its lookup arguments; the key only has to be equal
+   for matching entries, the final comparison is up to the subclass. */
 class Cache
 {
    const ResType *res_max_size;
    const ResType *res_enable;
+
+   CacheEntry *chain_tail;
+   CacheEntry *curr;
+   xmap<CacheEntry*> index;
+   long size;
+   int count;
+   unsigned long hits;
+   unsigned long misses;
+   unsigned long evictions;
+
+   void Unlink(CacheEntry *e);
+   void LinkFirst(CacheEntry *e);
+   void Delete(CacheEntry *e);
+
 protected:
-   CacheEntry *chain;
-   CacheEntry **curr;
+   CacheEntry *chain;	 // most recently used first
    CacheEntry *IterateFirst();
    CacheEntry *IterateNext();
    CacheEntry *IterateDelete();
+
+   CacheEntry *FindFirst(const xstring& key) const { return index.lookup(key); }
+   void Hit(CacheEntry *e);
+   void Miss() { misses++; }
+   void Expired(CacheEntry *e) { Delete(e); }
+   void SizeChanged(CacheEntry *e);
+   void AddCacheEntry(CacheEntry *e,const xstring& key);
+
 public:
    void Trim();
+   void Expire();
    void Flush();
-   Cache(const ResType *s,const ResType *e) {
-      res_max_size=s;
-      res_enable=e;
-      chain=0;
-      curr=0;
-   }
+   Cache(const ResType *s,const ResType *e);
    ~Cache() { Flush(); }
    bool IsEnabled(const char *closure) { return res_enable->QueryBool(closure); }
    long SizeLimit() { return res_max_size->Query(0); }
-   void AddCacheEntry(CacheEntry *e) {
-      e->next=chain;
-      chain=e;
-   }
+   long GetSize() const { return size; }
+   int GetCount() const { return count; }
+   unsigned long GetHits() const { return hits; }
+   unsigned long GetMisses() const { return misses; }
+   unsigned long GetEvictions() const { return evictions; }
 };
 
 #endif//CACHE_H
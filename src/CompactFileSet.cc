@@ -0,0 +1,136 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include "CompactFileSet.h"
+
+CompactFileSet::CompactFileSet(const FileSet *set)
+{
+   int n=set->count();
+   size_t space=1;
+   for(int i=0; i<n; i++)
+   {
+      const FileInfo *fi=(*set)[i];
+      space+=fi->name.length()+1;
+      if(fi->symlink)
+	 space+=strlen(fi->symlink)+1;
+   }
+   // allocate everything at once to avoid reallocations
+   strings.get_space(space);
+   strings.append("",1);
+   name_off.get_space(n);
+   symlink_off.get_space(n);
+   size.get_space(n);
+   date.get_space(n);
+   date_prec.get_space(n);
+   mode.get_space(n);
+   nlinks.get_space(n);
+   user.get_space(n);
+   group.get_space(n);
+   defined.get_space(n);
+   filetype.get_space(n);
+   for(int i=0; i<n; i++)
+      Add((*set)[i]);
+}
+
+size_t CompactFileSet::AddString(const char *s)
+{
+   if(!s || !*s)
+      return 0;
+   size_t off=strings.length();
+   strings.append(s,strlen(s)+1);
+   return off;
+}
+
+void CompactFileSet::Add(const FileInfo *fi)
+{
+   name_off.append(AddString(fi->name));
+   symlink_off.append(AddString(fi->symlink));
+   size.append(fi->size);
+   date.append(fi->date.ts);
+   date_prec.append(fi->date.ts_prec);
+   mode.append(fi->mode);
+   nlinks.append(fi->nlinks);
+   user.append(fi->user);
+   group.append(fi->group);
+   defined.append(fi->defined);
+   filetype.append(fi->filetype);
+}
+
+int CompactFileSet::FindByName(const char *name) const
+{
+   int l=0, u=count()-1;
+   while(l<=u)
+   {
+      int m=(l+u)/2;
+      int cmp=strcmp(GetName(m),name);
+      if(cmp==0)
+	 return m;
+      if(cmp<0)
+	 l=m+1;
+      else
+	 u=m-1;
+   }
+   return -1;
+}
+
+FileInfo *CompactFileSet::MakeFileInfo(int i) const
+{
+   FileInfo *fi=new FileInfo(GetName(i));
+   fi->defined=defined[i];
+   fi->filetype=(FileInfo::type)filetype[i];
+   fi->symlink.set(symlink_off[i]?strings.get()+symlink_off[i]:0);
+   fi->size=size[i];
+   fi->date.set(date[i],date_prec[i]);
+   fi->mode=mode[i];
+   fi->nlinks=nlinks[i];
+   fi->user=user[i];
+   fi->group=group[i];
+   return fi;
+}
+
+FileInfo *CompactFileSet::MakeFileInfo(const char *name) const
+{
+   int i=FindByName(name);
+   return i<0 ? 0 : MakeFileInfo(i);
+}
+
+FileSet *CompactFileSet::MakeFileSet() const
+{
+   FileSet *set=new FileSet();
+   for(int i=0; i<count(); i++)
+      set->Add(MakeFileInfo(i));
+   return set;
+}
+
+size_t CompactFileSet::EstimateMemory() const
+{
+   size_t per_entry=name_off.get_element_size()
+      +symlink_off.get_element_size()
+      +size.get_element_size()
+      +date.get_element_size()
+      +date_prec.get_element_size()
+      +mode.get_element_size()
+      +nlinks.get_element_size()
+      +user.get_element_size()
+      +group.get_element_size()
+      +defined.get_element_size()
+      +filetype.get_element_size();
+   return sizeof(CompactFileSet)+strings.length()+count()*per_entry;
+}
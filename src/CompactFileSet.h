@@ -0,0 +1,72 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPACTFILESET_H
+#define COMPACTFILESET_H
+
+#include "FileSet.h"
+
+/* Read-only file set for keeping big listings around. Names and symlink
+ * targets are stored in one string arena, other attributes in parallel
+ * arrays, so there is no allocation per entry. FileInfo objects are
+ * created on demand. The order of entries is that of the source FileSet
+ * (as returned by its operator[]). FindByName needs the entries in name
+ * order, i.e. a source FileSet which was not sorted. */
+class CompactFileSet
+{
+   xstring strings;		// zero-terminated, offset 0 is ""
+   xarray<size_t> name_off;
+   xarray<size_t> symlink_off;
+   xarray<off_t>  size;
+   xarray<time_t> date;
+   xarray<int>	  date_prec;
+   xarray<mode_t> mode;
+   xarray<int>	  nlinks;
+   xarray<const char*> user;	// from StringPool
+   xarray<const char*> group;
+   xarray<unsigned short> defined;
+   xarray<unsigned char>  filetype;
+
+   size_t AddString(const char *s);
+
+public:
+   CompactFileSet() { strings.append("",1); }
+   CompactFileSet(const FileSet *set);
+
+   void Add(const FileInfo *fi);
+
+   int count() const { return name_off.count(); }
+
+   const char *GetName(int i) const { return strings.get()+name_off[i]; }
+   bool Has(int i,unsigned m) const { return defined[i]&m; }
+   bool TypeIs(int i,FileInfo::type t) const
+      { return Has(i,FileInfo::TYPE) && filetype[i]==t; }
+   off_t GetSize(int i) const { return size[i]; }
+   time_t GetDate(int i) const { return date[i]; }
+
+   int FindByName(const char *name) const; // index or -1
+
+   FileInfo *MakeFileInfo(int i) const;
+   FileInfo *MakeFileInfo(const char *name) const; // 0 if not found
+   FileSet *MakeFileSet() const;
+
+   size_t EstimateMemory() const;
+};
+
+#endif//COMPACTFILESET_H
@@ -189,7 +189,11 @@ CopyJobEnv::CopyJobEnv(FileAccess *s,ArgV *a,bool cont1)
    cp=0;
    errors=0;
    count=0;
-   parallel=ResMgr::Query("xfer:parallel",0);
+   const char *p=ResMgr::Query("xfer:parallel",0);
+   if(ParallelTuner::IsAuto(p))
+      AutoParallel();
+   else
+      parallel=atoi(p);
    bytes=0;
    time_spent=0;
    no_status=false;
@@ -206,6 +210,11 @@ int CopyJobEnv::Do()
    int m=STALL;
    if(done)
       return m;
+   if(tuner)
+   {
+      tuner->Update(GetBytesCount(),waiting_num,session->GetConnectionLimit());
+      parallel=tuner->Get();
+   }
    if(waiting_num<parallel)
    {
       if(!errors || !ResMgr::QueryBool("cmd:fail-exit",0))
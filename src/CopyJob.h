@@ -23,6 +23,7 @@
 #include "Job.h"
 #include "StatusLine.h"
 #include "FileCopy.h"
+#include "ParallelTuner.h"
 
 class CopyJob : public Job
 {
@@ -113,6 +114,7 @@ protected:
    int errors;
    int count;
    int parallel;
+   Ref<ParallelTuner> tuner;  // chooses parallel in auto mode
    off_t bytes;
    TimeDate transfer_start_ts;
    double time_spent;
@@ -154,7 +156,8 @@ public:
 
    void Quiet(bool q) { quiet=q; }
 
-   void SetParallel(int n) { parallel=n; }
+   void SetParallel(int n) { parallel=n; tuner=0; }
+   void AutoParallel() { tuner=new ParallelTuner(op); parallel=tuner->Get(); }
 };
 
 #endif // COPYJOB_H
@@ -0,0 +1,784 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_RANDOM_H
+# include <sys/random.h>
+#endif
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "DnsLookup.h"
+#include "xmap.h"
+
+#define RESOLV_CONF "/etc/resolv.conf"
+#define HOSTS_FILE  "/etc/hosts"
+#define DNS_PORT    53
+#define MAX_SERVERS 3
+
+struct DnsLookup::Config
+{
+   bool have_resolv;
+   time_t checked;
+   time_t resolv_mtime;
+   time_t hosts_mtime;
+   xarray<sockaddr_u> servers;
+   StringSet search;
+   int ndots;
+   int timeout;
+   int attempts;
+   bool rotate;
+   int next_server;
+   xmap_p< xarray<sockaddr_u> > hosts;
+
+   Config() : have_resolv(false), checked(0), resolv_mtime(-1), hosts_mtime(-1),
+      ndots(1), timeout(5), attempts(2), rotate(false), next_server(0) {}
+   void LoadResolvConf();
+   void LoadHosts();
+};
+DnsLookup::Config *DnsLookup::config;
+
+static bool parse_numeric(const char *s,sockaddr_u *u)
+{
+   memset(u,0,sizeof(*u));
+   if(inet_pton(AF_INET,s,&u->in.sin_addr)>0)
+   {
+      u->sa.sa_family=AF_INET;
+#ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
+      u->sa.sa_len=sizeof(u->in);
+#endif
+      return true;
+   }
+#if INET6
+   if(inet_pton(AF_INET6,s,&u->in6.sin6_addr)>0)
+   {
+      u->sa.sa_family=AF_INET6;
+# ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
+      u->sa.sa_len=sizeof(u->in6);
+# endif
+      return true;
+   }
+#endif
+   return false;
+}
+
+static bool same_server(const sockaddr_u& a,const sockaddr_u& b)
+{
+   if(a.family()!=b.family() || a.port()!=b.port())
+      return false;
+   if(a.family()==AF_INET)
+      return !memcmp(&a.in.sin_addr,&b.in.sin_addr,sizeof(a.in.sin_addr));
+#if INET6
+   if(a.family()==AF_INET6)
+      return !memcmp(&a.in6.sin6_addr,&b.in6.sin6_addr,sizeof(a.in6.sin6_addr));
+#endif
+   return false;
+}
+
+static int rr_family(int type)
+{
+   if(type==DnsLookup::RR_A)
+      return AF_INET;
+#if INET6
+   if(type==DnsLookup::RR_AAAA)
+      return AF_INET6;
+#endif
+   return -1;
+}
+
+void DnsLookup::Config::LoadResolvConf()
+{
+   servers.unset();
+   search.Empty();
+   ndots=1;
+   timeout=5;
+   attempts=2;
+   rotate=false;
+
+   FILE *f=fopen(RESOLV_CONF,"r");
+   have_resolv=(f!=0);
+   if(f)
+   {
+      const char *const delim=" \t\r\n";
+      char line[1024];
+      while(fgets(line,sizeof(line),f))
+      {
+	 char *tok;
+	 const char *key=strtok_r(line,delim,&tok);
+	 if(!key || key[0]=='#' || key[0]==';')
+	    continue;
+	 if(!strcmp(key,"nameserver"))
+	 {
+	    const char *a=strtok_r(0,delim,&tok);
+	    sockaddr_u u;
+	    if(a && servers.count()<MAX_SERVERS && parse_numeric(a,&u))
+	    {
+	       u.set_port(DNS_PORT);
+	       servers.append(u);
+	    }
+	 }
+	 else if(!strcmp(key,"domain") || !strcmp(key,"search"))
+	 {
+	    search.Empty();
+	    for(const char *d; (d=strtok_r(0,delim,&tok)); )
+	       search.Append(d);
+	 }
+	 else if(!strcmp(key,"options"))
+	 {
+	    for(const char *o; (o=strtok_r(0,delim,&tok)); )
+	    {
+	       if(!strncmp(o,"ndots:",6))
+		  ndots=atoi(o+6);
+	       else if(!strncmp(o,"timeout:",8))
+		  timeout=atoi(o+8);
+	       else if(!strncmp(o,"attempts:",9))
+		  attempts=atoi(o+9);
+	       else if(!strcmp(o,"rotate"))
+		  rotate=true;
+	    }
+	 }
+      }
+      fclose(f);
+   }
+   // the same limits and defaults as libc resolver has.
+   if(ndots<0)
+      ndots=0;
+   if(ndots>15)
+      ndots=15;
+   if(timeout<1)
+      timeout=1;
+   if(timeout>30)
+      timeout=30;
+   if(attempts<1)
+      attempts=1;
+   if(attempts>5)
+      attempts=5;
+   if(servers.count()==0)
+   {
+      sockaddr_u u;
+      parse_numeric("127.0.0.1",&u);
+      u.set_port(DNS_PORT);
+      servers.append(u);
+   }
+   if(search.Count()==0)
+   {
+      char host[256];
+      if(gethostname(host,sizeof(host))==0)
+      {
+	 host[sizeof(host)-1]=0;
+	 const char *dot=strchr(host,'.');
+	 if(dot && dot[1])
+	    search.Append(dot+1);
+      }
+   }
+}
+
+void DnsLookup::Config::LoadHosts()
+{
+   hosts.empty();
+   FILE *f=fopen(HOSTS_FILE,"r");
+   if(!f)
+      return;
+   const char *const delim=" \t\r\n";
+   char line[1024];
+   while(fgets(line,sizeof(line),f))
+   {
+      char *hash=strchr(line,'#');
+      if(hash)
+	 *hash=0;
+      char *tok;
+      const char *a=strtok_r(line,delim,&tok);
+      sockaddr_u u;
+      if(!a || !parse_numeric(a,&u))
+	 continue;
+      for(const char *h; (h=strtok_r(0,delim,&tok)); )
+      {
+	 xstring& key=xstring::get_tmp(h);
+	 key.c_lc();
+	 xarray<sockaddr_u> *list=hosts.lookup(key);
+	 if(!list)
+	 {
+	    list=new xarray<sockaddr_u>;
+	    hosts.add(key,list);
+	 }
+	 list->append(u);
+      }
+   }
+   fclose(f);
+}
+
+void DnsLookup::LoadConfig()
+{
+   if(!config)
+      config=new Config;
+   time_t t=SMTask::now.UnixTime();
+   if(config->checked==t)
+      return;
+   config->checked=t;
+
+   struct stat st;
+   time_t mtime=(stat(RESOLV_CONF,&st)==-1 ? 0 : st.st_mtime);
+   if(mtime!=config->resolv_mtime)
+   {
+      config->resolv_mtime=mtime;
+      config->LoadResolvConf();
+   }
+   mtime=(stat(HOSTS_FILE,&st)==-1 ? 0 : st.st_mtime);
+   if(mtime!=config->hosts_mtime)
+   {
+      config->hosts_mtime=mtime;
+      config->LoadHosts();
+   }
+}
+
+bool DnsLookup::Configured()
+{
+   LoadConfig();
+   return config->have_resolv;
+}
+
+DnsLookup::DnsLookup(const char *n,const int *t,int t_count)
+   : name(n), candidate(-1), try_again(false), status(IN_PROGRESS)
+{
+   sock[0]=sock[1]=-1;
+   types.nset(t,t_count);
+
+   LoadConfig();
+   servers.set(config->servers);
+   timeout=config->timeout;
+   attempts=config->attempts;
+   first_server=0;
+   if(config->rotate)
+      first_server=config->next_server++%servers.count();
+
+   if(name.last_char()=='.')
+   {
+      name.chomp('.');
+      candidates.Append(name);
+      return;
+   }
+   int dots=0;
+   for(const char *s=name; *s; s++)
+      dots+=(*s=='.');
+   if(dots>=config->ndots)
+      candidates.Append(name);
+   for(int i=0; i<config->search.Count(); i++)
+      candidates.AppendFormat("%s.%s",name.get(),config->search[i]);
+   if(dots<config->ndots)
+      candidates.Append(name);
+}
+DnsLookup::~DnsLookup()
+{
+   for(int i=0; i<2; i++)
+      if(sock[i]!=-1)
+	 close(sock[i]);
+}
+DnsLookup::Query::~Query()
+{
+   if(tcp!=-1)
+      close(tcp);
+}
+
+// numeric addresses and the names from the hosts file need no queries.
+bool DnsLookup::LookupStatic()
+{
+   sockaddr_u u;
+   if(parse_numeric(name,&u))
+   {
+      for(int i=0; i<types.count(); i++)
+	 if(rr_family(types[i])==u.family())
+	    addr.append(u);
+      status=(addr.count()>0 ? FOUND : NOT_FOUND);
+      return true;
+   }
+   xstring& key=xstring::get_tmp(name);
+   key.c_lc();
+   const xarray<sockaddr_u> *h=config->hosts.lookup(key);
+   if(!h)
+      return false;
+   for(int i=0; i<types.count(); i++)
+      for(int j=0; j<h->count(); j++)
+	 if(rr_family(types[i])==(*h)[j].family())
+	    addr.append((*h)[j]);
+   if(addr.count()==0)
+      return false;
+   LogNote(9,"found in %s",HOSTS_FILE);
+   status=FOUND;
+   return true;
+}
+
+static bool make_query(xstring& p,const char *name,int type)
+{
+   static const char header[]={0,0, 1,0, 0,1, 0,0, 0,0, 0,0};
+   p.nset(header,sizeof(header));
+   size_t total=0;
+   while(*name)
+   {
+      const char *dot=strchr(name,'.');
+      size_t len=(dot ? dot-name : strlen(name));
+      if(len==0 || len>63)
+	 return false;
+      p.append(char(len));
+      p.append(name,len);
+      total+=len+1;
+      name+=len;
+      if(*name)
+	 name++;
+   }
+   if(total==0 || total>254)
+      return false;
+   p.append('\0');
+   p.append(char(type>>8));
+   p.append(char(type&255));
+   p.append('\0');
+   p.append('\1');   // class IN
+   return true;
+}
+
+// decodes the name at offset p of the message, returns the offset after it.
+static int get_name(const unsigned char *msg,int len,int p,xstring *out)
+{
+   int end=-1;
+   int hops=0;
+   if(out)
+      out->truncate();
+   for(;;)
+   {
+      if(p>=len)
+	 return -1;
+      int l=msg[p];
+      if((l&0xC0)==0xC0)
+      {
+	 if(p+1>=len || ++hops>64)
+	    return -1;
+	 if(end<0)
+	    end=p+2;
+	 p=((l&0x3F)<<8)|msg[p+1];
+	 continue;
+      }
+      if(l&0xC0)
+	 return -1;
+      p++;
+      if(l==0)
+	 break;
+      if(p+l>len)
+	 return -1;
+      if(out)
+      {
+	 if(out->length()>0)
+	    out->append('.');
+	 out->append((const char*)msg+p,l);
+      }
+      p+=l;
+   }
+   return end<0 ? p : end;
+}
+
+// unpredictable ids and ports make forged answers hard to get accepted.
+static void get_random(void *buf,size_t len)
+{
+#ifdef HAVE_GETRANDOM
+   if(getrandom(buf,len,0)==(ssize_t)len)
+      return;
+#endif
+   int fd=open("/dev/urandom",O_RDONLY);
+   if(fd!=-1)
+   {
+      int res=read(fd,buf,len);
+      close(fd);
+      if(res==(int)len)
+	 return;
+   }
+   for(size_t i=0; i<len; i++)
+      ((char*)buf)[i]=random()/13;
+}
+
+int DnsLookup::GetSocket(int af)
+{
+   int i=(af==AF_INET ? 0 : 1);
+   if(sock[i]==-1)
+   {
+      sock[i]=SocketCreateUnbound(af,SOCK_DGRAM,0,name);
+      if(sock[i]==-1)
+      {
+	 LogError(9,"socket: %s",strerror(errno));
+	 return -1;
+      }
+      // bind to a random port, leave it to the system if they are all taken.
+      for(int t=0; t<8; t++)
+      {
+	 unsigned short port;
+	 get_random(&port,sizeof(port));
+	 port=1024+port%(65536-1024);
+	 sockaddr_u bind_addr;
+	 bind_addr.set_defaults(af,name,port);
+	 if(bind_addr.bind_to(sock[i])==0)
+	    return sock[i];
+	 if(errno!=EADDRINUSE)
+	    break;
+      }
+      SocketBindStd(sock[i],af,name);
+   }
+   return sock[i];
+}
+
+bool DnsLookup::Send(Query *q)
+{
+   const sockaddr_u& server=servers[q->server];
+   int s=GetSocket(server.family());
+   if(s==-1)
+      return false;
+   get_random(&q->id,sizeof(q->id));
+   q->packet.get_non_const()[0]=char(q->id>>8);
+   q->packet.get_non_const()[1]=char(q->id&255);
+   if(sendto(s,q->packet,q->packet.length(),0,&server.sa,server.addr_len())==-1)
+   {
+      LogError(9,"sendto(%s): %s",server.to_string(),strerror(errno));
+      return false;
+   }
+   q->timer.Set(TimeInterval(timeout,0));
+   return true;
+}
+
+// sends the query to the next server, gives up when all tries are spent.
+void DnsLookup::SendNext(Query *q)
+{
+   if(q->tcp!=-1)
+   {
+      close(q->tcp);
+      q->tcp=-1;
+   }
+   int n=servers.count();
+   while(q->sent<n*attempts)
+   {
+      q->server=(q->server<0 ? first_server : (q->server+1)%n);
+      q->sent++;
+      if(Send(q))
+	 return;
+   }
+   q->done=true;
+   q->failed=true;
+}
+
+void DnsLookup::StartCandidate()
+{
+   queries.unset();
+   const char *cname=candidates[candidate];
+   LogNote(9,"looking up %s",cname);
+   for(int i=0; i<types.count(); i++)
+   {
+      Query *q=new Query(types[i]);
+      queries.append(q);
+      if(!make_query(q->packet,cname,q->type))
+      {
+	 q->done=true;
+	 q->rcode=3;
+	 continue;
+      }
+      SendNext(q);
+   }
+}
+
+void DnsLookup::StartTCP(Query *q)
+{
+   const sockaddr_u& server=servers[q->server];
+   LogNote(9,"answer from %s is truncated, repeating over TCP",server.to_string());
+   q->tcp=SocketCreateUnboundTCP(server.family(),name);
+   if(q->tcp==-1 || (SocketConnect(q->tcp,&server)==-1 && errno!=EINPROGRESS))
+   {
+      LogError(9,"connect(%s): %s",server.to_string(),strerror(errno));
+      SendNext(q);
+      return;
+   }
+   q->tcp_buf.set("");
+   q->tcp_buf.append(char(q->packet.length()>>8));
+   q->tcp_buf.append(char(q->packet.length()&255));
+   q->tcp_buf.append(q->packet);
+   q->tcp_sent=false;
+   q->timer.Set(TimeInterval(timeout,0));
+}
+
+int DnsLookup::DoTCP(Query *q)
+{
+   if(!q->tcp_sent)
+   {
+      if(!Ready(q->tcp,POLLOUT))
+      {
+	 Block(q->tcp,POLLOUT);
+	 return STALL;
+      }
+      int res=write(q->tcp,q->tcp_buf,q->tcp_buf.length());
+      if(res==-1 && E_RETRY(errno))
+      {
+	 Block(q->tcp,POLLOUT);
+	 return STALL;
+      }
+      if(res==-1)
+      {
+	 LogError(9,"write: %s",strerror(errno));
+	 SendNext(q);
+	 return MOVED;
+      }
+      q->tcp_buf.set_substr(0,res,"",0);
+      if(q->tcp_buf.length()==0)
+	 q->tcp_sent=true;
+      return MOVED;
+   }
+   if(!Ready(q->tcp,POLLIN))
+   {
+      Block(q->tcp,POLLIN);
+      return STALL;
+   }
+   char buf[0x1000];
+   int res=read(q->tcp,buf,sizeof(buf));
+   if(res==-1 && E_RETRY(errno))
+   {
+      Block(q->tcp,POLLIN);
+      return STALL;
+   }
+   if(res<=0)
+   {
+      LogError(9,"read: %s",res==0?"unexpected EOF":strerror(errno));
+      SendNext(q);
+      return MOVED;
+   }
+   q->tcp_buf.append(buf,res);
+   if(q->tcp_buf.length()>=2)
+   {
+      const unsigned char *b=(const unsigned char*)q->tcp_buf.get();
+      int len=(b[0]<<8)|b[1];
+      if((int)q->tcp_buf.length()>=len+2)
+	 HandleAnswer(q,b+2,len);
+   }
+   return MOVED;
+}
+
+int DnsLookup::ReceiveUDP(int s)
+{
+   int m=STALL;
+   for(;;)
+   {
+      if(!Ready(s,POLLIN))
+      {
+	 Block(s,POLLIN);
+	 return m;
+      }
+      unsigned char buf[0x1000];
+      sockaddr_u from;
+      socklen_t from_len=sizeof(from);
+      int res=recvfrom(s,buf,sizeof(buf),0,&from.sa,&from_len);
+      if(res==-1)
+      {
+	 if(!E_RETRY(errno))
+	    LogError(9,"recvfrom: %s",strerror(errno));
+	 Block(s,POLLIN);
+	 return m;
+      }
+      if(res<2)
+	 continue;
+      unsigned short id=(buf[0]<<8)|buf[1];
+      for(int i=0; i<queries.count(); i++)
+      {
+	 Query *q=queries[i];
+	 if(!q->done && q->tcp==-1 && q->id==id && same_server(from,servers[q->server]))
+	 {
+	    HandleAnswer(q,buf,res);
+	    m=MOVED;
+	    break;
+	 }
+      }
+   }
+}
+
+void DnsLookup::HandleAnswer(Query *q,const unsigned char *msg,int len)
+{
+   const sockaddr_u& server=servers[q->server];
+   xstring qname;
+   int p=(len>=12 ? get_name(msg,len,12,&qname) : -1);
+   if(p<0 || p+4>len
+   || ((msg[0]<<8)|msg[1])!=q->id
+   || !(msg[2]&0x80)			 // not a response
+   || ((msg[4]<<8)|msg[5])!=1		 // question count
+   || ((msg[p]<<8)|msg[p+1])!=q->type
+   || strcasecmp(qname,candidates[candidate]))
+   {
+      LogError(9,"invalid answer from %s",server.to_string());
+      if(q->tcp!=-1)
+	 SendNext(q);
+      return;
+   }
+   if((msg[2]&0x02) && q->tcp==-1)
+   {
+      StartTCP(q);
+      return;
+   }
+   int rcode=msg[3]&0x0F;
+   if(rcode!=0 && rcode!=3)
+   {
+      LogNote(9,"%s returned error %d",server.to_string(),rcode);
+      SendNext(q);
+      return;
+   }
+   q->rcode=rcode;
+   q->done=true;
+   if(q->tcp!=-1)
+   {
+      close(q->tcp);
+      q->tcp=-1;
+   }
+   if(rcode==0)
+      AddRecords(q,msg,len);
+}
+
+void DnsLookup::AddRecords(Query *q,const unsigned char *msg,int len)
+{
+   int answers=(msg[6]<<8)|msg[7];
+   int p=get_name(msg,len,12,0)+4;
+   xstring alias(candidates[candidate]);
+   xstring owner;
+   xstring target;
+   for( ; answers>0; answers--)
+   {
+      p=get_name(msg,len,p,&owner);
+      if(p<0 || p+10>len)
+	 return;
+      int type=(msg[p]<<8)|msg[p+1];
+      int rr_class=(msg[p+2]<<8)|msg[p+3];
+      int rdlen=(msg[p+8]<<8)|msg[p+9];
+      p+=10;
+      if(p+rdlen>len)
+	 return;
+      const unsigned char *rd=msg+p;
+      if(rr_class==1 && !strcasecmp(owner,alias))
+      {
+	 sockaddr_u u;
+	 memset(&u,0,sizeof(u));
+	 if(type==RR_CNAME)
+	 {
+	    if(get_name(msg,len,p,&target)>0)
+	       alias.set(target);
+	 }
+	 else if(type!=q->type)
+	    ;
+	 else if(type==RR_A && rdlen==sizeof(u.in.sin_addr))
+	 {
+	    u.sa.sa_family=AF_INET;
+	    memcpy(&u.in.sin_addr,rd,rdlen);
+	    q->addr.append(u);
+	 }
+#if INET6
+	 else if(type==RR_AAAA && rdlen==sizeof(u.in6.sin6_addr))
+	 {
+	    u.sa.sa_family=AF_INET6;
+	    memcpy(&u.in6.sin6_addr,rd,rdlen);
+	    q->addr.append(u);
+	 }
+#endif
+	 else if(type==RR_SRV && rdlen>6 && get_name(msg,len,p+6,&target)>0)
+	 {
+	    SRV *s=new SRV;
+	    s->priority=(rd[0]<<8)|rd[1];
+	    s->weight=(rd[2]<<8)|rd[3];
+	    s->port=(rd[4]<<8)|rd[5];
+	    s->target.set(target);
+	    srv.append(s);
+	 }
+      }
+      p+=rdlen;
+   }
+}
+
+// finishes the lookup or goes to the next search domain when the
+// answers for the current name are all in.
+void DnsLookup::CheckCandidate()
+{
+   for(int i=0; i<queries.count(); i++)
+      if(!queries[i]->done)
+	 return;
+   bool found=(srv.count()>0);
+   for(int i=0; i<queries.count(); i++)
+   {
+      if(queries[i]->failed)
+	 try_again=true;
+      for(int j=0; j<queries[i]->addr.count(); j++)
+      {
+	 addr.append(queries[i]->addr[j]);
+	 found=true;
+      }
+   }
+   queries.unset();
+   if(found)
+   {
+      status=FOUND;
+      return;
+   }
+   if(++candidate<candidates.Count())
+   {
+      StartCandidate();
+      return;
+   }
+   status=(try_again ? TRY_AGAIN : NOT_FOUND);
+}
+
+int DnsLookup::Do()
+{
+   if(Done())
+      return STALL;
+   int m=STALL;
+   if(candidate==-1)
+   {
+      candidate=0;
+      if(LookupStatic())
+	 return MOVED;
+      if(candidates.Count()==0)
+      {
+	 status=NOT_FOUND;
+	 return MOVED;
+      }
+      StartCandidate();
+      m=MOVED;
+   }
+   for(int i=0; i<2; i++)
+      if(sock[i]!=-1)
+	 m|=ReceiveUDP(sock[i]);
+   for(int i=0; i<queries.count(); i++)
+   {
+      Query *q=queries[i];
+      if(!q->done && q->tcp!=-1)
+	 m|=DoTCP(q);
+      if(!q->done && q->timer.Stopped())
+      {
+	 LogNote(9,"no answer from %s",servers[q->server].to_string());
+	 SendNext(q);
+	 m=MOVED;
+      }
+   }
+   CheckCandidate();
+   if(Done())
+      m=MOVED;
+   return m;
+}
@@ -0,0 +1,117 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DNSLOOKUP_H
+#define DNSLOOKUP_H
+
+#include "SMTask.h"
+#include "ResMgr.h"
+#include "ProtoLog.h"
+#include "network.h"
+#include "xarray.h"
+#include "StringSet.h"
+#include "Timer.h"
+
+/* Non-blocking stub resolver. It takes the name servers and the search
+ * list from /etc/resolv.conf and static names from /etc/hosts, sends the
+ * queries for all the requested record types at once over UDP and
+ * repeats a query over TCP when the answer is truncated. */
+class DnsLookup : public SMTask, protected ProtoLog, protected Networker
+{
+public:
+   enum { RR_A=1, RR_CNAME=5, RR_AAAA=28, RR_SRV=33 };
+   enum status_t { IN_PROGRESS, FOUND, NOT_FOUND, TRY_AGAIN };
+   struct SRV
+   {
+      xstring target;
+      int port;
+      int priority;
+      int weight;
+   };
+
+private:
+   struct Query
+   {
+      int type;
+      unsigned short id;
+      xstring packet;
+      int server;	 // the server the query was last sent to
+      int sent;
+      Timer timer;
+      int tcp;		 // the socket when repeating over TCP
+      xstring tcp_buf;	 // the query to send, then the answer
+      bool tcp_sent;
+      bool done;
+      bool failed;	 // no server has answered
+      int rcode;
+      xarray<sockaddr_u> addr;
+      Query(int t) : type(t), id(0), server(-1), sent(0), tcp(-1),
+	 tcp_sent(false), done(false), failed(false), rcode(-1) {}
+      ~Query();
+   };
+
+   struct Config;
+   static Config *config;
+   static void LoadConfig();
+
+   xstring name;
+   xarray<int> types;
+   xarray<sockaddr_u> servers;
+   int first_server;
+   int timeout;
+   int attempts;
+   StringSet candidates;	 // the name with the search domains
+   int candidate;
+   xarray_p<Query> queries;
+   int sock[2];	 // for IPv4 and IPv6 servers
+   bool try_again;
+   status_t status;
+
+   xarray<sockaddr_u> addr;
+   xarray_p<SRV> srv;
+
+   bool LookupStatic();
+   void StartCandidate();
+   bool Send(Query *q);
+   void SendNext(Query *q);
+   int GetSocket(int af);
+   int ReceiveUDP(int s);
+   int DoTCP(Query *q);
+   void StartTCP(Query *q);
+   void HandleAnswer(Query *q,const unsigned char *msg,int len);
+   void AddRecords(Query *q,const unsigned char *msg,int len);
+   void CheckCandidate();
+
+public:
+   DnsLookup(const char *name,const int *types,int n);
+   ~DnsLookup();
+
+   int Do();
+   status_t GetStatus() const { return status; }
+   bool Done() const { return status!=IN_PROGRESS; }
+   // port is zero; addresses come in the order of the requested types.
+   const xarray<sockaddr_u>& GetAddresses() const { return addr; }
+   const xarray_p<SRV>& GetSRV() const { return srv; }
+   const char *GetLogContext() { return name; }
+
+   // false if there is no resolv.conf to take the name servers from.
+   static bool Configured();
+};
+
+#endif//DNSLOOKUP_H
@@ -195,6 +195,7 @@ void FileAccess::Close()
    opt_size=0;
    fileset_for_info=0;
    retries=0;
+   more_ranges.truncate();
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
    ascii=false;
@@ -600,97 +601,220 @@ void FileAccess::SetFileURL(const char *u)
       new_cwd->SetURL(u);
 }
 
-FileAccess *SessionPool::pool[pool_size];
+xarray<SessionPool::entry> SessionPool::pool;
+int SessionPool::next_id;
+int SessionPool::evictions;
+
+// holds the sessions started by Prewarm until they are logged in
+class SessionWarmer : public SMTask
+{
+   TaskRefArray<FileAccess> sessions;
+public:
+   int Do();
+   void Add(FileAccess *s) { sessions.append(s); }
+   const TaskRefArray<FileAccess>& GetSessions() const { return sessions; }
+   void Clear() { sessions.unset(); }
+};
+static SMTaskRef<SessionWarmer> warmer;
+
+int SessionWarmer::Do()
+{
+   int m=STALL;
+   for(int i=0; i<sessions.count(); i++)
+   {
+      int res=sessions[i]->Done();
+      if(res==FA::IN_PROGRESS)
+	 continue;
+      FileAccess *s=sessions[i].borrow();
+      sessions.remove(i--);
+      if(s->IsConnected())
+	 SessionPool::Reuse(s);
+      else
+	 SMTask::Delete(s);
+      m=MOVED;
+   }
+   return m;
+}
+
+int SessionPool::CountHost(const char *host)
+{
+   int n=0;
+   for(int i=0; i<pool.count(); i++)
+      if(!xstrcmp(pool[i].session->GetHostName(),host))
+	 n++;
+   return n;
+}
+
+// removes a session of the host (any if host is null), preferring
+// one without a connection, then the least recently used one.
+void SessionPool::Evict(const char *host)
+{
+   int victim=-1;
+   for(int i=0; i<pool.count(); i++)
+   {
+      if(host && xstrcmp(pool[i].session->GetHostName(),host))
+	 continue;
+      if(victim==-1)
+	 victim=i;
+      if(!pool[i].session->IsConnected())
+      {
+	 victim=i;
+	 break;
+      }
+   }
+   if(victim==-1)
+      return;
+   SMTask::Delete(pool[victim].session);
+   pool.remove(victim);
+   evictions++;
+}
 
 void SessionPool::Reuse(FileAccess *f)
 {
    if(f==0)
       return;
-   if(f->GetHostName()==0)
+   const char *host=f->GetHostName();
+   if(host==0)
    {
       SMTask::Delete(f);
       return;
    }
    f->Close();
    f->SetPriority(0);
-   int i;
-   for(i=0; i<pool_size; i++)
+   for(int i=0; i<pool.count(); i++)
+      assert(pool[i].session!=f);
+   entry e={f,next_id++};
+   pool.append(e);
+
+   int host_max=ResMgr::Query("scache:max-idle-per-host",host);
+   while(CountHost(host)>host_max)
+      Evict(host);
+   int max=ResMgr::Query("scache:max-idle",0);
+   while(pool.count()>max)
+      Evict(0);
+}
+
+void SessionPool::Print(FILE *f)
+{
+   StringSet hosts;
+   xarray<int> idle,connected;
+
+   for(int i=0; i<pool.count(); i++)
    {
-      assert(pool[i]!=f);
-      if(pool[i]==0)
+      const FileAccess *s=pool[i].session;
+      int j;
+      for(j=0; j<i; j++)
+	 if(pool[j].session->SameLocationAs(s))
+	    break;
+      if(j==i)
+	 fprintf(f,"%d\t%s%s\n",pool[i].id,s->GetConnectURL().get(),
+	    s->IsConnected()?"":_(" (not connected)"));
+
+      for(j=0; j<hosts.Count(); j++)
+	 if(!strcmp(hosts[j],s->GetHostName()))
+	    break;
+      if(j==hosts.Count())
       {
-	 pool[i]=f;
-	 return;
+	 hosts.Append(s->GetHostName());
+	 idle.append(0);
+	 connected.append(0);
       }
+      idle[j]++;
+      if(s->IsConnected())
+	 connected[j]++;
    }
-   for(i=0; i<pool_size; i++)
+   if(warmer)
    {
-      if(f->IsBetterThan(pool[i]))
-      {
-	 SMTask::Delete(pool[i]);
-	 pool[i]=f;
-	 return;
-      }
+      const TaskRefArray<FileAccess>& w=warmer->GetSessions();
+      for(int i=0; i<w.count(); i++)
+	 fprintf(f,"-\t%s [%s]\n",w[i]->GetConnectURL().get(),w[i]->CurrentStatus());
    }
-   SMTask::Delete(f);
+   for(int j=0; j<hosts.Count(); j++)
+      fprintf(f,_("%s: %d idle sessions, %d connected (max %d)\n"),hosts[j],
+	 idle[j],connected[j],(int)ResMgr::Query("scache:max-idle-per-host",hosts[j]));
+   if(pool.count()>0 || evictions>0)
+      fprintf(f,_("total: %d idle sessions (max %d), %d evicted\n"),pool.count(),
+	 (int)ResMgr::Query("scache:max-idle",0),evictions);
 }
 
-void SessionPool::Print(FILE *f)
+FileAccess *SessionPool::GetSession(int id)
 {
-   int arr[pool_size];
-   int n=0;
-   int i;
-
-   for(i=0; i<pool_size; i++)
+   for(int i=0; i<pool.count(); i++)
    {
-      if(pool[i]==0)
+      if(pool[i].id!=id)
 	 continue;
-      int j;
-      for(j=0; j<n; j++)
-	 if(pool[arr[j]]->SameLocationAs(pool[i]))
-	    break;
-      if(j==n)
-	 arr[n++]=i;
+      FileAccess *s=pool[i].session;
+      pool.remove(i);
+      return s;
    }
-
-   // sort?
-
-   for(i=0; i<n; i++)
-      fprintf(f,"%d\t%s\n",arr[i],pool[arr[i]]->GetConnectURL().get());
+   return 0;
 }
 
-FileAccess *SessionPool::GetSession(int n)
+FileAccess *SessionPool::Walk(int *n,const char *proto)
 {
-   if(n<0 || n>=pool_size)
-      return 0;
-   FileAccess *s=pool[n];
-   pool[n]=0;
-   return s;
+   for( ; *n<pool.count(); (*n)++)
+   {
+      if(!strcmp(pool[*n].session->GetProto(),proto))
+	 return pool[*n].session;
+   }
+   return 0;
 }
 
-FileAccess *SessionPool::Walk(int *n,const char *proto)
+void SessionPool::Prewarm(const FileAccess *s,int n)
 {
-   for( ; *n<pool_size; (*n)++)
+   const char *host=s->GetHostName();
+   if(n<=0 || !host || !ResMgr::QueryBool("scache:prewarm",host))
+      return;
+
+   // the sessions already waiting for the site go first
+   int host_idle=CountHost(host);
+   for(int i=0; i<pool.count(); i++)
+      if(pool[i].session->SameSiteAs(s) && pool[i].session->IsConnected())
+	 n--;
+   if(warmer)
    {
-      if(pool[*n] && !strcmp(pool[*n]->GetProto(),proto))
-	 return pool[*n];
+      const TaskRefArray<FileAccess>& w=warmer->GetSessions();
+      for(int i=0; i<w.count(); i++)
+      {
+	 if(!xstrcmp(w[i]->GetHostName(),host))
+	    host_idle++;
+	 if(w[i]->SameSiteAs(s))
+	    n--;
+      }
+   }
+   // don't start what would be evicted right away
+   int room=(int)ResMgr::Query("scache:max-idle-per-host",host)-host_idle;
+   if(n>room)
+      n=room;
+   if(n<=0)
+      return;
+
+   if(!warmer)
+      warmer=new SessionWarmer();
+   ProtoLog::LogNote(9,"starting %d more sessions to %s in advance",n,host);
+   while(n-->0)
+   {
+      FileAccess *c=s->Clone();
+      c->SetPriority(0);
+      c->Chdir(c->GetCwd().path);
+      warmer->Add(c);
    }
-   return 0;
 }
 
 void SessionPool::ClearAll()
 {
+   if(warmer)
+      warmer->Clear();
    int pass=0;
    for(;;) {
       int left=0;
-      for(int n=0; n<pool_size; n++) {
-	 if(!pool[n])
-	    continue;
+      for(int n=0; n<pool.count(); n++) {
+	 FileAccess *s=pool[n].session;
 	 if(pass==0)
-	    pool[n]->Disconnect();
-	 if(!pool[n]->IsConnected()) {
-	    SMTask::Delete(pool[n]);
-	    pool[n]=0;
+	    s->Disconnect();
+	 if(!s->IsConnected()) {
+	    SMTask::Delete(s);
+	    pool.remove(n--);
 	 } else {
 	    left++;
 	 }
@@ -895,6 +1019,26 @@ void ListInfo::PrepareToDie()
 }
 ListInfo::~ListInfo() {}
 
+// LongListParser implementation
+int LongListParser::Feed(const char *buf,int len)
+{
+   int used=0;
+   for(;;)
+   {
+      const char *nl=(const char*)memchr(buf+used,'\n',len-used);
+      if(!nl)
+	 break;
+      line.nset(buf+used,nl-buf-used);
+      used=nl+1-buf;
+      line.chomp('\r');
+      if(line.length()==0)
+	 continue;
+      ParseLine(line.get_non_const());
+   }
+   consumed+=used;
+   return used;
+}
+
 
 // Path implementation
 void FileAccess::Path::init()
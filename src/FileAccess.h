@@ -38,6 +38,7 @@
 #define UNKNOWN_POS  ((off_t)-1L)
 
 class ListInfo;
+class LongListParser;
 class Glob;
 class NoGlob;
 class DirList;
@@ -123,6 +124,7 @@ protected:
    off_t pos;
    off_t real_pos;
    off_t limit;
+   xarray<off_t> more_ranges; // start,limit pairs to get after [pos,limit)
 
    FileTimestamp *opt_date;
    off_t  *opt_size;
@@ -227,6 +229,7 @@ public:
    void Open2(const char *f1,const char *f2,open_mode m);
    void SetFileURL(const char *u);
    void SetLimit(off_t lim) { limit=lim; }
+   void AddRange(off_t s,off_t lim) { more_ranges.append(s); more_ranges.append(lim); }
    void SetSize(off_t s) { entity_size=s; }
    void SetDate(time_t d) { entity_date=d; }
    void WantDate(FileTimestamp *d) { opt_date=d; }
@@ -252,6 +255,10 @@ public:
 
    virtual int Read(Buffer *buf,int size) = 0;
    virtual int Write(const void *buf,int size) = 0;
+   // zero-copy transfer from/to a local file at its current offset;
+   // NOT_SUPP means the caller has to use Read/Write.
+   virtual int WriteFromFD(int fd,int size) { return NOT_SUPP; }
+   virtual int ReadToFD(int fd,int size) { return NOT_SUPP; }
    virtual int Buffered();
    virtual int StoreStatus() = 0;
    virtual bool IOReady();
@@ -287,6 +294,16 @@ public:
    virtual void DisconnectLL() {}
    virtual void UseCache(bool);
    virtual bool NeedSizeDateBeforehand();
+   // STORE at a non-zero position writes in place, so several sessions
+   // can upload different parts of one file.
+   virtual bool CanStoreAt() { return false; }
+   // the file opened for STORE exists (and is truncated) on the server.
+   virtual bool StoreOpened() { return false; }
+   // RETRIEVE can get the ranges added by AddRange in the same request,
+   // the position jumps to the start of each range when its data come.
+   virtual bool CanMultiRange() { return false; }
+   // current limit of connections to the server, 0 if unknown or none.
+   virtual int GetConnectionLimit() { return 0; }
 
    int GetErrorCode() { return error_code; }
 
@@ -317,6 +334,7 @@ public:
    virtual Glob *MakeGlob(const char *pattern);
    virtual DirList *MakeDirList(ArgV *a);
    virtual FileSet *ParseLongList(const char *buf,int len,int *err=0) const { return 0; }
+   virtual LongListParser *MakeLongListParser() const { return 0; }
 
    static bool NotSerious(int err) { return temporary_network_error(err); }
 
@@ -385,20 +403,33 @@ public:
 // shortcut
 #define FA FileAccess
 
-// cache of used sessions
+// cache of used sessions, the least recently used first
 class SessionPool
 {
-   enum { pool_size=64 };
-   static FileAccess *pool[pool_size];
+   struct entry
+   {
+      FileAccess *session;
+      int id;	 // stable number for `scache N'
+   };
+   static xarray<entry> pool;
+   static int next_id;
+   static int evictions;
+
+   static int CountHost(const char *host);
+   static void Evict(const char *host);
 
 public:
    static void Reuse(FileAccess *);
    static void Print(FILE *f);
-   static FileAccess *GetSession(int n);
+   static FileAccess *GetSession(int id);
 
    // start with n==0, then increase n; returns 0 when no more
    static FileAccess *Walk(int *n,const char *proto);
 
+   // logs in up to n more sessions like s in background,
+   // so that they are ready when a parallel job needs them.
+   static void Prewarm(const FileAccess *s,int n);
+
    static void ClearAll();
 };
 
@@ -476,6 +507,25 @@ public:
    void UseCache(bool y=true) { use_cache=y; }
 };
 
+// Parses a long listing line by line while it is coming.
+class LongListParser
+{
+   off_t consumed;
+   xstring line;
+protected:
+   virtual void ParseLine(char *line)=0;
+public:
+   LongListParser() : consumed(0) {}
+   virtual ~LongListParser() {}
+   // parses the complete lines in buf, returns the number of bytes used.
+   int Feed(const char *buf,int len);
+   off_t GetConsumed() const { return consumed; }
+   // the entries parsed so far, 0 if it is not known yet which are valid.
+   virtual const FileSet *GetPartial() const=0;
+   // caller has to delete the resulting FileSet itself.
+   virtual FileSet *Finish(int *err=0)=0;
+};
+
 #include "PatternSet.h"
 class ListInfo : public FileAccessOperation
 {
@@ -504,6 +554,8 @@ public:
    // caller has to delete the resulting FileSet itself.
    FileSet *GetResult() { return result.borrow(); }
    FileSet *GetExcluded() { return excluded.borrow(); }
+   // files parsed so far while the listing is still being received.
+   virtual const FileSet *GetPartialResult() const { return 0; }
    bool IsRecursive() const { return is_recursive; }
 
    void Need(unsigned mask) { need|=mask; }
@@ -39,6 +39,7 @@
 #include <cmath>
 #include <stddef.h>
 #include "FileCopy.h"
+#include "buffer_crlf.h"
 #include "url.h"
 #include "log.h"
 #include "misc.h"
@@ -71,6 +72,36 @@ enum {
 #define set_state(s) do { state=(s); \
    Log::global->Format(11,"FileCopy(%p) enters state %s\n", this, #s); } while(0)
 
+/* Move the data between a local file and a session without copying it
+   through user space.  Returns the number of bytes moved, 0 when waiting
+   for the session, or FA::NOT_SUPP when the buffered path has to be used. */
+int FileCopy::DoZeroCopy()
+{
+   int res=FA::NOT_SUPP;
+   FileCopyPeer *local=0;
+   if(!line_buffer && get->range_limit==FILE_END
+   && get->Size()==0 && put->Size()==0)
+   {
+      int fd=get->GetLocalFD();
+      if(fd!=-1)
+      {
+	 local=get.get_non_const();
+	 res=put->WriteFromFD(fd,ZERO_COPY_CHUNK);
+      }
+      else if((fd=put->GetLocalFD())!=-1)
+      {
+	 local=put.get_non_const();
+	 res=get->ReadToFD(fd,ZERO_COPY_CHUNK);
+      }
+   }
+   bool on=(res!=FA::NOT_SUPP);
+   get->ZeroCopy(on);
+   put->ZeroCopy(on);
+   if(res>0)
+      local->ZeroCopied(res);
+   return res;
+}
+
 int FileCopy::Do()
 {
    int m=STALL;
@@ -196,7 +227,7 @@ int FileCopy::Do()
       get->Resume();
       if(fail_if_cannot_seek && (get->GetRealPos()<get->range_start
 			      || put->GetRealPos()<put->range_start
-			      || get->GetRealPos()!=put->GetRealPos()))
+			      || (get->GetRealPos()!=put->GetRealPos() && !SkippedGap())))
       {
 	 SetError(_("seek failed"));
 	 return MOVED;
@@ -229,6 +260,18 @@ int FileCopy::Do()
 	 }
 	 if(put_pos<get_pos)
 	 {
+	    if(SkippedGap() && put->CanSeek(get->GetRealPos()))
+	    {
+	       // the source has skipped a gap between ranges.
+	       if(get->range_limit!=FILE_END && get->range_limit<=get->GetRealPos())
+		  goto eof;
+	       if(put->Buffered()>0)
+		  return m;
+	       debug((9,"copy: get skipped to the range at %lld, seeking put\n",
+			(long long)get->GetRealPos()));
+	       put->Seek(get->GetRealPos());
+	       return MOVED;
+	    }
 	    if(!get->CanSeek(put->GetRealPos()))
 	    {
 	       // we lose... How about a large buffer?
@@ -255,7 +298,7 @@ int FileCopy::Do()
 	    if(!put->CanSeek(get->GetRealPos()) || skip<skip_threshold)
 	    {
 	       // we have to skip some data
-	       get->Get(&b,&s);
+	       get->GetChunk(&b,&s);
 	       if(skip>s)
 		  skip=s;
 	       if(skip==0)
@@ -270,9 +313,25 @@ int FileCopy::Do()
 	    return MOVED;
 	 }
       }
+      {
+	 int res=DoZeroCopy();
+	 if(res!=FA::NOT_SUPP)
+	 {
+	    if(res==0)
+	       return m;
+	    bytes_count+=res;
+	    RateAdd(res);
+	    if(high_watermark<put_pos+res)
+	    {
+	       high_watermark=put_pos+res;
+	       high_watermark_timeout.Reset();
+	    }
+	    return MOVED;
+	 }
+      }
       if(put->IsFull())
 	 get->Suspend(); // stall the get.
-      get->Get(&b,&s);
+      get->GetChunk(&b,&s);   // the rest is taken on the next round
       if(b==0) // eof
       {
 	 debug((10,"copy: get hit eof\n"));
@@ -687,6 +746,18 @@ void FileCopy::SetRange(off_t s,off_t lim)
    put->SetRange(s,lim);
 }
 
+// get has jumped over the data between its ranges
+bool FileCopy::SkippedGap()
+{
+   if(get->ranges.count()==0)
+      return false;
+   off_t p=get->GetRealPos();
+   if(p<=put->GetRealPos())
+      return false;
+   return get->IsRangeStart(p)
+      || (get->range_limit!=FILE_END && get->range_limit<=p);
+}
+
 bool FileCopy::CheckFileSizeAtEOF() const
 {
    long long range_limit=GetRangeLimit();
@@ -745,6 +816,39 @@ void FileCopyPeer::SetRange(const off_t s,const off_t lim)
       Seek(range_start);
 }
 
+void FileCopyPeer::AddRange(off_t s,off_t lim)
+{
+   if(ranges.count()==0)
+   {
+      ranges.append(range_start);
+      ranges.append(range_limit);
+   }
+   ranges.append(s);
+   ranges.append(lim);
+   range_limit=lim;
+}
+bool FileCopyPeer::IsRangeStart(off_t p) const
+{
+   for(int i=2; i<ranges.count(); i+=2)
+      if(ranges[i]==p)
+	 return range_limit==FILE_END || p<range_limit;
+   return false;
+}
+// start of the first range after p if p is in a gap, -1 otherwise
+off_t FileCopyPeer::NextRangeStart(off_t p) const
+{
+   for(int i=0; i<ranges.count(); i+=2)
+   {
+      if(range_limit!=FILE_END && ranges[i]>=range_limit)
+	 break;
+      if(ranges[i]>p)
+	 return ranges[i];
+      if(p<ranges[i+1])
+	 return -1;
+   }
+   return -1;
+}
+
 bool FileCopyPeer::Done()
 {
    if(Error())
@@ -768,6 +872,7 @@ void FileCopyPeer::Seek(off_t offs)
    if(mode==PUT)
       pos-=Size();
    Empty();
+   ResetTranslation();
    eof=false;
    broken=false;
 }
@@ -839,6 +944,7 @@ FileCopyPeer::FileCopyPeer(dir_t m) : IOBuffer(m)
    write_allowed=true;
    done=false;
    auto_rename=false;
+   zero_copy=false;
    Suspend();  // don't do anything too early
 }
 
@@ -972,10 +1078,13 @@ int FileCopyPeerFA::Do()
 	    goto fxp_eof;
 	 return m;
       }
-      res=Put_LL(buffer+buffer_ptr,Size());
+      const char *b;
+      int s;
+      GetChunk(&b,&s);
+      res=Put_LL(b,s);
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       else if(res<0)
@@ -1028,7 +1137,7 @@ int FileCopyPeerFA::Do()
    case GET:
       if(eof)
 	 return m;
-      if(fxp)
+      if(fxp || zero_copy)
 	 return m;
       res=TuneGetSize(Get_LL(get_size));
       if(res>0)
@@ -1098,6 +1207,9 @@ void FileCopyPeerFA::OpenSession()
    current->Timeout(0);	// mark it MOVED.
    if(mode==GET)
    {
+      off_t next=NextRangeStart(seek_pos);
+      if(next>=0)
+	 seek_pos=next;	 // skip the gap
       if(size!=NO_SIZE && size!=NO_SIZE_YET && !ascii
       && (seek_pos>size || (seek_pos==size && size>0)))
       {
@@ -1146,6 +1258,30 @@ void FileCopyPeerFA::OpenSession()
    session->Open(file,FAmode,seek_pos);
    session->SetFileURL(orig_url);
    session->SetLimit(range_limit);
+   if(mode==GET && ranges.count()>0)
+   {
+      // the ranges left after seek_pos; without multi-range support the
+      // session stops at the end of the current range (see Get_LL).
+      bool first=true;
+      for(int i=0; i<ranges.count(); i+=2)
+      {
+	 off_t s=ranges[i];
+	 off_t lim=ranges[i+1];
+	 if(range_limit!=FILE_END && lim>range_limit)
+	    lim=range_limit;
+	 if(lim<=seek_pos || s>=lim)
+	    continue;
+	 if(first)
+	 {
+	    session->SetLimit(lim);
+	    first=false;
+	 }
+	 else if(session->CanMultiRange())
+	    session->AddRange(s,lim);
+	 else
+	    break;
+      }
+   }
    if(mode==PUT) {
       upload_state.Restore(session);
       if(e_size!=NO_SIZE && e_size!=NO_SIZE_YET)
@@ -1199,7 +1335,13 @@ int FileCopyPeerFA::Get_LL(int len)
    int res=0;
 
    if(session->IsClosed())
+   {
+      // the data of the previous range go first.
+      if(range_gap && Size()>0)
+	 return 0;
+      range_gap=false;
       OpenSession();
+   }
 
    if(eof)  // OpenSession can set eof=true.
       return 0;
@@ -1260,6 +1402,15 @@ int FileCopyPeerFA::Get_LL(int len)
    }
    else if(res==0)
    {
+      off_t next=NextRangeStart(session->GetPos());
+      if(next>=0)
+      {
+	 debug((10,"copy-peer: end of range, next one at %lld\n",(long long)next));
+	 session->Close();
+	 seek_pos=next;
+	 range_gap=true;
+	 return 0;
+      }
       debug((10,"copy-peer: EOF on %s\n",session->GetFileURL(session->GetFile()).get()));
       eof=true;
       FileAccess::cache->Add(session,file,FAmode,FA::OK,this);
@@ -1321,6 +1472,46 @@ int FileCopyPeerFA::Put_LL(const char *buf,int len)
    return res;
 }
 
+int FileCopyPeerFA::WriteFromFD(int fd,int size)
+{
+   if(mode!=PUT || fxp || ascii || do_mkdir || fileincreased || eof || Size()>0)
+      return FA::NOT_SUPP;
+
+   if(session->IsClosed())
+      OpenSession();
+
+   off_t io_at=pos;
+   if(GetRealPos()!=io_at)
+      return FA::NOT_SUPP;
+
+   int res=session->WriteFromFD(fd,size);
+   if(res==FA::DO_AGAIN)
+      return 0;
+   if(res<0)
+      return FA::NOT_SUPP;   // Put_LL will handle the error
+   seek_pos+=res;
+   pos+=res;
+   return res;
+}
+
+int FileCopyPeerFA::ReadToFD(int fd,int size)
+{
+   if(mode!=GET || fxp || ascii || eof || Size()>0 || session->IsClosed())
+      return FA::NOT_SUPP;
+
+   off_t io_at=pos;
+   if(GetRealPos()!=io_at || Size()>0)  // GetRealPos can roll back
+      return FA::NOT_SUPP;
+
+   int res=session->ReadToFD(fd,size);
+   if(res==FA::DO_AGAIN)
+      return 0;
+   if(res<0)
+      return FA::NOT_SUPP;   // Get_LL will handle the error
+   pos+=res;
+   return res;
+}
+
 int FileCopyPeerFA::PutEOF_LL()
 {
    if(mode==GET && session)
@@ -1361,6 +1552,7 @@ void FileCopyPeerFA::Init()
    get_delay=0;
    fxp=false;
    fileincreased=false;
+   range_gap=false;
    redirections=0;
    can_seek=true;
    can_seek0=true;
@@ -1419,6 +1611,13 @@ FileCopyPeer *FileCopyPeerFA::Clone()
 {
    FileCopyPeerFA *c=new FileCopyPeerFA(session->Clone(),file,FAmode);
    c->orig_url.set(orig_url);
+   if(mode==PUT)
+   {
+      // write to the same (maybe temporary) file, the original renames it.
+      c->file.set(file);
+      c->temp_file=false;
+      c->auto_rename=false;
+   }
    return c;
 }
 
@@ -1630,15 +1829,18 @@ int FileCopyPeerFDStream::Do()
       if(check_min_size && !eof && Size()<PUT_LL_MIN
       && put_ll_timer && !put_ll_timer->Stopped())
 	 break;
-      res=Put_LL(buffer+buffer_ptr,Size());
+      const char *b;
+      int s;
+      GetChunk(&b,&s);
+      res=Put_LL(b,s);
       if(res>0)
-	 buffer_ptr+=res;
+	 Consume(res);
       if(res!=0)
 	 m=MOVED;
       break;
 
    case GET:
-      if(eof)
+      if(eof || zero_copy)
 	 return m;
 
       res=TuneGetSize(Get_LL(get_size));
@@ -1705,6 +1907,32 @@ void FileCopyPeerFDStream::Seek(off_t new_pos)
    Seek_LL();
 }
 
+void FileCopyPeerFDStream::Ascii()
+{
+   FileCopyPeer::Ascii();
+#ifndef NATIVE_CRLF
+   // the positions stay in wire units, see CRLFTranslator.
+   SetTranslator(new CRLFTranslator(mode==GET?CRLFTranslator::ENCODE:CRLFTranslator::DECODE));
+#endif
+}
+
+int FileCopyPeerFDStream::GetLocalFD()
+{
+   if(ascii || GetTranslator() || Size()>0 || eof)
+      return -1;
+   if(mode==PUT && !write_allowed)
+      return -1;
+   int fd=getfd();
+   if(fd==-1)
+      return -1;
+   struct stat st;
+   if(fstat(fd,&st)==-1 || !S_ISREG(st.st_mode))
+      return -1;
+   if(need_seek && lseek(fd,seek_base+pos,SEEK_SET)==-1)
+      return -1;
+   return fd;
+}
+
 int FileCopyPeerFDStream::Get_LL(int len)
 {
    int res=0;
@@ -1736,7 +1964,7 @@ int FileCopyPeerFDStream::Get_LL(int len)
    if(need_seek)  // this does not combine with ascii.
       lseek(fd,seek_base+pos,SEEK_SET);
 
-   char *p=GetSpace(ascii?len*2:len);
+   char *p=GetSpace(len);
    res=read(fd,p,len);
    if(res==-1)
    {
@@ -1753,22 +1981,6 @@ int FileCopyPeerFDStream::Get_LL(int len)
    }
    stream->clear_status();
 
-#ifndef NATIVE_CRLF
-   if(ascii)
-   {
-      for(int i=res; i>0; i--)
-      {
-	 if(*p=='\n')
-	 {
-	    memmove(p+1,p,i);
-	    *p++='\r';
-	    res++;
-	 }
-	 p++;
-      }
-   }
-#endif
-
    if(res==0) {
       debug((10,"copy-peer: EOF on FD %d\n",fd));
       eof=true;
@@ -1785,39 +1997,6 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
    if(fd==-1)
       return 0;
 
-   int skip_cr=0;
-
-#ifndef NATIVE_CRLF
-   if(ascii)
-   {
-      // find where line ends.
-      const char *cr=buf;
-      for(;;)
-      {
-	 cr=(const char *)memchr(cr,'\r',len-(cr-buf));
-	 if(!cr)
-	    break;
-	 if(cr-buf<len-1 && cr[1]=='\n')
-	 {
-	    skip_cr=1;
-	    len=cr-buf;
-	    break;
-	 }
-	 if(cr-buf==len-1)
-	 {
-	    if(eof)
-	       break;
-	    len--;
-	    break;
-	 }
-	 cr++;
-      }
-   }
-#endif	 // NATIVE_CRLF
-
-   if(len==0)
-      return skip_cr;
-
    if(need_seek)  // this does not combine with ascii.
       lseek(fd,seek_base+pos-Size(),SEEK_SET);
 
@@ -1864,14 +2043,6 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
       return -1;
    }
    stream->clear_status();
-   if(res==len && skip_cr)
-   {
-      res+=skip_cr;
-      // performance gets worse because of writing a single char,
-      // but leaving uncomplete line on screen allows mixing it with debug text.
-      if(write(fd,"\n",1)==1)
-	 res+=1;
-   }
    if(put_ll_timer)
       put_ll_timer->Reset();
    return res;
@@ -67,9 +67,16 @@ protected:
    xstring_c suggested_filename;
    bool auto_rename;
 
+   bool zero_copy;   // FileCopy moves the data directly, don't do i/o
+
 public:
    off_t range_start; // NOTE: ranges are implemented only partially. (FIXME)
    off_t range_limit;
+   xarray<off_t> ranges; // start,limit pairs if the range has gaps
+
+   void AddRange(off_t s,off_t lim);
+   bool IsRangeStart(off_t p) const;
+   off_t NextRangeStart(off_t p) const;
 
    bool CanSeek() { return can_seek; }
    bool CanSeek0() { return can_seek0; }
@@ -101,11 +108,13 @@ public:
 
    bool Done();
 
-   void Ascii() { ascii=true; }
+   virtual void Ascii() { ascii=true; }
    virtual void NoCache() { use_cache=false; }
 
    virtual const char *GetStatus() { return 0; }
    virtual bool NeedSizeDateBeforehand() { return false; }
+   virtual bool CanStoreAt() { return false; }
+   virtual bool StoreOpened() { return false; }
 
    virtual pid_t GetProcGroup() { return 0; }
    virtual void Kill(int sig) {}
@@ -141,6 +150,13 @@ public:
    virtual FileCopyPeer *Clone() { return 0; }
    virtual const Ref<FDStream>& GetLocal() const { return Ref<FDStream>::null; }
 
+   // zero-copy support, see FileCopy::DoZeroCopy.
+   virtual int GetLocalFD() { return -1; } // regular file positioned at pos
+   virtual int WriteFromFD(int fd,int size) { return FA::NOT_SUPP; }
+   virtual int ReadToFD(int fd,int size) { return FA::NOT_SUPP; }
+   void ZeroCopy(bool on) { zero_copy=on; }
+   void ZeroCopied(int n) { pos+=n; }
+
    const char *GetSuggestedFileName() { return suggested_filename; }
    void SetSuggestedFileName(const char *f) { if(f) suggested_filename.set(f); }
    void AutoRename(bool yes=true) { auto_rename=yes; }
@@ -192,6 +208,10 @@ private:
    int  line_buffer_max;
 
    bool CheckFileSizeAtEOF() const;
+   bool SkippedGap();
+
+   enum { ZERO_COPY_CHUNK=0x100000 };
+   int DoZeroCopy();
 
 protected:
    void RateAdd(int a);
@@ -236,6 +256,9 @@ public:
    void FailIfCannotSeek() { fail_if_cannot_seek=true; }
    void SetRange(off_t s,off_t lim);
    void SetRangeLimit(off_t lim) { get->range_limit=lim; }
+   // add a range to get after the one given with SetRange, the data
+   // between the ranges are not copied.
+   void AddRange(off_t s,off_t lim) { get->AddRange(s,lim); put->range_limit=lim; }
    off_t GetRangeStart() const { return get->range_start; }
    off_t GetRangeLimit() const { return get->range_limit; }
    void RemoveSourceLater() { remove_source_later=true; }
@@ -336,6 +359,7 @@ class FileCopyPeerFA : public FileCopyPeer
 
    bool fxp;   // FXP (ftp<=>ftp copy) active
    bool fileincreased;
+   bool range_gap;   // the session is closed to skip to the next range
 
    UploadState upload_state;
    int redirections;
@@ -355,6 +379,8 @@ public:
    bool IOReady();
    off_t GetRealPos();
    void Seek(off_t new_pos);
+   int WriteFromFD(int fd,int size);
+   int ReadToFD(int fd,int size);
 
    int Buffered() { return Size()+session->Buffered(); }
 
@@ -365,6 +391,8 @@ public:
    const char *GetProto() const { return session->GetProto(); }
 
    bool NeedSizeDateBeforehand() { return session->NeedSizeDateBeforehand(); }
+   bool CanStoreAt() { return session->CanStoreAt(); }
+   bool StoreOpened() { return session->StoreOpened(); }
    void WantSize();
    void RemoveFile();
 
@@ -417,6 +445,8 @@ public:
    void DontCreateFgData() { create_fg_data=false; }
    void NeedSeek() { need_seek=true; }
    void CloseWhenDone() { close_when_done=true; }
+   void Ascii();
+   int GetLocalFD();
    void WantSize();
    void RemoveFile();
    void SetBase(off_t b) { seek_base=b; }
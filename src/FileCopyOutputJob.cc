@@ -67,10 +67,13 @@ int FileCopyPeerOutputJob::Do()
 
    while(Size()>0)
    {
-      int res=Put_LL(buffer+buffer_ptr,Size());
+      const char *b;
+      int s;
+      GetChunk(&b,&s);
+      int res=Put_LL(b,s);
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       if(res<0)
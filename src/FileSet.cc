@@ -364,75 +364,113 @@ void FileSet::Empty()
    ind=0;
 }
 
+/* Removes the entries for which drop() returns true. Both arrays are
+   sorted by name, so they are walked in parallel; match is the entry
+   of the other set with the same name or 0. */
+void FileSet::SubtractMatching(const FileSet *set,drop_f drop,int arg)
+{
+   assert(!sorted && set!=this);
+   int j=0,k=0;
+   int new_ind=ind;
+   for(int i=0; i<fnum; i++)
+   {
+      const FileInfo *match=0;
+      while(j<set->fnum)
+      {
+	 int cmp=strcmp(set->files[j]->name,files[i]->name);
+	 if(cmp>0)
+	    break;
+	 if(cmp==0)
+	 {
+	    match=set->files[j];
+	    break;
+	 }
+	 j++;
+      }
+      if(drop(files[i],match,arg))
+      {
+	 files[i]=0;
+	 if(i<ind)
+	    new_ind--;
+	 continue;
+      }
+      if(k<i)
+	 files[k]=files[i].borrow();
+      k++;
+   }
+   files.set_length(k);
+   ind=new_ind;
+}
+
+static bool drop_same(const FileInfo *f,const FileInfo *match,int ignore)
+{
+   return match && f->SameAs(match,ignore);
+}
 void FileSet::SubtractSame(const FileSet *set,int ignore)
 {
    if(!set)
       return;
-   for(int i=0; i<fnum; i++)
-   {
-      FileInfo *f=set->FindByName(files[i]->name);
-      if(f && files[i]->SameAs(f,ignore))
-	 Sub(i--);
-   }
+   SubtractMatching(set,drop_same,ignore);
 }
 
+static bool drop_any(const FileInfo *,const FileInfo *match,int)
+{
+   return match;
+}
 void FileSet::SubtractAny(const FileSet *set)
 {
    if(!set)
       return;
-   for(int i=0; i<fnum; i++)
-      if(set->FindByName(files[i]->name))
-	 Sub(i--);
+   SubtractMatching(set,drop_any);
 }
 
+static bool drop_not_in(const FileInfo *,const FileInfo *match,int)
+{
+   return !match;
+}
 void FileSet::SubtractNotIn(const FileSet *set)
 {
    if(!set) {
       Empty();
       return;
    }
-   for(int i=0; i<fnum; i++)
-      if(!set->FindByName(files[i]->name))
-	 Sub(i--);
+   SubtractMatching(set,drop_not_in);
+}
+
+static bool drop_same_type(const FileInfo *f,const FileInfo *match,int)
+{
+   return match && f->Has(FileInfo::TYPE) && match->Has(FileInfo::TYPE)
+      && f->filetype==match->filetype;
 }
 void FileSet::SubtractSameType(const FileSet *set)
 {
    if(!set)
       return;
-   for(int i=0; i<fnum; i++)
-   {
-      FileInfo *f=set->FindByName(files[i]->name);
-      if(f && files[i]->defined&FileInfo::TYPE && f->defined&FileInfo::TYPE
-      && files[i]->filetype==f->filetype)
-	 Sub(i--);
-   }
+   SubtractMatching(set,drop_same_type);
+}
+
+static bool drop_dirs(const FileInfo *f,const FileInfo *match,int)
+{
+   return match && f->TypeIs(FileInfo::DIRECTORY)
+      && match->TypeIs(FileInfo::DIRECTORY);
 }
 void FileSet::SubtractDirs(const FileSet *set)
 {
    if(!set)
       return;
-   for(int i=0; i<fnum; i++)
-   {
-      if(!files[i]->TypeIs(FileInfo::DIRECTORY))
-	 continue;
-      FileInfo *f=set->FindByName(files[i]->name);
-      if(f && f->TypeIs(f->DIRECTORY))
-	 Sub(i--);
-   }
+   SubtractMatching(set,drop_dirs);
+}
+
+static bool drop_not_older_dirs(const FileInfo *f,const FileInfo *match,int)
+{
+   return match && f->TypeIs(FileInfo::DIRECTORY) && f->Has(FileInfo::DATE)
+      && match->TypeIs(FileInfo::DIRECTORY) && match->NotOlderThan(f->date);
 }
 void FileSet::SubtractNotOlderDirs(const FileSet *set)
 {
    if(!set)
       return;
-   for(int i=0; i<fnum; i++)
-   {
-      if(!files[i]->TypeIs(FileInfo::DIRECTORY)
-      || !files[i]->Has(FileInfo::DATE))
-	 continue;
-      FileInfo *f=set->FindByName(files[i]->name);
-      if(f && f->TypeIs(f->DIRECTORY) && f->NotOlderThan(files[i]->date))
-	 Sub(i--);
-   }
+   SubtractMatching(set,drop_not_older_dirs);
 }
 
 void FileSet::SubtractTimeCmp(bool (FileInfo::*cmp)(time_t) const,time_t t)
@@ -1169,6 +1207,12 @@ void FileInfo::MakeLongName()
       longname.vappend(" -> ",symlink.get(),NULL);
 }
 
+// every FileInfo and every string in it is a separate heap block
+#define MALLOC_OVERHEAD (2*sizeof(void*))
+static size_t string_memory(const char *s,size_t len)
+{
+   return s ? len+1+MALLOC_OVERHEAD : 0;
+}
 size_t FileSet::EstimateMemory() const
 {
    size_t size=sizeof(FileSet)
@@ -1176,10 +1220,13 @@ size_t FileSet::EstimateMemory() const
       +sorted.count()*sorted.get_element_size();
    for(int i=0; i<fnum; i++)
    {
-      size+=sizeof(FileInfo);
-      size+=xstrlen(files[i]->name);
-      size+=xstrlen(files[i]->symlink);
-      size+=xstrlen(files[i]->longname);
+      const FileInfo *fi=files[i];
+      size+=sizeof(FileInfo)+MALLOC_OVERHEAD;
+      size+=string_memory(fi->name,fi->name.length());
+      size+=string_memory(fi->symlink,xstrlen(fi->symlink));
+      size+=string_memory(fi->longname,fi->longname.length());
+      size+=string_memory(fi->uri,xstrlen(fi->uri));
+      size+=string_memory(fi->data,fi->data.length());
    }
    return size;
 }
@@ -157,6 +157,9 @@ private:
    void	 Sub(int);
    FileInfo *Borrow(int);
 
+   typedef bool (*drop_f)(const FileInfo *f,const FileInfo *match,int arg);
+   void	 SubtractMatching(const FileSet *set,drop_f drop,int arg=0);
+
    void add_before(int pos,FileInfo *fi);
    void assert_sorted() const;
 
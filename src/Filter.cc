@@ -36,13 +36,17 @@
 #include "FileSet.h"
 #include "ResMgr.h"
 #include "log.h"
+#include "SMTask.h"
 
 #ifndef O_BINARY
 # define O_BINARY 0
 #endif
 
 FDStream::FDStream(int new_fd,const char *new_name)
-   : close_when_done(false), closed(false), fd(new_fd), name(new_name?expand_home_relative(new_name):0), status(0) {}
+   : close_when_done(false), closed(false), fd(new_fd), name(new_name?expand_home_relative(new_name):0), status(0)
+{
+   SMTask::FDOpened(fd);
+}
 FDStream::FDStream()
    : close_when_done(false), closed(false), fd(-1), status(0) {}
 
@@ -72,6 +76,7 @@ void FDStream::DoCloseFD()
 void FDStream::SetFD(int new_fd,bool c)
 {
    DoCloseFD();
+   SMTask::FDOpened(new_fd);
    fd=new_fd;
    close_when_done=c;
 }
@@ -470,7 +475,6 @@ off_t FileStream::get_size()
    return st.st_size;
 }
 
-#include "SMTask.h"
 bool FDStream::NonFatalError(int err)
 {
    if(err==EDQUOT || err==ENOSPC)
@@ -29,7 +29,7 @@
 #include "PatternSet.h"
 #include "buffer_std.h"
 
-#define top (*stack.last())
+#define top (*stack.last().get_non_const())
 #define stack_ptr (stack.count()-1)
 #define super SessionJob
 #define orig_session super::session
@@ -108,13 +108,12 @@ int FinderJob::Do()
 	 Enter(dir);
 
       Push(li->GetResult());
-      top.fset->rewind();
 
       li=0;
       state=LOOP;
       m=MOVED;
    case LOOP:
-      if(stack_ptr==-1 || top.fset->curr()==0)
+      if(stack_ptr==-1 || top.curr()==0)
       {
 	 Up();
 	 return MOVED;
@@ -127,7 +126,7 @@ int FinderJob::Do()
       // 2. we just returned from a subdir (depth_done)
       if(depth_first && !depth_done && (maxdepth == -1 || stack_ptr+1 < maxdepth))
       {
-	 FileInfo *f=top.fset->curr();
+	 const FileInfo *f=top.curr();
 	 if((f->defined&f->TYPE) && f->filetype==f->DIRECTORY)
 	 {
 	    Down(f->name);
@@ -138,7 +137,7 @@ int FinderJob::Do()
       state=PROCESSING;
       m=MOVED;
    case PROCESSING:
-      pres=ProcessFile(top.path,top.fset->curr());
+      pres=ProcessFile(top.path,top.curr());
 
       if(pres==PRF_LATER)
 	 return m;
@@ -169,15 +168,15 @@ int FinderJob::Do()
 	 return m;
       if(!depth_first && (maxdepth == -1 || stack_ptr+1 < maxdepth))
       {
-	 FileInfo *f=top.fset->curr();
+	 const FileInfo *f=top.curr();
 	 if((f->defined&f->TYPE) && f->filetype==f->DIRECTORY)
 	 {
-	    top.fset->next();
 	    Down(f->name);
+	    top.next();
 	    return MOVED;
 	 }
       }
-      top.fset->next();
+      top.next();
       return MOVED;
 
    case WAIT:
@@ -231,11 +230,22 @@ void FinderJob::Push(FileSet *fset)
     * on the filename portion only */
    if(exclude)
       fset->Exclude(0, exclude);
-   stack.append(new place(new_path,fset));
 
    /* give a chance to operate on the list as a whole, and
     * possibly sort it */
    ProcessList(fset);
+
+   stack.append(new place(new_path,fset));
+   delete fset;
+}
+
+const FileInfo *FinderJob::place::curr()
+{
+   if(ind>=fset->count())
+      return 0;
+   if(!fi)
+      fi=fset->MakeFileInfo(ind);
+   return fi;
 }
 
 void FinderJob::Down(const char *p)
@@ -25,6 +25,7 @@
 #include "ArgV.h"
 #include "GetFileInfo.h"
 #include "PatternSet.h"
+#include "CompactFileSet.h"
 
 class FinderJob : public SessionJob
 {
@@ -40,9 +41,15 @@ class FinderJob : public SessionJob
 	 friend class FinderJob;
 
 	 xstring_c path;
-	 Ref<FileSet> fset;
-
-	 place(const char *p,FileSet *f) : path(p), fset(f) {}
+	 /* listings of all parent directories stay on the stack,
+	    keep them compact. */
+	 Ref<CompactFileSet> fset;
+	 int ind;
+	 Ref<FileInfo> fi;   // the current entry, made on demand
+
+	 place(const char *p,FileSet *f) : path(p), fset(new CompactFileSet(f)), ind(0) {}
+	 const FileInfo *curr();
+	 void next() { ind++; fi=0; }
       };
 
    RefArray<place> stack;
@@ -35,14 +35,15 @@ FileSet *FtpListInfo::Parse(const char *buf,int len)
 {
    if(mode==FA::LONG_LIST || mode==FA::MP_LIST)
    {
-      if(len==0 && mode==FA::LONG_LIST
+      if(len==0 && (!parser || parser->GetConsumed()==0) && mode==FA::LONG_LIST
       && !ResMgr::QueryBool("ftp:list-empty-ok",session->GetHostName()))
       {
+	 parser=0;
 	 mode=FA::LIST;
 	 return 0;
       }
       int err;
-      FileSet *set=session->ParseLongList(buf,len,&err);
+      FileSet *set=ParseLongList(buf,len,&err);
       if(!set || err>0)
       {
 	 if(mode==FA::MP_LIST)
@@ -58,100 +59,157 @@ FileSet *FtpListInfo::Parse(const char *buf,int len)
    }
 }
 
-FileSet *Ftp::ParseLongList(const char *buf,int len,int *err_ret) const
+/* Tries all the line parsers until one of them wins by a wide margin,
+   keeping a FileSet for each meanwhile. The winner is remembered for the
+   site, so the next listing goes through it alone until it fails on a line. */
+class FtpLongListParser : public LongListParser
 {
-   if(err_ret)
-      *err_ret=0;
-
+   Ftp::SiteData *site;
+   xstring_c tz;
+   Ref<FileSet> set[number_of_parsers];
    int err[number_of_parsers];
-   FileSet *set[number_of_parsers];
-   int i;
-   for(i=0; i<number_of_parsers; i++)
+   int known;	 // the remembered parser, while it parses all lines
+   int guessed;	 // the winner, -1 while guessing
+   int best_err1;
+   int best_err2;
+   int lines;
+   bool failed;
+   xstring saved_line;
+   xstring tmp_line;
+
+   void Add(int i,FileInfo *info);
+   void Guess(const char *line,int skip);
+   void ParseLine(char *line);
+
+public:
+   FtpLongListParser(const Ftp *session);
+   const FileSet *GetPartial() const;
+   FileSet *Finish(int *err);
+};
+
+FtpLongListParser::FtpLongListParser(const Ftp *session)
+   : site(session->GetSiteData()),
+     tz(session->Query("timezone",session->GetHostName())),
+     guessed(-1), best_err1(0), best_err2(1), lines(0), failed(false)
+{
+   for(int i=0; i<number_of_parsers; i++)
    {
       err[i]=0;
       set[i]=new FileSet;
    }
+   known=site->GetLongListParser();
+   if(known>=number_of_parsers)
+      known=-1;
+}
 
-   xstring line;
-   xstring tmp_line;
-
-   FtpLineParser guessed_parser=0;
-   FileSet **the_set=0;
-   int *the_err=0;
-   int *best_err1=&err[0];
-   int *best_err2=&err[1];
-
-   const char *tz=Query("timezone",hostname);
+void FtpLongListParser::Add(int i,FileInfo *info)
+{
+   if(info && info->name.length()>1)
+      info->name.chomp('/');
+   if(info && !strchr(info->name,'/'))
+      set[i]->Add(info);
+   else
+      delete info;
+}
 
-   for(;;)
+// runs the line through all parsers but skip, which has seen it already.
+void FtpLongListParser::Guess(const char *line,int skip)
+{
+   for(int i=0; i<number_of_parsers; i++)
    {
-      const char *nl=(char*)memchr(buf,'\n',len);
-      if(!nl)
-	 break;
-      line.nset(buf,nl-buf);
-      line.chomp('\r');
-      if(line.length()==0)
+      if(i!=skip)
       {
-	 len-=nl+1-buf;
-	 buf=nl+1;
-	 continue;
+	 tmp_line.set(line);	 // parser can clobber the line - work on a copy
+	 Add(i,(*Ftp::line_parsers[i])(tmp_line.get_non_const(),&err[i],tz));
       }
-
-      len-=nl+1-buf;
-      buf=nl+1;
-
-      if(!guessed_parser)
+      if(err[best_err1]>err[i])
+	 best_err1=i;
+      if(err[best_err2]>err[i] && best_err1!=i)
+	 best_err2=i;
+      if(err[best_err1]>16)
       {
-	 for(i=0; i<number_of_parsers; i++)
-	 {
-	    tmp_line.set(line);	 // parser can clobber the line - work on a copy
-	    FileInfo *info=(*line_parsers[i])(tmp_line.get_non_const(),&err[i],tz);
-	    if(info && info->name.length()>1)
-	       info->name.chomp('/');
-	    if(info && !strchr(info->name,'/'))
-	       set[i]->Add(info);
-	    else
-	       delete info;
-
-	    if(*best_err1>err[i])
-	       best_err1=&err[i];
-	    if(*best_err2>err[i] && best_err1!=&err[i])
-	       best_err2=&err[i];
-	    if(*best_err1>16)
-	       goto leave; // too many errors with best parser.
-	 }
-	 if(*best_err2 > (*best_err1+1)*16)
-	 {
-	    i=best_err1-err;
-	    guessed_parser=line_parsers[i];
-	    the_set=&set[i];
-	    the_err=&err[i];
-	 }
-      }
-      else
-      {
-	 FileInfo *info=(*guessed_parser)(line.get_non_const(),the_err,tz);
-	 if(info && info->name.length()>1)
-	    info->name.chomp('/');
-	 if(info && !strchr(info->name,'/'))
-	    (*the_set)->Add(info);
-	 else
-	    delete info;
+	 failed=true; // too many errors with best parser.
+	 return;
       }
    }
-   if(!the_set)
+   if(err[best_err2] > (err[best_err1]+1)*16)
    {
-      i=best_err1-err;
-      the_set=&set[i];
-      the_err=&err[i];
+      guessed=best_err1;
+      site->SetLongListParser(guessed);
    }
-leave:
-   for(i=0; i<number_of_parsers; i++)
-      if(&set[i]!=the_set)
-	 delete set[i];
-   if(err_ret && the_err)
-      *err_ret=*the_err;
-   return the_set?*the_set:0;
+}
+
+void FtpLongListParser::ParseLine(char *line)
+{
+   if(failed)
+      return;
+   if(guessed>=0)
+   {
+      Add(guessed,(*Ftp::line_parsers[guessed])(line,&err[guessed],tz));
+      return;
+   }
+   if(known>=0)
+   {
+      saved_line.set(line);
+      FileInfo *info=(*Ftp::line_parsers[known])(line,&err[known],tz);
+      if(err[known]==0)
+      {
+	 Add(known,info);
+	 lines++;
+	 return;
+      }
+      delete info;
+      ProtoLog::LogNote(10,"listing format changed, guessing it again");
+      site->SetLongListParser(-1);
+      // the lines parsed so far count as errors for the other parsers.
+      for(int i=0; i<number_of_parsers; i++)
+	 if(i!=known)
+	    err[i]=lines;
+      int skip=known;
+      known=-1;
+      Guess(saved_line,skip);
+      return;
+   }
+   Guess(line,-1);
+}
+
+const FileSet *FtpLongListParser::GetPartial() const
+{
+   if(failed)
+      return 0;
+   if(guessed>=0)
+      return set[guessed];
+   if(known>=0)
+      return set[known];
+   return 0;
+}
+
+FileSet *FtpLongListParser::Finish(int *err_ret)
+{
+   if(err_ret)
+      *err_ret=0;
+   if(failed)
+      return 0;
+   int i=guessed;
+   if(i<0)
+      i=known;
+   if(i<0)
+      i=best_err1;
+   if(err_ret)
+      *err_ret=err[i];
+   return set[i].borrow();
+}
+
+LongListParser *Ftp::MakeLongListParser() const
+{
+   return new FtpLongListParser(this);
+}
+
+FileSet *Ftp::ParseLongList(const char *buf,int len,int *err) const
+{
+   FtpLongListParser parser(this);
+   parser.Feed(buf,len);
+   return parser.Finish(err);
 }
 
 FileSet *FtpListInfo::ParseShortList(const char *buf,int len)
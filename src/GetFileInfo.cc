@@ -80,6 +80,7 @@
 #include "GetFileInfo.h"
 #include "misc.h"
 #include "LsCache.h"
+#include "log.h"
 
 GetFileInfo::GetFileInfo(const FileAccessRef& a, const char *_dir, bool _showdir)
    : ListInfo(0,0), session(a), dir(_dir?_dir:""), origdir(a->GetCwd())
@@ -130,6 +131,22 @@ void GetFileInfo::MakeVerifyFileName()
    session->SetCwd(pwd);
 }
 
+/* Whether a file found in a partial listing needs nothing more from
+ * the listing: ListInfo may still ask for a precise date or a symlink
+ * target after the listing, and a directory means we have to retry. */
+bool GetFileInfo::IsCompleteEarly(const FileInfo *file) const
+{
+   if(!file->Has(file->TYPE) || file->filetype==file->SYMLINK)
+      return false;
+   if(!showdir && file->filetype==file->DIRECTORY)
+      return false;
+   if((file->defined&need)!=need)
+      return false;
+   if((need&file->DATE) && file->date.ts_prec>0)
+      return false;
+   return true;
+}
+
 int GetFileInfo::Do()
 {
    int res;
@@ -342,7 +359,26 @@ int GetFileInfo::Do()
       }
 
       if(!li->Done())
+      {
+	 /* Looking for one file in a big directory, take it as soon as
+	  * its line is parsed instead of waiting for the whole listing. */
+	 if(!was_directory && !exclude && !follow_symlinks)
+	 {
+	    const FileSet *partial=li->GetPartialResult();
+	    verify_fn.rtrim('/');
+	    const FileInfo *file=partial?partial->FindByName(verify_fn):0;
+	    if(file && IsCompleteEarly(file))
+	    {
+	       Log::global->Format(10,"GetFileInfo: found %s before the end of listing\n",verify_fn.get());
+	       li=0;
+	       result=new FileSet();
+	       result->Add(new FileInfo(*file));
+	       state=DONE;
+	       goto done;
+	    }
+	 }
 	 return m;
+      }
 
       state=DONE;
       m=MOVED;
@@ -67,6 +67,7 @@ class GetFileInfo : public ListInfo
    void PrepareToDie();
 
    void MakeVerifyFileName();
+   bool IsCompleteEarly(const FileInfo *file) const;
 
 public:
    GetFileInfo(const FileAccessRef& a, const char *path, bool showdir);
@@ -29,6 +29,9 @@
 #include <fnmatch.h>
 #include <locale.h>
 #include <assert.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include "Http.h"
 #include "ResMgr.h"
 #include "log.h"
@@ -166,7 +169,11 @@ void Http::Init()
 
    request_pos=0;
 
+   ranges_sent=0;
+   part_left=-1;
+
    no_ranges=false;
+   no_multi_range=false;
    seen_ranges_bytes=false;
    entity_date_set=false;
    sending_proppatch=false;
@@ -225,6 +232,7 @@ void Http::DisconnectLL()
 {
    Enter(this);
    rate_limit=0;
+   RaceStop();
    if(conn)
    {
       LogNote(7,_("Closing HTTP connection"));
@@ -271,6 +279,9 @@ void Http::ResetRequestData()
    chunk_size=CHUNK_SIZE_UNKNOWN;
    chunk_pos=0;
    request_pos=0;
+   ranges_sent=0;
+   multipart_boundary.set(0);
+   part_left=-1;
    propfind=0;
    inflate=0;
    seen_ranges_bytes=false;
@@ -315,6 +326,7 @@ void Http::Close()
    auth_sent[0]=auth_sent[1]=0;
    auth_scheme[0]=auth_scheme[1]=HttpAuth::NONE;
    no_ranges=!QueryBool("use-range",hostname);
+   no_multi_range=!QueryBool("use-multi-range",hostname);
    use_propfind_now=QueryBool("use-propfind",hostname);
    special=HTTP_NONE;
    special_data.set(0);
@@ -749,12 +761,29 @@ void Http::SendRequest(const char *connection,const char *f)
    case RETRIEVE:
    retrieve:
       SendMethod("GET",efile);
-      if(pos>0 && !no_ranges)
+      if((pos>0 || more_ranges.count()>0) && !no_ranges)
       {
-	 if(limit==FILE_END)
-	    Send("Range: bytes=%lld-\r\n",(long long)pos);
-	 else
-	    Send("Range: bytes=%lld-%lld\r\n",(long long)pos,(long long)limit-1);
+	 xstring range("bytes=");
+	 ranges_sent=0;
+	 if(limit==FILE_END || pos<limit)
+	 {
+	    range.appendf("%lld-",(long long)pos);
+	    if(limit!=FILE_END)
+	       range.appendf("%lld",(long long)limit-1);
+	    ranges_sent++;
+	 }
+	 // the current range can be complete when the connection breaks
+	 // between parts, then only the next ranges are requested.
+	 for(int i=0; i<more_ranges.count() && limit!=FILE_END; i+=2)
+	 {
+	    if(ranges_sent>0 && no_multi_range)
+	       break;
+	    range.appendf("%s%lld-%lld",ranges_sent>0?",":"",
+	       (long long)more_ranges[i],(long long)more_ranges[i+1]-1);
+	    ranges_sent++;
+	 }
+	 if(ranges_sent>0)
+	    Send("Range: %s\r\n",range.get());
       }
       break;
 
@@ -882,6 +911,7 @@ void Http::SendRequest(const char *connection,const char *f)
    request_pos=0;
    inflate=0;
    no_ranges=!QueryBool("use-range",hostname);
+   no_multi_range=!QueryBool("use-multi-range",hostname);
 
    conn->send_buf->SetPos(0);
 }
@@ -1136,6 +1166,14 @@ void Http::HandleHeaderLine(const char *name,const char *value)
       return;
    }
    case_hh("Content-Type",'C') {
+      if(H_PARTIAL(status_code) && ranges_sent>1
+      && !strncasecmp(value,"multipart/byteranges",20))
+      {
+	 const char *b=strstr(value,"boundary=");
+	 if(b)
+	    multipart_boundary.vset("--",HttpHeader::extract_quoted_value(b+9).get(),NULL);
+	 return;
+      }
       entity_content_type.set(value);
       const char *cs=strstr(value,"charset=");
       if(cs)
@@ -1451,7 +1489,7 @@ int Http::Do()
       timeout_timer.Reset();
 
    case CONNECTING:
-      res=Poll(conn->sock,POLLOUT,&error);
+      res=RaceConnect(&conn->sock,0,&error);
       if(res==-1)
       {
 	 LogError(0,_("Socket error (%s) - reconnecting"),error);
@@ -1880,8 +1918,27 @@ int Http::Do()
 	 inflate=new DirectedBuffer(DirectedBuffer::GET);
 	 inflate->SetTranslator(new DataInflator());
       }
+      if(ranges_sent>1 && H_2XX(status_code))
+      {
+	 if(!multipart_boundary || chunked || inflate)
+	 {
+	    // the server or a proxy ignored the extra ranges, or sent them
+	    // in a form we cannot split; use one range per request.
+	    LogNote(9,"multi-range request is not supported, disabling");
+	    ResMgr::Set(xstring::cat(ResPrefix(),":use-multi-range",NULL),hostname,"no");
+	    no_multi_range=true;
+	    if(multipart_boundary)
+	    {
+	       Disconnect();
+	       DontSleep();
+	       return MOVED;
+	    }
+	 }
+	 else
+	    real_pos=pos;  // the part headers have the real positions
+      }
       // sometimes it's possible to derive entity size from body size.
-      if(entity_size==NO_SIZE && body_size!=NO_SIZE
+      if(entity_size==NO_SIZE && body_size!=NO_SIZE && !multipart_boundary
       && pos==0 && !ModeIs(STORE) && !ModeIs(MAKE_DIR) && !inflate) {
 	 entity_size=body_size;
 	 if(opt_size && H_2XX(status_code))
@@ -2070,8 +2127,115 @@ void Http::_UpdatePos(int to_skip)
 	 chunk_pos+=to_skip;
       bytes_received+=to_skip;
    }
+   if(multipart_boundary)
+      part_left-=to_skip;
    real_pos+=to_skip;
 }
+
+bool Http::IsRangeStart(off_t p) const
+{
+   for(int i=0; i<more_ranges.count(); i+=2)
+      if(more_ranges[i]==p)
+	 return true;
+   return false;
+}
+// skip to the range which starts at real_pos
+void Http::NextRange()
+{
+   pos=real_pos;
+   while(more_ranges.count()>=2 && more_ranges[0]<=pos)
+   {
+      limit=more_ranges[1];
+      more_ranges.remove(0,2);
+   }
+   LogNote(10,"next range: %lld-%lld",(long long)pos,(long long)limit-1);
+}
+
+/* Parse the delimiter and the headers of the next part of a
+   multipart/byteranges body. Returns MOVED when the part data follow,
+   0 after the closing delimiter and DO_AGAIN if more data are needed. */
+int Http::ReadPartHeader()
+{
+   const char *buf;
+   int size;
+   conn->recv_buf->Get(&buf,&size);
+   const char *end=buf+size;
+
+   // the CRLF ending the previous part and the preamble are skipped.
+   const char *b=(const char*)memmem(buf,size,multipart_boundary,multipart_boundary.length());
+   if(!b)
+      goto not_yet;
+   b+=multipart_boundary.length();
+   if(end-b<2)
+      goto not_yet;
+   if(b[0]=='-' && b[1]=='-')
+   {
+      LogNote(9,_("Received last part"));
+      b+=2;
+      const char *nl=(const char*)memchr(b,'\n',end-b);
+      if(nl)
+	 b=nl+1;
+      bytes_received+=b-buf;
+      conn->recv_buf->Skip(b-buf);
+      body_size=bytes_received;
+      part_left=0;
+      return 0;
+   }
+   {
+      const char *nl=(const char*)memchr(b,'\n',end-b);
+      if(!nl)
+	 goto not_yet;
+      b=nl+1;
+      long long first=-1,last=-1,fsize=-1;
+      for(;;)
+      {
+	 nl=(const char*)memchr(b,'\n',end-b);
+	 if(!nl)
+	    goto not_yet;
+	 int len=nl-b;
+	 if(len>0 && b[len-1]=='\r')
+	    len--;
+	 if(len==0)
+	    break;
+	 if(len>14 && !strncasecmp(b,"Content-Range:",14))
+	 {
+	    const xstring& value=xstring::get_tmp(b+14,len-14);
+	    LogRecv(5,xstring::cat("Content-Range:",value.get(),NULL));
+	    if(sscanf(value,"%*s %lld-%lld/%lld",&first,&last,&fsize)<2)
+	       first=-1;
+	 }
+	 b=nl+1;
+      }
+      b=nl+1;
+      if(first<0 || last<first)
+      {
+	 LogError(0,"invalid multipart/byteranges response");
+	 ResMgr::Set(xstring::cat(ResPrefix(),":use-multi-range",NULL),hostname,"no");
+	 no_multi_range=true;
+	 Disconnect();
+	 return DO_AGAIN;
+      }
+      bytes_received+=b-buf;
+      conn->recv_buf->Skip(b-buf);
+      real_pos=first;
+      part_left=last-first+1;
+      if(fsize>=0 && !ModeIs(STORE))
+      {
+	 entity_size=fsize;
+	 if(opt_size)
+	    *opt_size=fsize;
+      }
+      return MOVED;
+   }
+
+not_yet:
+   if(conn->recv_buf->Eof())
+   {
+      LogError(0,_("Received not enough data, retrying"));
+      Disconnect();
+   }
+   return DO_AGAIN;
+}
 int Http::_Read(Buffer *buf,int size)
 {
    const char *buf1;
@@ -2114,6 +2278,13 @@ get_again:
    }
    if(size1==0 && (!inflate || inflate->Size()==0))
       return DO_AGAIN;
+   if(multipart_boundary && part_left<=0)
+   {
+      int res=ReadPartHeader();
+      if(res!=MOVED)
+	 return res;
+      goto get_again;
+   }
    if(chunked && size1>0)
    {
       if(chunked_trailer && state==RECEIVING_HEADER)
@@ -2173,6 +2344,8 @@ get_again:
       // limit by body_size.
       if(body_size>=0 && size1+bytes_received>=body_size)
 	 size1=body_size-bytes_received;
+      if(multipart_boundary && size1>part_left)
+	 size1=part_left;
    }
 
    int bytes_allowed=0x10000000;
@@ -2202,6 +2375,14 @@ get_again:
       return DO_AGAIN;
    if(norest_manual && real_pos==0 && pos>0)
       return DO_AGAIN;
+   if(real_pos>pos && IsRangeStart(real_pos))
+   {
+      // the data before the gap have to be consumed first,
+      // the reader sees the position jump to the next range.
+      if(buf->Size()==0)
+	 NextRange();
+      return DO_AGAIN;
+   }
    if(real_pos<pos)
    {
       off_t to_skip=pos-real_pos;
@@ -2282,6 +2463,65 @@ int Http::Write(const void *buf,int size)
    return(size);
 }
 
+/*
+   WriteFromFD - send the PUT body from a local file using sendfile(2).
+   Only used while send_buf is empty, so the data stay in order.
+*/
+int Http::WriteFromFD(int fd,int size)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+   if(!ModeIs(STORE))
+      return NOT_SUPP;
+
+   Resume();
+   Do();
+   if(Error())
+      return NOT_SUPP;	// Write will report it
+
+   if(!conn || state!=RECEIVING_HEADER || status!=0 || conn->send_buf->Size()!=0)
+      return DO_AGAIN;
+
+#if USE_SSL
+   if(conn->ssl)
+      return NOT_SUPP;
+#endif
+   if(!rate_limit->Unlimited(RateLimit::PUT))
+      return NOT_SUPP;
+
+   if(entity_size!=NO_SIZE && pos+size>entity_size)
+   {
+      size=entity_size-pos;
+      if(size<=0)
+	 return NOT_SUPP;  // Write will make it retry
+   }
+
+   ssize_t res=sendfile(conn->sock,fd,0,size);
+   if(res==-1)
+   {
+      if(errno==EAGAIN || errno==EINTR)
+      {
+	 Block(conn->sock,POLLOUT);
+	 return DO_AGAIN;
+      }
+      // not supported for this file or a real error, Write will tell.
+      return NOT_SUPP;
+   }
+   if(res==0)  // end of file, let the caller notice it
+      return NOT_SUPP;
+
+   conn->send_buf->SetPos(conn->send_buf->GetPos()+res);
+   if(retries>0 && conn->send_buf->GetPos()>Buffered()+0x1000)
+      TrySuccess();
+   rate_limit->BytesPut(res);
+   pos+=res;
+   real_pos+=res;
+   timeout_timer.Reset();
+   return(res);
+#else
+   return NOT_SUPP;
+#endif
+}
+
 int Http::SendEOT()
 {
    if(sent_eot)
@@ -2384,6 +2624,7 @@ void Http::Reconfig(const char *name)
    user_agent=ResMgr::Query("http:user-agent",c);
    use_propfind_now=(use_propfind_now && QueryBool("use-propfind",c));
    no_ranges=(no_ranges || !QueryBool("use-range",hostname));
+   no_multi_range=(no_multi_range || !QueryBool("use-multi-range",hostname));
 
    if(QueryBool("use-allprop",c)) {
       allprop.set(   // PROPFIND request
@@ -2436,6 +2677,7 @@ void Http::ResetLocationData()
    state=DISCONNECTED;
    use_propfind_now=QueryBool("use-propfind",hostname);
    no_ranges=!QueryBool("use-range",hostname);
+   no_multi_range=!QueryBool("use-multi-range",hostname);
 }
 
 DirList *Http::MakeDirList(ArgV *args)
@@ -160,6 +160,14 @@ class Http : public NetAccess
 
    off_t request_pos;
 
+   // multipart/byteranges
+   int ranges_sent;
+   xstring multipart_boundary;	// the delimiter, with leading "--"
+   off_t part_left;		// -1 when the part headers are expected
+   int ReadPartHeader();
+   bool IsRangeStart(off_t p) const;
+   void NextRange();
+
    Ref<DirectedBuffer> inflate;
    SMTaskRef<IOBuffer> propfind;
    xstring_c content_encoding;
@@ -168,6 +176,7 @@ class Http : public NetAccess
    bool CompressedContentType() const;
 
    bool no_ranges;
+   bool no_multi_range;
    bool seen_ranges_bytes;
    bool entity_date_set;
    bool sending_proppatch;
@@ -217,6 +226,7 @@ public:
    int Done();
    int Read(Buffer *,int);
    int Write(const void *,int);
+   int WriteFromFD(int fd,int size);
    int StoreStatus();
    int SendEOT();
    int Buffered();
@@ -238,6 +248,7 @@ public:
    void UseCache(bool use) { no_cache_this=!use; }
 
    bool NeedSizeDateBeforehand() { return true; }
+   bool CanMultiRange() { return !no_ranges && !no_multi_range; }
 
    void SuspendInternal();
    void ResumeInternal();
@@ -28,6 +28,7 @@
 #include <pwd.h>
 
 #include "LocalAccess.h"
+#include "buffer_crlf.h"
 #include "xstring.h"
 #include "misc.h"
 #include "log.h"
@@ -321,8 +322,9 @@ read_again:
 
    char *buf=buf0->GetSpace(size);
 #ifndef NATIVE_CRLF
+   // read to the upper half, so that the data can be expanded in place.
    if(ascii)
-      res=read(fd,buf,size/2);
+      res=read(fd,buf+size-size/2,size/2);
    else
 #endif
       res=read(fd,buf,size);
@@ -345,19 +347,7 @@ read_again:
 
 #ifndef NATIVE_CRLF
    if(ascii)
-   {
-      char *p=buf;
-      for(int i=res; i>0; i--)
-      {
-	 if(*p=='\n')
-	 {
-	    memmove(p+1,p,i);
-	    *p++='\r';
-	    res++;
-	 }
-	 p++;
-      }
-   }
+      res=CRLFTranslator::Encode(buf,buf+size-size/2,res);
 #endif
 
    real_pos+=res;
@@ -397,40 +387,26 @@ int LocalAccess::Write(const void *vbuf,int len)
    }
    stream->Kill(SIGCONT);
 
-   int skip_cr=0;
+   const char *in_buf=buf;
+   int in_len=len;
 
 #ifndef NATIVE_CRLF
    if(ascii)
    {
-      // find where line ends.
-      const char *cr=buf;
-      for(;;)
-      {
-	 cr=(const char *)memchr(cr,'\r',len-(cr-buf));
-	 if(!cr)
-	    break;
-	 if(cr-buf<len-1 && cr[1]=='\n')
-	 {
-	    skip_cr=1;
-	    len=cr-buf;
-	    break;
-	 }
-	 if(cr-buf==len-1)
-	 {
-	    if(len==1)	   // last CR in stream will be lost. (FIX?)
-	       skip_cr=1;
-	    len--;
-	    break;
-	 }
-	 cr++;
-      }
+      // a CR at the end can start a CRLF pair, it is left for the next call.
+      ascii_buf.get_space(len);
+      char *d=ascii_buf.get_non_const();
+      len=CRLFTranslator::Decode(d,in_buf,&in_len);
+      if(in_len==0)
+	 in_len=1;   // last CR in stream will be lost. (FIX?)
+      buf=d;
    }
-#endif	 // NATIVE_CRLF
+#endif
 
    if(len==0)
    {
-      pos=(real_pos+=skip_cr);
-      return skip_cr;
+      pos=(real_pos+=in_len);
+      return in_len;
    }
 
    int res=write(fd,buf,len);
@@ -465,7 +441,11 @@ int LocalAccess::Write(const void *vbuf,int len)
    stream->clear_status();
 
    if(res==len)
-      res+=skip_cr;
+      res=in_len;
+#ifndef NATIVE_CRLF
+   else if(ascii)
+      res=CRLFTranslator::DecodedSpan(in_buf,in_len,res);
+#endif
    pos=(real_pos+=res);
    return res;
 }
@@ -27,6 +27,7 @@ class LocalAccess : public FileAccess
 {
    Ref<FDStream> stream;
    bool done;
+   xstring ascii_buf;	// decoded data for Write in ascii mode
    void errno_handle();
    void fill_array_info();
 
@@ -59,6 +60,9 @@ public:
    ListInfo *MakeListInfo(const char *path);
    Glob	    *MakeGlob(const char *pattern);
    DirList  *MakeDirList(ArgV *a);
+
+   bool CanStoreAt() { return true; }
+   bool StoreOpened() { return mode==STORE && stream && stream->getfd()!=-1; }
 };
 
 #endif//LOCALACCESS_H
@@ -79,6 +79,7 @@ ResDecl res_cache_enable("cache:enable","yes",ResMgr::BoolValidate,0);
 ResDecl res_cache_expire("cache:expire","60m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_expire_neg("cache:expire-negative","1m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_size  ("cache:size","16M",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl res_cache_persist("cache:persist","no",ResMgr::BoolValidate,0);
 
 LsCache::LsCache() : Cache(&res_cache_size,&res_cache_enable) {}
 
@@ -92,18 +93,29 @@ void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const char *
    if(e!=FA::OK && e!=FA::NO_FILE && e!=FA::NOT_SUPP)
       return;
 
-   Trim();
-
    LsCacheEntry *c=Find(p_loc,a,m);
    if(!c)
    {
       if(!IsEnabled(p_loc->GetHostName()))
 	 return;
-      AddCacheEntry(new LsCacheEntry(p_loc,a,m,e,d,l,fs));
+      c=new LsCacheEntry(p_loc,a,m,e,d,l,fs);
+      AddCacheEntry(c,MakeKey(p_loc,a,m));
    }
    else
    {
       c->SetData(e,d,l,fs);
+      SizeChanged(c);
+   }
+   Trim();
+
+   // SetDirectory markers are cheap to rediscover, persist only listings.
+   LsCacheFile *df=(m==FA::CHANGE_DIR?0:GetDisk(p_loc));
+   if(df)
+   {
+      TimeIntervalR exp(ResMgr::Query(e==FA::OK?"cache:expire":"cache:expire-negative",c->GetClosure()));
+      time_t expire=exp.IsInfty()?0:SMTask::now.UnixTime()+exp.Seconds();
+      xstring site(DiskSite(p_loc).get());
+      df->Add(site,p_loc->GetCwd().path,a,m,e,d,l,expire);
    }
 }
 
@@ -124,40 +136,103 @@ void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const Buffer
    LsCache::Add(p_loc,a,m,e,cache_buffer,cache_buffer_size,fs);
 }
 
+// everything SameLocationAs compares in all protocols: host and cwd.
+const xstring& LsCache::MakeKey(const FileAccess *p_loc,const char *a,int m)
+{
+   xstring& key=xstring::get_tmp(p_loc->GetProto());
+   key.appendf(" %d ",m);
+   if(p_loc->GetHostName())
+      key.append(p_loc->GetHostName());
+   key.c_lc();
+   key.append(' ').append(p_loc->GetCwd().path).append(' ');
+   if(a)
+      key.append(a);
+   return key;
+}
+
 LsCacheEntry *LsCache::Find(const FileAccess *p_loc,const char *a,int m)
 {
    if(!IsEnabled(p_loc->GetHostName()))
       return 0;
 
    LsCacheEntry *c;
-   for(c=IterateFirst(); c; c=IterateNext())
+   for(c=FindFirst(MakeKey(p_loc,a,m)); c; c=c->NextSameKey())
    {
       if(c->Matches(p_loc,a,m))
 	 break;
    }
    if(c && c->Stopped())
    {
-      Trim();
+      Expired(c);
       return 0;
    }
    return c;
 }
 
-bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char **d,int *l,const FileSet **fs)
+// local listings are not worth sharing, they are read directly.
+LsCacheFile *LsCache::GetDisk(const FileAccess *p_loc)
+{
+   if(!strcmp(p_loc->GetProto(),"file"))
+      return 0;
+   if(!res_cache_persist.QueryBool(p_loc->GetHostName()))
+      return 0;
+   if(!disk)
+      disk=new LsCacheFile(dir_file(get_lftp_cache_dir(),"ls-cache"));
+   return disk.get_non_const();
+}
+const xstring& LsCache::DiskSite(const FileAccess *p_loc)
+{
+   return p_loc->GetConnectURL(FA::NO_PATH|FA::NO_PASSWORD);
+}
+
+// looks in memory, then in the cache file shared with other processes.
+LsCacheEntry *LsCache::Load(const FileAccess *p_loc,const char *a,int m)
 {
    LsCacheEntry *c=Find(p_loc,a,m);
+   if(c || m==FA::CHANGE_DIR || !IsEnabled(p_loc->GetHostName()))
+      return c;
+   LsCacheFile *df=GetDisk(p_loc);
+   if(!df)
+      return 0;
+   int e,l;
+   const char *d;
+   time_t expire;
+   xstring site(DiskSite(p_loc).get());  // DiskSite is a temporary
+   if(!df->Find(site,p_loc->GetCwd().path,a,m,&e,&d,&l,&expire))
+      return 0;
+   c=new LsCacheEntry(p_loc,a,m,e,d,l,0);
+   if(expire)
+      c->Set(TimeInterval(expire-SMTask::now.UnixTime(),0));
+   AddCacheEntry(c,MakeKey(p_loc,a,m));
+   Trim();
+   return Find(p_loc,a,m);
+}
+
+bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char **d,int *l,const FileSet **fs)
+{
+   LsCacheEntry *c=Load(p_loc,a,m);
    if(!c)
+   {
+      Miss();
       return false;
+   }
+   Hit(c);
    c->GetData(e,d,l,fs);
    return true;
 }
 
 const FileSet *LsCache::FindFileSet(const FileAccess *p_loc,const char *a,int m)
 {
-   LsCacheEntry *c=Find(p_loc,a,m);
+   LsCacheEntry *c=Load(p_loc,a,m);
    if(!c)
+   {
+      Miss();
       return 0;
-   return c->GetFileSet(c->loc);
+   }
+   Hit(c);
+   const FileSet *fs=c->GetFileSet(c->loc);
+   SizeChanged(c);
+   return fs;
 }
 const FileSet *LsCacheEntryData::GetFileSet(const FileAccess *parser)
 {
@@ -177,15 +252,14 @@ void LsCache::UpdateFileSet(const FileAccess *p_loc,const char *a,int m,const Fi
    if(!c)
       return;
    c->UpdateFileSet(fs);
+   SizeChanged(c);
 }
 
 void LsCache::List()
 {
-   Trim();
+   Expire();
 
-   long vol=0;
-   for(LsCacheEntry *c=IterateFirst(); c; c=IterateNext())
-      vol+=c->EstimateSize();
+   long vol=GetSize();
 
    printf(plural("%ld $#l#byte|bytes$ cached",vol),vol);
 
@@ -194,6 +268,15 @@ void LsCache::List()
       puts(_(", no size limit"));
    else
       printf(_(", maximum size %ld\n"),sizelimit);
+   printf(_("%d entries, %lu hits, %lu misses, %lu evictions\n"),
+      GetCount(),GetHits(),GetMisses(),GetEvictions());
+}
+
+void LsCache::Flush()
+{
+   Cache::Flush();
+   if(disk)
+      disk->Flush();
 }
 
 void LsCache::Changed(change_mode m,const FileAccess *f,const char *dir)
@@ -202,6 +285,13 @@ void LsCache::Changed(change_mode m,const FileAccess *f,const char *dir)
    if(m==FILE_CHANGED)
       dirname_modify(fdir);
 
+   LsCacheFile *df=GetDisk(f);
+   if(df)
+   {
+      xstring site(DiskSite(f).get());
+      df->Changed(site,f->GetCwd().path,fdir,m==TREE_CHANGED);
+   }
+
    LsCacheEntry *c=IterateFirst();
    while(c)
    {
@@ -23,6 +23,7 @@
 #include <time.h>
 #include "Cache.h"
 #include "FileAccess.h"
+#include "LsCacheFile.h"
 
 class Buffer;
 class FileAccess;
@@ -58,12 +59,20 @@ class LsCacheEntry : public CacheEntry, public LsCacheEntryLoc, public LsCacheEn
 {
 public:
    int EstimateSize() const;
+   LsCacheEntry *NextSameKey() const { return (LsCacheEntry*)CacheEntry::NextSameKey(); }
    LsCacheEntry(const FileAccess *p_loc,const char *a,int m,int e,const char *d,int l,const FileSet *fs);
 };
 
 class LsCache : public Cache
 {
+   Ref<LsCacheFile> disk;
+   LsCacheFile *GetDisk(const FileAccess *p_loc);
+   static const xstring& DiskSite(const FileAccess *p_loc);
+
+   static const xstring& MakeKey(const FileAccess *p_loc,const char *a,int m);
    LsCacheEntry *Find(const FileAccess *p_loc,const char *a,int m);
+   LsCacheEntry *Load(const FileAccess *p_loc,const char *a,int m);
+   LsCacheEntry *FindFirst(const xstring& key) const { return (LsCacheEntry*)Cache::FindFirst(key); }
    LsCacheEntry *IterateFirst() { return (LsCacheEntry*)Cache::IterateFirst(); }
    LsCacheEntry *IterateNext()  { return (LsCacheEntry*)Cache::IterateNext(); }
    LsCacheEntry *IterateDelete(){ return (LsCacheEntry*)Cache::IterateDelete(); }
@@ -94,6 +103,7 @@ public:
       }
 
    void List();
+   void Flush();
 };
 
 #endif//LSCACHE_H
@@ -0,0 +1,344 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "LsCacheFile.h"
+#include "misc.h"
+#include "log.h"
+
+/* File format: the magic, then records. A record is a header followed
+   by the site URL, cwd, argument and data bytes (not terminated), padded
+   with zeros to a multiple of 8. All numbers are in host byte order. */
+#define CACHE_MAGIC "lftpLsC1"
+#define CACHE_MAGIC_LEN 8
+#define COMPACT_MIN 0x100000
+
+LsCacheFile::LsCacheFile(const char *f)
+   : file(f), fd(-1), dev(0), ino(0), map(0), map_size(0),
+     indexed(0), dead(0), broken(false)
+{
+}
+LsCacheFile::~LsCacheFile()
+{
+   Close();
+}
+
+void LsCacheFile::MakeKey(xstring& key,const char *site,const char *cwd,const char *arg,int mode)
+{
+   key.setf("%d\n%s\n%s\n%s",mode,site,cwd?cwd:"",arg?arg:"");
+}
+
+int LsCacheFile::Lock(int fd,int type)
+{
+   struct flock lk;
+   memset(&lk,0,sizeof(lk));
+   lk.l_type=type;
+   lk.l_whence=SEEK_SET;
+   int res;
+   while((res=fcntl(fd,F_SETLKW,&lk))==-1 && errno==EINTR)
+      ;
+   if(res==-1 && E_LOCK_IGNORE(errno))
+      return 0;
+   return res;
+}
+
+bool LsCacheFile::Open()
+{
+   fd=open(file,O_RDWR|O_CREAT,0600);
+   if(fd==-1)
+   {
+      Log::global->Format(1,"%s: %s\n",file.get(),strerror(errno));
+      broken=true;
+      return false;
+   }
+   fcntl(fd,F_SETFD,FD_CLOEXEC);
+   struct stat st;
+   fstat(fd,&st);
+   dev=st.st_dev;
+   ino=st.st_ino;
+   return true;
+}
+void LsCacheFile::Close()
+{
+   if(map)
+      munmap((void*)map,map_size);
+   map=0;
+   map_size=0;
+   if(fd!=-1)
+      close(fd);
+   fd=-1;
+   index.empty();
+   indexed=0;
+   dead=0;
+}
+bool LsCacheFile::Replaced() const
+{
+   struct stat st;
+   return stat(file,&st)==-1 || st.st_dev!=dev || st.st_ino!=ino;
+}
+
+// maps the current file and indexes the new records; needs a lock.
+bool LsCacheFile::Map()
+{
+   // not get_tmp: there are few of them and the caller's may be in use.
+   xstring r_site,r_cwd,r_arg,key;
+   struct stat st;
+   if(fstat(fd,&st)==-1)
+      return false;
+   if((size_t)st.st_size<map_size)
+   {
+      Close();	 // should not happen, start over
+      return false;
+   }
+   if((size_t)st.st_size!=map_size)
+   {
+      if(map)
+	 munmap((void*)map,map_size);
+      map=0;
+      map_size=st.st_size;
+      void *m=mmap(0,map_size,PROT_READ,MAP_SHARED,fd,0);
+      if(m==MAP_FAILED)
+      {
+	 Log::global->Format(1,"%s: mmap: %s\n",file.get(),strerror(errno));
+	 map_size=0;
+	 broken=true;
+	 return false;
+      }
+      map=(const char*)m;
+   }
+   if(map_size==0)
+      return true;
+   if(indexed==0)
+   {
+      if(map_size<CACHE_MAGIC_LEN || memcmp(map,CACHE_MAGIC,CACHE_MAGIC_LEN))
+	 goto format_err;
+      indexed=CACHE_MAGIC_LEN;
+   }
+   while((size_t)indexed+sizeof(header)<=map_size)
+   {
+      const header *h=Record(indexed);
+      if(h->size<sizeof(header) || h->size%8 || (size_t)indexed+h->size>map_size
+      || sizeof(header)+(uint64_t)h->site_len+h->cwd_len+h->arg_len+h->data_len>h->size)
+	 goto format_err;
+      r_site.nset(Site(h),h->site_len);
+      r_cwd.nset(Cwd(h),h->cwd_len);
+      r_arg.nset(Arg(h),h->arg_len);
+      MakeKey(key,r_site,r_cwd,r_arg,h->mode);
+      off_t& slot=index.lookup_Lv(key);
+      if(slot)
+	 dead+=Record(slot)->size;
+      slot=indexed;
+      indexed+=h->size;
+   }
+   return true;
+
+format_err:
+   Log::global->Format(1,"%s: invalid cache file format at offset %lld\n",
+      file.get(),(long long)indexed);
+   broken=true;
+   return false;
+}
+
+bool LsCacheFile::Refresh()
+{
+   if(broken)
+      return false;
+   if(fd!=-1 && Replaced())
+      Close();
+   if(fd==-1 && !Open())
+      return false;
+   if(Lock(fd,F_RDLCK)==-1)
+      return false;
+   bool res=Map();
+   if(fd!=-1)
+      Lock(fd,F_UNLCK);
+   return res;
+}
+
+// locks the current file for writing, reopening it if it was replaced.
+bool LsCacheFile::WriteLock()
+{
+   if(broken)
+      return false;
+   for(;;)
+   {
+      if(fd==-1 && !Open())
+	 return false;
+      if(Lock(fd,F_WRLCK)==-1)
+	 return false;
+      if(!Replaced())
+	 return true;
+      Close();
+   }
+}
+void LsCacheFile::Unlock()
+{
+   if(fd!=-1)
+      Lock(fd,F_UNLCK);
+}
+
+bool LsCacheFile::Append(const xstring& site,const xstring& cwd,const xstring& arg,int mode,
+			 int err,const char *data,int len,time_t expire)
+{
+   header h;
+   memset(&h,0,sizeof(h));
+   h.mode=mode;
+   h.err=err;
+   h.site_len=site.length();
+   h.cwd_len=cwd.length();
+   h.arg_len=arg.length();
+   h.data_len=len;
+   h.expire=expire;
+   h.size=(sizeof(h)+h.site_len+h.cwd_len+h.arg_len+h.data_len+7)&~7;
+
+   xstring rec;
+   rec.nset((const char*)&h,sizeof(h));
+   rec.append(site).append(cwd).append(arg).append(data,len);
+   while(rec.length()<h.size)
+      rec.append('\0');
+
+   off_t end=lseek(fd,0,SEEK_END);
+   if(end==0)
+   {
+      rec.set_substr(0,0,CACHE_MAGIC);
+      indexed=0;
+   }
+   if(write(fd,rec,rec.length())!=(int)rec.length())
+   {
+      Log::global->Format(1,"%s: %s\n",file.get(),strerror(errno));
+      if(ftruncate(fd,end)==-1)
+	 broken=true;
+      return false;
+   }
+   return true;
+}
+
+// rewrites the live records (or none) to a new file; needs the write lock.
+void LsCacheFile::Compact(bool keep)
+{
+   if(keep && !Map())
+      return;
+   xstring tmp_file(file);
+   tmp_file.append(".tmp");
+   int tmp_fd=open(tmp_file,O_WRONLY|O_CREAT|O_TRUNC,0600);
+   if(tmp_fd==-1)
+   {
+      Log::global->Format(1,"%s: %s\n",tmp_file.get(),strerror(errno));
+      return;
+   }
+   xstring buf(CACHE_MAGIC);
+   time_t now=time(0);
+   int count=0;
+   if(keep)
+   {
+      for(off_t off=index.each_begin(); !index.each_finished(); off=index.each_next())
+      {
+	 const header *h=Record(off);
+	 if(h->err==DELETED || (h->expire && h->expire<=now))
+	    continue;
+	 buf.append((const char*)h,h->size);
+	 count++;
+      }
+   }
+   bool ok=(write(tmp_fd,buf,buf.length())==(int)buf.length());
+   if(close(tmp_fd)!=0)
+      ok=false;
+   if(!ok || rename(tmp_file,file)==-1)
+   {
+      Log::global->Format(1,"%s: %s\n",file.get(),strerror(errno));
+      remove(tmp_file);
+      return;
+   }
+   Log::global->Format(9,"cache: rewrote %s with %d listings\n",file.get(),count);
+   Close();
+}
+
+bool LsCacheFile::Find(const char *site,const char *cwd,const char *arg,int mode,
+		       int *err,const char **data,int *len,time_t *expire)
+{
+   if(!Refresh())
+      return false;
+   xstring key;
+   MakeKey(key,site,cwd,arg,mode);
+   off_t off=index.lookup(key);
+   if(!off)
+      return false;
+   const header *h=Record(off);
+   if(h->err==DELETED || (h->expire && h->expire<=time(0)))
+      return false;
+   *err=h->err;
+   *data=Data(h);
+   *len=h->data_len;
+   *expire=h->expire;
+   return true;
+}
+
+void LsCacheFile::Add(const char *site,const char *cwd,const char *arg,int mode,
+		      int err,const char *data,int len,time_t expire)
+{
+   if(!WriteLock())
+      return;
+   xstring r_site(site),r_cwd(cwd),r_arg(arg);
+   if(Map()
+   && Append(r_site,r_cwd,r_arg,mode,err,data,len,expire)
+   && dead>COMPACT_MIN && dead*2>indexed)
+      Compact(true);
+   Unlock();
+}
+
+void LsCacheFile::Changed(const char *site,const char *cwd,const char *dir,bool tree)
+{
+   if(!WriteLock())
+      return;
+   if(Map())
+   {
+      size_t site_len=strlen(site);
+      size_t dir_len=strlen(dir);
+      xstring r_site,r_cwd,r_arg;
+      for(off_t off=index.each_begin(); !index.each_finished(); off=index.each_next())
+      {
+	 const header *h=Record(off);
+	 if(h->err==DELETED || h->site_len!=site_len || memcmp(Site(h),site,site_len))
+	    continue;
+	 r_site.nset(Site(h),h->site_len);
+	 r_cwd.nset(Cwd(h),h->cwd_len);
+	 r_arg.nset(Arg(h),h->arg_len);
+	 const char *r_dir=dir_file(r_cwd,r_arg);
+	 if(r_cwd.ne(cwd) && (tree ? strncmp(dir,r_dir,dir_len) : strcmp(dir,r_dir)))
+	    continue;
+	 if(!Append(r_site,r_cwd,r_arg,h->mode,DELETED,0,0,0))
+	    break;
+      }
+   }
+   Unlock();
+}
+
+void LsCacheFile::Flush()
+{
+   if(!WriteLock())
+      return;
+   Compact(false);
+   Unlock();
+}
@@ -0,0 +1,94 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSCACHEFILE_H
+#define LSCACHEFILE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include "xstring.h"
+#include "xmap.h"
+
+/* Listing cache on disk, shared by concurrent lftp processes. Records
+ * are appended under a write lock and never changed in place; readers
+ * map the file and index the newest record of each location. When most
+ * of the file is dead, it is rewritten to a new file renamed over the
+ * old one; other processes notice the new inode and map it again. */
+class LsCacheFile
+{
+   struct header
+   {
+      uint32_t size;	 // of the whole record, a multiple of 8
+      int32_t mode;
+      int32_t err;	 // DELETED for a removed location
+      uint32_t site_len;
+      uint32_t cwd_len;
+      uint32_t arg_len;
+      uint32_t data_len;
+      uint32_t reserved;
+      int64_t expire;	 // 0 means never
+   };
+   enum { DELETED=-0x7fffffff };
+
+   xstring_c file;
+   int fd;
+   dev_t dev;
+   ino_t ino;
+   const char *map;
+   size_t map_size;
+   off_t indexed;	 // the records before it are in the index
+   off_t dead;		 // bytes in replaced records
+   xmap<off_t> index;	 // location key -> offset of the newest record
+   bool broken;
+
+   static void MakeKey(xstring& key,const char *site,const char *cwd,const char *arg,int mode);
+   static int Lock(int fd,int type);
+
+   bool Open();
+   void Close();
+   bool Replaced() const;
+   bool Map();
+   bool Refresh();
+   bool WriteLock();
+   void Unlock();
+   const header *Record(off_t off) const { return (const header*)(map+off); }
+   const char *Site(const header *h) const { return (const char*)(h+1); }
+   const char *Cwd(const header *h) const { return Site(h)+h->site_len; }
+   const char *Arg(const header *h) const { return Cwd(h)+h->cwd_len; }
+   const char *Data(const header *h) const { return Arg(h)+h->arg_len; }
+   bool Append(const xstring& site,const xstring& cwd,const xstring& arg,int mode,
+	       int err,const char *data,int len,time_t expire);
+   void Compact(bool keep);
+
+public:
+   LsCacheFile(const char *file);
+   ~LsCacheFile();
+
+   // the data pointer is valid until the next call.
+   bool Find(const char *site,const char *cwd,const char *arg,int mode,
+	     int *err,const char **data,int *len,time_t *expire);
+   void Add(const char *site,const char *cwd,const char *arg,int mode,
+	    int err,const char *data,int len,time_t expire);
+   // removes the listings of cwd and those of dir (with subdirectories if tree).
+   void Changed(const char *site,const char *cwd,const char *dir,bool tree);
+   void Flush();
+};
+
+#endif//LSCACHEFILE_H
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
 #include <mbswidth.h>
 #include "MirrorJob.h"
 #include "CmdExec.h"
@@ -44,6 +45,8 @@
    Log::global->Format(11,"mirror(%p) enters state %s\n", this, #s); } while(0)
 #define waiting_num waiting.count()
 #define transfer_count root_mirror->root_transfer_count
+#define listing_count root_mirror->root_listing_count
+#define large_job root_mirror->root_large_job
 
 xstring& MirrorJob::FormatStatus(xstring& s,int v,const char *tab)
 {
@@ -204,6 +207,8 @@ void MirrorJob::TransferStarted(CopyJob *cp)
 {
    if(transfer_count==0)
       root_mirror->transfer_start_ts=now;
+   file_transfers.append(cp);
+   root_mirror->root_file_transfers++;
    JobStarted(cp);
 }
 void MirrorJob::JobStarted(Job *j)
@@ -238,6 +243,15 @@ void MirrorJob::JobFinished(Job *j)
 {
    if(j->ExitCode()!=0)
       stats.error_count++;
+   if(j==large_job)
+      large_job=0;
+   for(int i=0; i<file_transfers.count(); i++) {
+      if(file_transfers[i]==j) {
+	 file_transfers.remove(i);
+	 root_mirror->root_file_transfers--;
+	 break;
+      }
+   }
    RemoveWaiting(j);
    Delete(j);
    assert(transfer_count>0);
@@ -289,7 +303,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
       filetype=file->filetype;
    else
    {
-      FileInfo *target=target_set->FindByName(file->name);
+      Ref<FileInfo> target(FindFile(target_list,file->name));
       if(target && target->Has(target->TYPE))
 	 filetype=target->filetype;
    }
@@ -301,18 +315,20 @@ void  MirrorJob::HandleFile(FileInfo *file)
       {
 	 bool remove_target=false;
 	 bool cont_this=false;
-	 bool use_pget=(pget_n>1) && target_is_local;
-	 if(file->Has(file->SIZE) && file->size<pget_minchunk*2)
+	 // uploads are done in parallel when the target can write at an offset
+	 bool use_pget=(pget_n>1)
+	    && (target_is_local || (source_is_local && target_session->CanStoreAt()));
+	 if(file->Has(file->SIZE) && (file->size<pget_minchunk*2
+				      || file->size<pget_min_size))
 	    use_pget=false;
 	 if(target_is_local)
 	 {
 	    if(lstat(target_name,&st)!=-1)
 	    {
 	       // few safety checks.
-	       FileInfo *old=new_files_set->FindByName(file->name);
-	       if(old)
+	       if(new_files_set->FindByName(file->name)>=0)
 		  goto skip;  // file has appeared after mirror start
-	       old=old_files_set->FindByName(file->name);
+	       Ref<FileInfo> old(FindFile(old_files_set,file->name));
 	       if(old && ((old->Has(old->SIZE) && old->size!=st.st_size)
 			||(old->Has(old->DATE) && old->date!=st.st_mtime)))
 		  goto skip;  // the file has changed after mirror start
@@ -323,7 +339,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	       }
 	    }
 	 }
-	 FileInfo *old=target_set->FindByName(FileCopy::TempFileName(file->name));
+	 Ref<FileInfo> old(FindFile(target_list,FileCopy::TempFileName(file->name)));
 	 if(old)
 	 {
 	    if(FlagSet(CONTINUE)
@@ -362,8 +378,10 @@ void  MirrorJob::HandleFile(FileInfo *file)
 
 	 if(script)
 	 {
-	    ArgV args(use_pget?"pget":"get");
-	    if(use_pget)
+	    // the script uses plain get with a file: URL for uploads
+	    bool script_pget=use_pget && target_is_local;
+	    ArgV args(script_pget?"pget":"get");
+	    if(script_pget)
 	    {
 	       args.Append("-n");
 	       args.Append(pget_n);
@@ -422,7 +440,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    goto skip;
 
 	 bool create_target_subdir=true;
-	 const FileInfo *old=0;
+	 Ref<FileInfo> old;
 
 	 if(FlagSet(TARGET_FLAT)) {
 	    create_target_subdir=false;
@@ -430,8 +448,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    goto do_submirror;
 	 }
 
-	 if(target_set)
-	    old=target_set->FindByName(file->name);
+	 old=FindFile(target_list,file->name);
 	 if(!old)
 	 {
 	    if(FlagSet(ONLY_EXISTING))
@@ -469,6 +486,16 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    }
 	 }
 
+	 if(!create_target_subdir && root_mirror->mirror_state
+	 && root_mirror->mirror_state->Unchanged(source_name_rel,file))
+	 {
+	    int dirs=root_mirror->mirror_state->Keep(source_name_rel);
+	    if(verbose_report>=3)
+	       Report(plural("Skipping unchanged directory `%s' (%d director$y|ies$)",dirs),
+		  target_name_rel,dirs);
+	    goto skip;
+	 }
+
       do_submirror:
 	 // launch sub-mirror
 	 MirrorJob *mj=new MirrorJob(this,
@@ -481,6 +508,8 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	 mj->target_relative_dir.set(target_name_rel);
 
 	 mj->create_target_dir=create_target_subdir;
+	 if(file->Has(file->DATE))
+	    mj->source_dir_stamp=file->date;
 
 	 if(verbose_report>=3) {
 	    if(FlagSet(SCAN_ALL_FIRST))
@@ -513,7 +542,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
 		  goto skip;
 	    }
 	    bool remove_target=false;
-	    FileInfo *old=target_set->FindByName(file->name);
+	    Ref<FileInfo> old(FindFile(target_list,file->name));
 	    if(old && !to_rm_mismatched->FindByName(file->name))
 	    {
 	       Report(_("Removing old file `%s'"),target_name_rel);
@@ -640,12 +669,14 @@ void  MirrorJob::InitSets()
    if(skip_noaccess)
       to_transfer->ExcludeUnaccessible(source_session->GetUser());
 
-   new_files_set=new FileSet(to_transfer);
-   new_files_set->SubtractAny(target_set);
-   old_files_set=new FileSet(target_set);
-   old_files_set->SubtractNotIn(to_transfer);
+   FileSet new_files(to_transfer);
+   new_files.SubtractAny(target_set);
+   FileSet old_files(target_set);
+   old_files.SubtractNotIn(to_transfer);
+   // only looked up by name later
+   old_files_set=new CompactFileSet(&old_files);
 
-   to_rm_mismatched=new FileSet(old_files_set);
+   to_rm_mismatched=new FileSet(&old_files);
    to_rm_mismatched->SubtractSameType(to_transfer);
    to_rm_mismatched->SubtractNotDirs();
 
@@ -658,12 +689,20 @@ void  MirrorJob::InitSets()
       to_transfer->SubtractDirs();
       same->UnsortFlat();
       to_mkdir->Empty();
-      new_files_set->UnsortFlat();
+      new_files.UnsortFlat();
    }
+   new_files_set=new CompactFileSet(&new_files);
 
    const char *sort_by=ResMgr::Query("mirror:sort-by",0);
    bool desc=strstr(sort_by,"-desc");
-   if(!strncmp(sort_by,"name",4))
+   mixed_order=false;
+   if(!strcmp(sort_by,"mixed"))
+   {
+      // smallest first, the largest are taken from the end
+      to_transfer->Sort(FileSet::BYSIZE,false,true);
+      mixed_order=true;
+   }
+   else if(!strncmp(sort_by,"name",4))
       to_transfer->SortByPatternList(ResMgr::Query("mirror:order",0));
    else if(!strncmp(sort_by,"date",4))
       to_transfer->Sort(FileSet::BYDATE);
@@ -694,17 +733,27 @@ void MirrorJob::ExcludeEmptyDir(const char *target_rel_dir)
 
    root_transfer_count is initialized once in ctor, so that change of
    mirror:parallel-directories setting won't disbalance the count.
+
+   In pipelined mode (parallel_listings>0) the directory scans are counted
+   in listing_count instead, so that they don't take transfer slots and
+   transfers don't hold off scanning of other directories.
 */
 void MirrorJob::MirrorStarted()
 {
    if(!parent_mirror)
       return;
+   if(parallel_listings>0)
+      listing_count++;
    transfer_count+=root_transfer_count;
 }
 void MirrorJob::MirrorFinished()
 {
    if(!parent_mirror)
       return;
+   if(parallel_listings>0) {
+      assert(listing_count>0);
+      listing_count--;
+   }
    assert(transfer_count>=root_transfer_count);
    transfer_count-=root_transfer_count;
 }
@@ -850,6 +899,20 @@ void MirrorJob::HandleListInfo(SMTaskRef<ListInfo>& list_info, Ref<FileSet>& set
    set->ExcludeDots(); // don't need .. and .
 }
 
+void MirrorJob::UpdateParallel()
+{
+   if(!root_mirror->tuner)
+      return;
+   if(!parent_mirror) {
+      int limit=source_session->GetConnectionLimit();
+      int limit2=target_session->GetConnectionLimit();
+      if(limit2>0 && (limit==0 || limit2<limit))
+	 limit=limit2;
+      tuner->Update(GetBytesCount(),root_file_transfers,limit);
+   }
+   parallel=root_mirror->tuner->Get();
+}
+
 int   MirrorJob::Do()
 {
    int	 res;
@@ -857,6 +920,8 @@ int   MirrorJob::Do()
    FileInfo *file;
    Job	 *j;
 
+   UpdateParallel();
+
    switch(state)
    {
    case(INITIAL_STATE):
@@ -864,6 +929,12 @@ int   MirrorJob::Do()
       if(!strcmp(target_dir,".") || !strcmp(target_dir,"..") || (FlagSet(SCAN_ALL_FIRST) && parent_mirror))
 	 create_target_dir=false;
 
+      if(!parent_mirror && parallel>1)
+      {
+	 // have the logins for the parallel transfers done meanwhile
+	 SessionPool::Prewarm(source_session,parallel-1);
+	 SessionPool::Prewarm(target_session,parallel-1);
+      }
       source_session->Chdir(source_dir);
       source_redirections=0;
       source_session->Roll();
@@ -987,6 +1058,9 @@ int   MirrorJob::Do()
 
       MirrorFinished(); // leave room for transfers.
 
+      if(root_mirror->mirror_state && source_set && !state_set)
+	 state_set=new CompactFileSet(source_set);
+
       if(FlagSet(DEPTH_FIRST) && source_set && !target_set)
       {
 	 // transfer directories first
@@ -1022,6 +1096,7 @@ int   MirrorJob::Do()
 	       root_mirror->target_set_excluded=target_set_excluded.borrow();
 	 }
 	 root_mirror->stats.dirs++;
+	 SaveDirState();   // deferred until the root's transfers succeed
 	 transfer_count++; // parent mirror will decrement it.
 	 goto pre_DONE;
       }
@@ -1047,6 +1122,9 @@ int   MirrorJob::Do()
 
       target_set->Merge(target_set_excluded);
       target_set_excluded=0;
+      // keep only a compact copy for lookups during the transfers
+      target_list=new CompactFileSet(target_set);
+      target_set=0;
 
       set_state(TARGET_REMOVE_OLD_FIRST);
       goto TARGET_REMOVE_OLD_FIRST_label;
@@ -1090,6 +1168,16 @@ int   MirrorJob::Do()
 
    pre_WAITING_FOR_TRANSFER:
       to_transfer->rewind();
+      large_index=(mixed_order?to_transfer->count()-1:-1);
+      to_scan=0;
+      if(parallel_listings>0 && !FlagSet(NO_RECURSION) && recursion_mode!=RECURSION_NEVER)
+      {
+	 // start scanning subdirectories before transferring the files,
+	 // so that the transfers don't wait for the listings later.
+	 to_scan=new FileSet(to_transfer);
+	 to_scan->SubtractNotDirs();
+	 to_scan->rewind();
+      }
       set_state(WAITING_FOR_TRANSFER);
       m=MOVED;
       /*fallthrough*/
@@ -1101,13 +1189,44 @@ int   MirrorJob::Do()
       }
       if(max_error_count>0 && stats.error_count>=max_error_count)
 	 goto pre_FINISHING;
+      while(to_scan && listing_count<parallel_listings && state==WAITING_FOR_TRANSFER)
+      {
+	 file=to_scan->curr();
+	 if(!file)
+	    break;
+	 HandleFile(file);
+	 to_scan->next();
+	 m=MOVED;
+      }
       while(transfer_count<parallel && state==WAITING_FOR_TRANSFER)
       {
 	 file=to_transfer->curr();
+	 bool large=false;
+	 if(large_index>=0)
+	 {
+	    // mixed order: one slot takes the largest files, so that they
+	    // don't pile up at the end, the others drain the small ones.
+	    if(to_transfer->curr_index()>large_index)
+	       file=0;
+	    else if(!large_job && parallel>1)
+	    {
+	       file=(*to_transfer)[large_index];
+	       large=true;
+	    }
+	 }
+	 if(to_scan && file && file->TypeIs(file->DIRECTORY))
+	 {
+	    // already handled via to_scan
+	    if(large)
+	       large_index--;
+	    else
+	       to_transfer->next();
+	    continue;
+	 }
 	 if(!file)
 	 {
 	    // go to the next step only when all transfers have finished
-	    if(waiting_num>0)
+	    if(waiting_num>0 || (to_scan && to_scan->curr()))
 	       break;
 	    if(FlagSet(DEPTH_FIRST))
 	    {
@@ -1129,8 +1248,19 @@ int   MirrorJob::Do()
 	    }
 	    goto pre_TARGET_REMOVE_OLD;
 	 }
-	 HandleFile(file);
-	 to_transfer->next();
+	 if(large)
+	 {
+	    int started=waiting_num;
+	    HandleFile(file);
+	    large_index--;
+	    if(waiting_num>started && file->TypeIs(file->NORMAL))
+	       large_job=waiting[waiting_num-1];
+	 }
+	 else
+	 {
+	    HandleFile(file);
+	    to_transfer->next();
+	 }
 	 m=MOVED;
       }
       break;
@@ -1257,7 +1387,7 @@ int   MirrorJob::Do()
 	    if((st.st_mode&07777)==(file->mode&~mode_mask))
 	       continue;
 	 }
-	 FileInfo *target=target_set->FindByName(file->name);
+	 Ref<FileInfo> target(FindFile(target_list,file->name));
 	 if(target && target->filetype==file->DIRECTORY && file->filetype==file->DIRECTORY
 	 && target->mode==(file->mode&~mode_mask) && (target->mode&0200))
 	    continue;
@@ -1343,11 +1473,26 @@ int   MirrorJob::Do()
 
       // all jobs finished and src dir removed, if needed.
 
+      if(stats.error_count==0)
+      {
+	 // the --scan-all-first subdirectories were transferred here
+	 if(mirror_state)
+	    mirror_state->CommitDeferred();
+	 SaveDirState();
+      }
       transfer_count++; // parent mirror will decrement it.
       if(parent_mirror)
 	 parent_mirror->stats.Add(stats);
       else
       {
+	 // directories with errors have not been updated, they are
+	 // scanned again next time.
+	 if(mirror_state && !script_only)
+	 {
+	    const char *err=mirror_state->Save();
+	    if(err)
+	       eprintf("mirror: %s\n",err);
+	 }
 	 if(stats.HaveSomethingDone(flags) && on_change)
 	 {
 	    CmdExec *exec=new CmdExec(GetExecSession().Clone(),0);
@@ -1426,6 +1571,8 @@ int   MirrorJob::Do()
 	 stats.Reset();
 	 source_set=0;
 	 target_set=0;
+	 target_list=0;
+	 state_set=0;
 	 goto pre_GETTING_LIST_INFO;
       }
       /*fallthrough*/
@@ -1433,7 +1580,7 @@ int   MirrorJob::Do()
       break;
    }
    // give direct parent priority over grand-parents.
-   if(transfer_count<parallel && parent_mirror)
+   if((transfer_count<parallel || listing_count<parallel_listings) && parent_mirror)
       m|=parent_mirror->Roll();
    return m;
 }
@@ -1444,7 +1591,8 @@ MirrorJob::MirrorJob(MirrorJob *parent,
  :
    bytes_transferred(0), bytes_to_transfer(0),
    source_dir(new_source_dir), target_dir(new_target_dir),
-   transfer_time_elapsed(0), root_transfer_count(0),
+   transfer_time_elapsed(0), root_transfer_count(0), root_listing_count(0),
+   root_large_job(0), root_file_transfers(0),
    verbose_report(0),
    parent_mirror(parent), root_mirror(parent?parent->root_mirror:this)
 {
@@ -1481,8 +1629,12 @@ MirrorJob::MirrorJob(MirrorJob *parent,
    skip_noaccess=false;
 
    parallel=1;
+   parallel_listings=0;
    pget_n=1;
    pget_minchunk=0x10000;
+   pget_min_size=0;
+   mixed_order=false;
+   large_index=-1;
 
    source_redirections=0;
    target_redirections=0;
@@ -1495,6 +1647,9 @@ MirrorJob::MirrorJob(MirrorJob *parent,
       // get file sets and start transfers.
       // See also comment at MirrorJob::MirrorStarted().
       root_transfer_count=parallel_dirs?1:1024;
+      parallel_listings=parent->parallel_listings;
+      if(parallel_listings>0)
+	 root_transfer_count=0;
 
       // inherit flags and other things
       SetFlags(parent->flags,1);
@@ -1509,6 +1664,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
       parallel=parent->parallel;
       pget_n=parent->pget_n;
       pget_minchunk=parent->pget_minchunk;
+      pget_min_size=parent->pget_min_size;
       remove_source_files=parent->remove_source_files;
       remove_source_dirs=parent->remove_source_dirs;
       skip_noaccess=parent->skip_noaccess;
@@ -1688,6 +1844,32 @@ void MirrorJob::SetOnChange(const char *oc)
    on_change.set(oc);
 }
 
+const char *MirrorJob::SetStateFile(const char *file,bool full_scan)
+{
+   xstring_c source_url(source_session->GetFileURL(source_dir,FA::NO_PASSWORD));
+   xstring_c target_url(target_session->GetFileURL(target_dir,FA::NO_PASSWORD));
+   mirror_state=new MirrorState(file,source_url,target_url);
+   if(full_scan)
+      mirror_state->FullScan();
+   const char *err=mirror_state->Load();
+   if(err)
+      mirror_state=0;
+   return err;
+}
+
+void MirrorJob::SaveDirState()
+{
+   if(!root_mirror->mirror_state || !state_set || script_only)
+      return;
+   const char *dir=source_relative_dir?source_relative_dir.get():"";
+   // with --scan-all-first the files of a subdirectory are transferred
+   // by the root mirror, so its state is only good when they all are.
+   if(FlagSet(SCAN_ALL_FIRST) && parent_mirror)
+      root_mirror->mirror_state->Defer(dir,source_dir_stamp,state_set.borrow());
+   else
+      root_mirror->mirror_state->Update(dir,source_dir_stamp,state_set.borrow());
+}
+
 const char *MirrorJob::AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg)
 {
    if(!optarg || !*optarg)
@@ -1817,6 +1999,9 @@ CMD(mirror)
       OPT_TRANSFER_ALL,
       OPT_TARGET_FLAT,
       OPT_DELETE_EXCLUDED,
+      OPT_STATE_FILE,
+      OPT_FULL_SCAN,
+      OPT_PARALLEL_LISTINGS,
    };
    static const struct option mirror_opts[]=
    {
@@ -1851,6 +2036,7 @@ CMD(mirror)
       {"Remove-source-dirs",no_argument,0,OPT_REMOVE_SOURCE_DIRS},
       {"Move",no_argument,0,OPT_REMOVE_SOURCE_DIRS},
       {"parallel",optional_argument,0,'P'},
+      {"parallel-listings",optional_argument,0,OPT_PARALLEL_LISTINGS},
       {"ignore-time",no_argument,0,OPT_IGNORE_TIME},
       {"ignore-size",no_argument,0,OPT_IGNORE_SIZE},
       {"only-missing",no_argument,0,OPT_ONLY_MISSING},
@@ -1879,6 +2065,8 @@ CMD(mirror)
       {"transfer-all",no_argument,0,OPT_TRANSFER_ALL},
       {"flat",no_argument,0,OPT_TARGET_FLAT},
       {"delete-excluded",no_argument,0,OPT_DELETE_EXCLUDED},
+      {"state-file",required_argument,0,OPT_STATE_FILE},
+      {"full-scan",no_argument,0,OPT_FULL_SCAN},
       {0}
    };
 
@@ -1899,6 +2087,8 @@ CMD(mirror)
    bool  remove_source_dirs=false;
    bool	 skip_noaccess=ResMgr::QueryBool("mirror:skip-noaccess",0);
    int	 parallel=-1;
+   bool	 auto_parallel=false;
+   int	 parallel_listings=-1;
    int	 use_pget=-1;
    bool	 reverse=false;
    bool	 script_only=false;
@@ -1906,6 +2096,8 @@ CMD(mirror)
    const char *script_file=0;
    const char *on_change=0;
    const char *recursion_mode=0;
+   const char *state_file=0;
+   bool full_scan=false;
    bool single_file=false;
    bool single_dir=false;
 
@@ -2060,11 +2252,18 @@ CMD(mirror)
 	 flags|=MirrorJob::IGNORE_TIME|MirrorJob::IGNORE_SIZE;
 	 break;
       case('P'):
+	 auto_parallel=ParallelTuner::IsAuto(optarg);
 	 if(optarg)
 	    parallel=atoi(optarg);
 	 else
 	    parallel=3;
 	 break;
+      case(OPT_PARALLEL_LISTINGS):
+	 if(optarg)
+	    parallel_listings=atoi(optarg);
+	 else
+	    parallel_listings=3;
+	 break;
       case(OPT_USE_PGET_N):
 	 if(optarg)
 	    use_pget=atoi(optarg);
@@ -2132,6 +2331,12 @@ CMD(mirror)
       case(OPT_DELETE_EXCLUDED):
 	 flags|=MirrorJob::DELETE_EXCLUDED;
 	 break;
+      case(OPT_STATE_FILE):
+	 state_file=optarg;
+	 break;
+      case(OPT_FULL_SCAN):
+	 full_scan=true;
+	 break;
       case('?'):
 	 eprintf(_("Try `help %s' for more information.\n"),args->a0());
       no_job:
@@ -2263,14 +2468,25 @@ CMD(mirror)
       return 0;
    }
 
-   if(parallel<0) {
-      int parallel1=ResMgr::Query("mirror:parallel-transfer-count",source_session->GetHostName());
-      int parallel2=ResMgr::Query("mirror:parallel-transfer-count",target_session->GetHostName());
+   if(parallel<0 && !auto_parallel) {
+      const char *p1=ResMgr::Query("mirror:parallel-transfer-count",source_session->GetHostName());
+      const char *p2=ResMgr::Query("mirror:parallel-transfer-count",target_session->GetHostName());
+      auto_parallel=ParallelTuner::IsAuto(p1) || ParallelTuner::IsAuto(p2);
+      int parallel1=atoi(p1);
+      int parallel2=atoi(p2);
       if(parallel1>0)
 	 parallel=parallel1;
       if(parallel2>0 && (parallel<0 || parallel>parallel2))
 	 parallel=parallel2;
    }
+   if(parallel_listings<0) {
+      int parallel1=ResMgr::Query("mirror:parallel-listing-count",source_session->GetHostName());
+      int parallel2=ResMgr::Query("mirror:parallel-listing-count",target_session->GetHostName());
+      if(parallel1>0)
+	 parallel_listings=parallel1;
+      if(parallel2>0 && (parallel_listings<0 || parallel_listings>parallel2))
+	 parallel_listings=parallel2;
+   }
    if(use_pget<0) {
       int use_pget1=ResMgr::Query("mirror:use-pget-n",source_session->GetHostName());
       int use_pget2=ResMgr::Query("mirror:use-pget-n",target_session->GetHostName());
@@ -2303,10 +2519,18 @@ CMD(mirror)
       parallel=0;
    if(parallel>64)
       parallel=64;   // a (in)sane limit.
-   if(parallel)
+   if(auto_parallel)
+      j->AutoParallel();
+   else if(parallel)
       j->SetParallel(parallel);
-   if(use_pget>1 && !(flags&MirrorJob::ASCII))
+   if(parallel_listings>64)
+      parallel_listings=64;
+   if(parallel_listings>0)
+      j->SetParallelListings(parallel_listings);
+   if(use_pget>1 && !(flags&MirrorJob::ASCII)) {
       j->SetPGet(use_pget);
+      j->SetPGetMinSize(ResMgr::Query("mirror:pget-min-size",0).to_unumber(LLONG_MAX));
+   }
 
    if(!recursion_mode && single_file && !single_dir)
       recursion_mode="never";
@@ -2333,6 +2557,15 @@ CMD(mirror)
       if(!script_file)
 	 j->SetScriptFile("-");
    }
+   if(state_file)
+   {
+      const char *err=j->SetStateFile(expand_home_relative(state_file),full_scan);
+      if(err)
+      {
+	 eprintf("%s: %s\n",args->a0(),err);
+	 return 0;
+      }
+   }
    j->SetMaxErrorCount(max_error_count);
    if(on_change)
       j->SetOnChange(on_change);
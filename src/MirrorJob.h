@@ -24,6 +24,8 @@
 #include "FileSet.h"
 #include "Job.h"
 #include "PatternSet.h"
+#include "MirrorState.h"
+#include "ParallelTuner.h"
 #include "misc.h"
 
 class MirrorJob : public Job
@@ -65,6 +67,7 @@ private:
    long long bytes_to_transfer;
 
    Ref<FileSet> target_set;
+   Ref<CompactFileSet> target_list; // target_set after InitSets, for lookups
    Ref<FileSet> target_set_excluded;
    Ref<FileSet> source_set;
    Ref<FileSet> target_set_recursive;
@@ -75,11 +78,18 @@ private:
    Ref<FileSet> same;
    Ref<FileSet> to_rm;
    Ref<FileSet> to_rm_mismatched;
-   Ref<FileSet> old_files_set;
-   Ref<FileSet> new_files_set;
+   Ref<CompactFileSet> old_files_set;
+   Ref<CompactFileSet> new_files_set;
    Ref<FileSet> to_rm_src;
+   Ref<FileSet> to_scan;   // subdirectories to be scanned, in pipelined mode
+   bool mixed_order;	   // to_transfer is sorted by size, see large_index
+   int large_index;	   // the largest file not yet handled, in mixed order
+   Ref<CompactFileSet> state_set; // source listing to be saved in the state file
    void InitSets(); // deduce above sets from source_set and target_set
    void ExcludeEmptyDir(const char *target_rel_dir);
+   static FileInfo *FindFile(const CompactFileSet *set,const char *name) {
+      return set ? set->MakeFileInfo(name) : 0;
+   }
    bool only_dirs;  // to_transfer (or to_mkdir) contains directories only
 
    void RemoveSourceLater(const FileInfo *fi) {
@@ -136,6 +146,15 @@ private:
    /* root_transfer_count is the global counter in the root mirror,
     * and weight of a non-root mirror in global transfer_count otherwise. */
    int	 root_transfer_count;
+   /* number of directories being scanned, in the root mirror only;
+    * it is limited by parallel_listings separately from transfers. */
+   int	 root_listing_count;
+   Job  *root_large_job;   // the transfer holding the slot for large files
+   /* running file transfers in the whole tree, in the root mirror only;
+    * unlike transfer_count it does not include the weights of the
+    * subdirectory mirrors, so it can be given to the parallel tuner. */
+   int	 root_file_transfers;
+   xarray<Job*> file_transfers;	 // started by this mirror
 
    unsigned flags;
    recursion_mode_t recursion_mode;
@@ -168,11 +187,19 @@ private:
    bool skip_noaccess;
 
    int parallel;
+   int parallel_listings;  // >0 enables pipelined mode
+   Ref<ParallelTuner> tuner;  // chooses parallel in auto mode, root only
+   void UpdateParallel();
    int pget_n;
    int pget_minchunk;
+   off_t pget_min_size;	   // smaller files are copied without pget
 
    xstring_c on_change;
 
+   Ref<MirrorState> mirror_state;	 // only in the root mirror
+   FileTimestamp source_dir_stamp;   // as seen in the parent listing
+   void SaveDirState();
+
    mode_t get_mode_mask();
 
    int source_redirections;
@@ -265,7 +292,10 @@ public:
    void	 SkipNoAccess() { skip_noaccess=true; }
 
    void  SetParallel(int p) { parallel=p; }
+   void  AutoParallel() { tuner=new ParallelTuner("mirror"); parallel=tuner->Get(); }
+   void  SetParallelListings(int p) { parallel_listings=p; }
    void  SetPGet(int n) { pget_n=n; }
+   void  SetPGetMinSize(off_t s) { pget_min_size=s; }
 
    void Fg();
    void Bg();
@@ -278,6 +308,7 @@ public:
       }
    void SetMaxErrorCount(int ec) { max_error_count=ec; }
    void SetOnChange(const char *oc);
+   const char *SetStateFile(const char *file,bool full_scan);
    static const char *AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg);
    static const char *AddPatternsFrom(Ref<PatternSet>& exclude,char opt,const char *file);
 
@@ -0,0 +1,296 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "MirrorState.h"
+#include "url.h"
+#include "misc.h"
+#include "log.h"
+
+/* State file format:
+      lftp-mirror-state 1
+      source URL
+      target URL
+      time T
+      dir TS PREC PATH
+      f DEFINED TYPE MODE DATE PREC SIZE NLINKS NAME SYMLINK USER GROUP
+      ...
+   Strings are url-encoded, so that they contain no spaces;
+   the root directory has PATH ".". */
+#define STATE_MAGIC "lftp-mirror-state 1"
+#define STATE_UNSAFE URL_UNSAFE
+
+MirrorState::MirrorState(const char *f,const char *src,const char *dst)
+   : file(f), source_url(src), target_url(dst)
+{
+   old_time=NO_DATE;
+   start_time=time(0);
+   full_scan=false;
+}
+
+static void append_field(xstring& s,const char *f)
+{
+   s.append(' ');
+   if(!f || !*f)
+      s.append('-');
+   else if(!strcmp(f,"-"))
+      s.append("%2D");
+   else
+      s.append_url_encoded(f,STATE_UNSAFE);
+}
+
+void MirrorState::WriteFileInfo(FILE *f,const FileInfo *fi)
+{
+   xstring& line=xstring::format("f %o %d %lo %lld %d %lld %d",
+      fi->defined,(int)fi->filetype,(unsigned long)fi->mode,
+      (long long)fi->date.ts,fi->date.ts_prec,(long long)fi->size,fi->nlinks);
+   append_field(line,fi->name);
+   append_field(line,fi->symlink);
+   append_field(line,fi->user);
+   append_field(line,fi->group);
+   fprintf(f,"%s\n",line.get());
+}
+
+FileInfo *MirrorState::ParseFileInfo(char *line)
+{
+   unsigned defined;
+   int type;
+   unsigned long mode;
+   long long date,size;
+   int prec,nlinks;
+   int n=0;
+   if(sscanf(line,"f %o %d %lo %lld %d %lld %d %n",
+	 &defined,&type,&mode,&date,&prec,&size,&nlinks,&n)<7 || n==0)
+      return 0;
+   char *field[4];
+   char *p=line+n;
+   for(int i=0; i<4; i++) {
+      field[i]=strtok(i==0?p:0," ");
+      if(!field[i])
+	 return 0;
+      if(!strcmp(field[i],"-"))
+	 field[i][0]=0;
+   }
+   FileInfo *fi=new FileInfo(url::decode(field[0]));
+   if(defined&fi->TYPE)
+      fi->SetType((FileInfo::type)type);
+   if(defined&fi->SYMLINK_DEF)
+      fi->SetSymlink(url::decode(field[1]));
+   if(defined&fi->MODE)
+      fi->SetMode(mode);
+   if(defined&fi->DATE)
+      fi->SetDate(date,prec);
+   if(defined&fi->SIZE)
+      fi->SetSize(size);
+   if(defined&fi->NLINKS)
+      fi->SetNlink(nlinks);
+   if(defined&fi->USER)
+      fi->SetUser(url::decode(field[2]));
+   if(defined&fi->GROUP)
+      fi->SetGroup(url::decode(field[3]));
+   return fi;
+}
+
+const char *MirrorState::Load()
+{
+   FILE *f=fopen(file,"r");
+   if(!f) {
+      if(errno==ENOENT)
+	 return 0;   // first run
+      return xstring::format("%s: %s",file.get(),strerror(errno));
+   }
+
+   const char *err=0;
+   xstring line;
+   xstring path;
+   Dir *dir=0;
+   int lineno=0;
+   int c;
+   while(!feof(f)) {
+      line.truncate();
+      while((c=getc(f))!=EOF && c!='\n')
+	 line.append(c);
+      if(line.length()==0)
+	 continue;
+      lineno++;
+      char *s=line.get_non_const();
+      if(lineno==1) {
+	 if(strcmp(s,STATE_MAGIC))
+	    goto format_err;
+	 continue;
+      }
+      if(!strncmp(s,"source ",7)) {
+	 if(strcmp(url::decode(s+7),source_url))
+	    goto mismatch;
+      } else if(!strncmp(s,"target ",7)) {
+	 if(strcmp(url::decode(s+7),target_url))
+	    goto mismatch;
+      } else if(!strncmp(s,"time ",5)) {
+	 long long t;
+	 if(sscanf(s+5,"%lld",&t)<1)
+	    goto format_err;
+	 old_time=t;
+      } else if(!strncmp(s,"dir ",4)) {
+	 long long ts;
+	 int prec,n=0;
+	 if(sscanf(s+4,"%lld %d %n",&ts,&prec,&n)<2 || n==0)
+	    goto format_err;
+	 path.set(url::decode(s+4+n));
+	 if(path.eq("."))
+	    path.truncate();
+	 dir=new Dir;
+	 dir->stamp.set(ts,prec);
+	 dir->set=new CompactFileSet();
+	 old_dirs.add(path,dir);
+      } else if(s[0]=='f' && s[1]==' ') {
+	 Ref<FileInfo> fi(ParseFileInfo(s));
+	 if(!fi || !dir)
+	    goto format_err;
+	 dir->set->Add(fi);
+      } else
+	 goto format_err;
+   }
+   if(lineno>0 && old_time==NO_DATE)
+      goto format_err;
+   if(Log::global->WillOutput(9)) {
+      size_t mem=0;
+      for(Dir *d=old_dirs.each_begin(); d; d=old_dirs.each_next())
+	 mem+=d->set->EstimateMemory();
+      Log::global->Format(9,"mirror: loaded %d directories from %s (%lu bytes in memory)\n",
+	 old_dirs.count(),file.get(),(unsigned long)mem);
+   }
+out:
+   fclose(f);
+   return err;
+
+mismatch:
+   err=xstring::format(_("%s: the state file belongs to another mirror"),file.get());
+   old_dirs.empty();
+   goto out;
+format_err:
+   err=xstring::format(_("%s: invalid state file format (line %d)"),file.get(),lineno);
+   old_dirs.empty();
+   goto out;
+}
+
+const char *MirrorState::Save()
+{
+   if(new_dirs.count()==0)
+      return 0;	  // nothing was scanned successfully, keep the old state
+
+   xstring tmp_file(file);
+   tmp_file.append(".tmp");
+   FILE *f=fopen(tmp_file,"w");
+   if(!f)
+      return xstring::format("%s: %s",tmp_file.get(),strerror(errno));
+
+   fprintf(f,"%s\n",STATE_MAGIC);
+   fprintf(f,"source %s\n",url::encode(source_url,STATE_UNSAFE).get());
+   fprintf(f,"target %s\n",url::encode(target_url,STATE_UNSAFE).get());
+   fprintf(f,"time %lld\n",(long long)start_time);
+   for(Dir *d=new_dirs.each_begin(); d; d=new_dirs.each_next()) {
+      const xstring& path=new_dirs.each_key();
+      fprintf(f,"dir %lld %d %s\n",(long long)d->stamp.ts,d->stamp.ts_prec,
+	 path.length()>0?url::encode(path,STATE_UNSAFE).get():".");
+      if(!d->set)
+	 continue;
+      for(int i=0; i<d->set->count(); i++) {
+	 Ref<FileInfo> fi(d->set->MakeFileInfo(i));
+	 WriteFileInfo(f,fi);
+      }
+   }
+   if(ferror(f) | (fclose(f)!=0)) {
+      int saved_errno=errno;
+      remove(tmp_file);
+      return xstring::format("%s: %s",tmp_file.get(),strerror(saved_errno));
+   }
+   if(rename(tmp_file,file)==-1) {
+      int saved_errno=errno;
+      remove(tmp_file);
+      return xstring::format("%s: %s",file.get(),strerror(saved_errno));
+   }
+   Log::global->Format(9,"mirror: saved %d directories to %s\n",new_dirs.count(),file.get());
+
+   // the saved state is the base for the next run (mirror --loop)
+   old_dirs.empty();
+   old_dirs.move_here(new_dirs);
+   old_time=start_time;
+   start_time=time(0);
+   return 0;
+}
+
+/* fi is the directory entry as found in the parent listing. */
+bool MirrorState::Unchanged(const char *dir,const FileInfo *fi) const
+{
+   if(full_scan || !fi->Has(fi->DATE))
+      return false;
+   const FileTimestamp& date=fi->date;
+   if(date.ts==NO_DATE || date.ts==NO_DATE_YET)
+      return false;
+   const Dir *d=old_dirs.lookup(dir);
+   if(!d || d->stamp.ts!=date.ts || d->stamp.ts_prec!=date.ts_prec)
+      return false;
+   // an imprecise stamp (e.g. LIST without seconds) does not change
+   // when the directory is modified again within the same minute,
+   // so trust it only if that window was closed before the last run.
+   return date.ts_prec==0 || date.ts+date.ts_prec<old_time;
+}
+
+/* Carry the old state of a skipped directory and its subdirectories
+   over to the new state. Returns the number of directories kept. */
+int MirrorState::Keep(const char *dir)
+{
+   const xstring key(dir);
+   Dir *d=old_dirs.borrow(key);
+   if(!d)
+      return 0;
+   new_dirs.add(key,d);
+   int count=1;
+   for(int i=0; i<d->set->count(); i++) {
+      if(d->set->TypeIs(i,FileInfo::DIRECTORY))
+	 count+=Keep(xstring(dir_file(key,d->set->GetName(i))));
+   }
+   return count;
+}
+
+void MirrorState::Update(const char *dir,const FileTimestamp& stamp,CompactFileSet *set)
+{
+   Dir *d=new Dir;
+   d->stamp=stamp;
+   d->set=set;
+   new_dirs.add(dir,d);
+}
+
+// like Update, but takes effect only on CommitDeferred.
+void MirrorState::Defer(const char *dir,const FileTimestamp& stamp,CompactFileSet *set)
+{
+   Dir *d=new Dir;
+   d->stamp=stamp;
+   d->set=set;
+   deferred_dirs.add(dir,d);
+}
+void MirrorState::CommitDeferred()
+{
+   for(Dir *d=deferred_dirs.each_begin(); d; d=deferred_dirs.each_next())
+      Update(deferred_dirs.each_key(),d->stamp,d->set.borrow());
+   deferred_dirs.empty();
+}
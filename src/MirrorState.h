@@ -0,0 +1,67 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIRRORSTATE_H
+#define MIRRORSTATE_H
+
+#include "CompactFileSet.h"
+#include "xmap.h"
+#include "Ref.h"
+
+/* On-disk index of a mirror pair: for each source directory it keeps
+ * the directory time stamp (as seen in the parent listing) and the
+ * listing itself. A directory whose stamp has not changed since the
+ * last successful mirror is not scanned again. */
+class MirrorState
+{
+   struct Dir
+   {
+      FileTimestamp stamp;
+      Ref<CompactFileSet> set;
+   };
+   xmap_p<Dir> old_dirs;   // loaded from the file
+   xmap_p<Dir> new_dirs;   // to be saved
+   xmap_p<Dir> deferred_dirs; // waiting for the transfers to succeed
+
+   xstring_c file;
+   xstring_c source_url;
+   xstring_c target_url;
+   time_t old_time;	   // start of the run which saved old_dirs
+   time_t start_time;
+   bool full_scan;
+
+   void WriteFileInfo(FILE *f,const FileInfo *fi);
+   FileInfo *ParseFileInfo(char *line);
+
+public:
+   MirrorState(const char *file,const char *source_url,const char *target_url);
+
+   void FullScan() { full_scan=true; }
+
+   const char *Load();
+   const char *Save();
+
+   bool Unchanged(const char *dir,const FileInfo *fi) const;
+   int Keep(const char *dir);
+   void Update(const char *dir,const FileTimestamp& stamp,CompactFileSet *set);
+   void Defer(const char *dir,const FileTimestamp& stamp,CompactFileSet *set);
+   void CommitDeferred();
+};
+
+#endif//MIRRORSTATE_H
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <cmath>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "NetAccess.h"
 #include "log.h"
@@ -46,6 +47,8 @@ void NetAccess::Init()
    socket_maxseg=0;
 
    peer_curr=0;
+   connect_next=-1;
+   connect_attempt_timer.SetResource("net:connect-attempt-delay",0);
 
    reconnect_interval=30;  // retry with 30 second interval
    reconnect_interval_multiplier=1.2;
@@ -78,6 +81,7 @@ NetAccess::NetAccess(const NetAccess *o) : super(o)
 }
 NetAccess::~NetAccess()
 {
+   RaceStop();
    ClearPeer();
 }
 
@@ -114,6 +118,7 @@ void NetAccess::Reconfig(const char *name)
       reconnect_interval_max=reconnect_interval;
    max_retries = ResMgr::Query("net:max-retries",c);
    max_persist_retries = ResMgr::Query("net:persist-retries",c);
+   connect_attempt_timer.SetResource("net:connect-attempt-delay",c);
    socket_buffer = ResMgr::Query("net:socket-buffer",c);
    socket_maxseg = ResMgr::Query("net:socket-maxseg",c);
    connection_limit = ResMgr::Query("net:connection-limit",c);
@@ -161,12 +166,139 @@ int NetAccess::Poll(int fd,int ev,const char **err)
    return pfd.revents;
 }
 
-void NetAccess::SayConnectingTo()
+void NetAccess::SayConnectingTo(int p)
 {
-   assert(peer_curr<peer.count());
+   if(p<0)
+      p=peer_curr;
+   assert(p<peer.count());
    const char *h=(proxy?proxy:hostname);
    LogNote(1,_("Connecting to %s%s (%s) port %u"),proxy?"proxy ":"",
-      h,SocketNumericAddress(&peer[peer_curr]),SocketPort(&peer[peer_curr]));
+      h,SocketNumericAddress(&peer[p]),SocketPort(&peer[p]));
+}
+
+// orders the other peers so that the address families alternate,
+// starting with the family not tried first (RFC 8305, section 4).
+void NetAccess::RaceInit()
+{
+   int n=peer.count();
+   int af=peer[peer_curr].family();
+   xarray<int> same,other;
+   for(int i=1; i<n; i++)
+   {
+      int p=(peer_curr+i)%n;
+      if(peer[p].family()==af)
+	 same.append(p);
+      else
+	 other.append(p);
+   }
+   connect_order.unset();
+   for(int i=0; i<same.count() || i<other.count(); i++)
+   {
+      if(i<other.count())
+	 connect_order.append(other[i]);
+      if(i<same.count())
+	 connect_order.append(same[i]);
+   }
+   connect_next=0;
+   connect_attempt_timer.Reset();
+}
+
+// starts connecting to the next peer; returns false if none is left.
+bool NetAccess::RaceStartNext()
+{
+   while(connect_next<connect_order.count())
+   {
+      int p=connect_order[connect_next++];
+      int s=SocketCreateTCP(peer[p].family());
+      if(s==-1)
+	 continue;
+      SayConnectingTo(p);
+      if(SocketConnect(s,&peer[p])==-1 && errno!=EINPROGRESS)
+      {
+	 LogError(4,"connect: %s",strerror(errno));
+	 close(s);
+	 continue;
+      }
+      ConnectAttempt a={s,p};
+      connect_attempts.append(a);
+      connect_attempt_timer.Reset();
+      return true;
+   }
+   return false;
+}
+
+// makes the i-th attempt the main one in place of *sock.
+void NetAccess::RaceWin(int *sock,sockaddr_u *sa,int i)
+{
+   close(*sock);
+   *sock=connect_attempts[i].sock;
+   peer_curr=connect_attempts[i].peer;
+   connect_attempts.remove(i);
+   if(sa)
+      *sa=peer[peer_curr];
+}
+
+/* Polls the pending connection *sock to peer_curr the way Poll does.
+   Meanwhile connections to the other peers are started one by one each
+   net:connect-attempt-delay, or at once when an attempt fails. The first
+   to connect replaces *sock (and *sa) and sets peer_curr, others are
+   closed. Returns -1 only when all the attempts have failed. */
+int NetAccess::RaceConnect(int *sock,sockaddr_u *sa,const char **err)
+{
+   if(connect_next<0)
+      RaceInit();
+   for(;;)
+   {
+      int res=Poll(*sock,POLLOUT,err);
+      if(res>0 && (res&POLLOUT))
+      {
+	 RaceStop();
+	 return res;
+      }
+      if(res!=-1)
+	 break;
+      LogError(4,"%s: %s",SocketNumericAddress(&peer[peer_curr]),*err);
+      if(connect_attempts.count()==0 && !RaceStartNext())
+      {
+	 RaceStop();
+	 return -1;
+      }
+      RaceWin(sock,sa,0);
+   }
+   for(int i=0; i<connect_attempts.count(); i++)
+   {
+      const char *e;
+      int s=connect_attempts[i].sock;
+      int res=Poll(s,POLLOUT,&e);
+      if(res==-1)
+      {
+	 LogError(4,"%s: %s",SocketNumericAddress(&peer[connect_attempts[i].peer]),e);
+	 close(s);
+	 connect_attempts.remove(i--);
+	 continue;
+      }
+      if(res&POLLOUT)
+      {
+	 RaceWin(sock,sa,i);
+	 LogNote(4,"connected to %s first",SocketNumericAddress(&peer[peer_curr]));
+	 RaceStop();
+	 return res;
+      }
+      Block(s,POLLOUT);
+   }
+   if(connect_attempt_timer.Stopped())
+      RaceStartNext();
+   return 0;
+}
+
+void NetAccess::RaceStop()
+{
+   for(int i=0; i<connect_attempts.count(); i++)
+      close(connect_attempts[i].sock);
+   connect_attempts.unset();
+   connect_order.unset();
+   connect_next=-1;
+   connect_attempt_timer.Stop();
 }
 
 void NetAccess::SetProxy(const char *px)
@@ -503,6 +635,8 @@ do_again:
       {
 	 session->Open("",mode);
 	 session->UseCache(use_cache);
+	 if(mode==FA::LONG_LIST || mode==FA::MP_LIST)
+	    parser=session->MakeLongListParser();
 	 ubuf=new IOBufferFileAccess(session);
 	 ubuf->SetSpeedometer(new Speedometer());
 	 if(FileAccess::cache->IsEnabled(session->GetHostName()))
@@ -517,6 +651,7 @@ do_again:
       if(ubuf->Error())
       {
 	 FileAccess::cache->Add(session,"",mode,session->GetErrorCode(),ubuf);
+	 parser=0;
 	 if(mode==FA::MP_LIST)
 	 {
 	    mode=FA::LONG_LIST;
@@ -530,7 +665,23 @@ do_again:
       }
 
       if(!ubuf->Eof())
+      {
+	 if(parser)
+	 {
+	    // parse the complete lines now, so that the text can be freed
+	    // unless the cache saves it.
+	    const char *b;
+	    int len;
+	    ubuf->Get(&b,&len);
+	    int used=parser->Feed(b,len);
+	    if(used>0)
+	    {
+	       ubuf->Skip(used);
+	       m=MOVED;
+	    }
+	 }
 	 return m;
+      }
 
       // now we have all the index in ubuf; parse it.
       const char *b;
@@ -569,6 +720,7 @@ got_fileset:
       }
 
       ubuf=0;
+      parser=0;
       m=MOVED;
 
       // try another mode? Parse() can set mode to indicate it wants to try it.
@@ -680,6 +832,15 @@ GenericParseListInfo::GenericParseListInfo(FileAccess *s,const char *p)
    mode=FA::MP_LIST;
 }
 
+FileSet *GenericParseListInfo::ParseLongList(const char *buf,int len,int *err)
+{
+   if(!parser)
+      return session->ParseLongList(buf,len,err);
+   parser->Feed(buf,len);
+   FileSet *set=parser->Finish(err);
+   parser=0;
+   return set;
+}
 const char *GenericParseListInfo::Status()
 {
    if(ubuf && !ubuf->Eof() && session->IsOpen())
@@ -33,11 +33,15 @@ protected:
       int current_connection_limit;
       int connection_limit;
       Timer connection_limit_timer;
+      int long_list_parser;   // protocol-specific index, -1 if not known yet
+      int info_window;	      // pipelining depth known to work, 0 if not known yet
+      int info_window_max;    // the depth the site has failed over, 0 if none
 
    public:
       SiteData(const xstring &site)
 	 : current_connection_limit(0), connection_limit(0),
-	   connection_limit_timer("net:connection-limit-timer",site) {}
+	   connection_limit_timer("net:connection-limit-timer",site),
+	   long_list_parser(-1), info_window(0), info_window_max(0) {}
 
       void SetConnectionLimit(int L) {
 	 connection_limit=L;
@@ -62,6 +66,12 @@ protected:
 	    connection_limit_timer.Reset();
 	 }
       }
+      int GetLongListParser() const { return long_list_parser; }
+      void SetLongListParser(int p) { long_list_parser=p; }
+      int GetInfoWindow() const { return info_window; }
+      void SetInfoWindow(int w) { info_window=w; }
+      int GetInfoWindowMax() const { return info_window_max; }
+      void SetInfoWindowMax(int w) { info_window_max=w; }
    };
 
    static xmap_p<NetAccess::SiteData> site_data;
@@ -76,10 +86,6 @@ protected:
       return data;
    }
 
-   int GetConnectionLimit() {
-      return GetSiteData()->GetConnectionLimit();
-   }
-
    SMTaskRef<Resolver> resolver;
 
    xarray<sockaddr_u> peer;
@@ -87,6 +93,22 @@ protected:
    void	 ClearPeer();
    void	 NextPeer();
 
+   // connections to other peers raced against the pending one (RFC 8305).
+   struct ConnectAttempt
+   {
+      int sock;
+      int peer;
+   };
+   xarray<ConnectAttempt> connect_attempts;
+   xarray<int> connect_order;	 // the peers to try after peer_curr
+   int	 connect_next;		 // -1 when not racing
+   Timer connect_attempt_timer;
+   void	 RaceInit();
+   bool	 RaceStartNext();
+   void	 RaceWin(int *sock,sockaddr_u *sa,int i);
+   int	 RaceConnect(int *sock,sockaddr_u *sa,const char **err);
+   void	 RaceStop();
+
    int	 max_persist_retries;
    int	 persist_retries;
 
@@ -125,7 +147,7 @@ protected:
    void	 PropagateHomeAuto();
    const char *FindHomeAuto();
 
-   void SayConnectingTo();
+   void SayConnectingTo(int p=-1);
 
    void SetProxy(const char *);
    static bool NoProxy(const char *);
@@ -158,6 +180,9 @@ public:
    void CleanupThis();
 
    int CountConnections();
+   int GetConnectionLimit() {
+      return GetSiteData()->GetConnectionLimit();
+   }
 
    static void ClassInit();
    static void ClassCleanup() {
@@ -177,17 +202,21 @@ class GenericParseListInfo : public ListInfo
 protected:
    int mode;
    SMTaskRef<IOBuffer> ubuf;
+   Ref<LongListParser> parser;
 
    bool get_time_for_dirs;
    bool can_get_prec_time;
 
+   // parses the rest of the listing, with the incremental parser if any.
+   FileSet *ParseLongList(const char *buf,int len,int *err=0);
    virtual FileSet *Parse(const char *buf,int len)
-      { return session->ParseLongList(buf,len); }
+      { return ParseLongList(buf,len); }
 
 public:
    GenericParseListInfo(FileAccess *session,const char *path);
    int Do();
    const char *Status();
+   const FileSet *GetPartialResult() const { return parser?parser->GetPartial():0; }
 };
 
 #endif//NETACCESS_H
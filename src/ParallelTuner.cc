@@ -0,0 +1,124 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <strings.h>
+#include "ParallelTuner.h"
+#include "log.h"
+
+#define START_LEVEL 2
+#define PROBE_GAIN  1.1	 // an added transfer must give 10% more
+#define DROP_RATIO  0.7	 // back off when the rate falls by 30%
+#define HOLD_CHECKS 6	 // intervals to wait before probing again
+
+ParallelTuner::ParallelTuner(const char *n)
+   : name(n), rate("xfer:parallel-tune-interval")
+{
+   max_level=ResMgr::Query("xfer:parallel-max",0);
+   if(max_level<1)
+      max_level=1;
+   level=START_LEVEL;
+   if(level>max_level)
+      level=max_level;
+   server_limit=0;
+   check_timer.Set(ResMgr::Query("xfer:parallel-tune-interval",0));
+   last_bytes=0;
+   base_rate=0;
+   probing=false;
+   hold_count=0;
+}
+
+bool ParallelTuner::IsAuto(const char *s)
+{
+   return s && !strcasecmp(s,"auto");
+}
+
+void ParallelTuner::Report(float r,const char *fmt,...)
+{
+   va_list v;
+   va_start(v,fmt);
+   xstring& msg=xstring::vformat(fmt,v);
+   va_end(v);
+   Log::global->Format(3,"%s: auto-parallel: %s (rate %s)\n",name,msg.get(),
+      Speedometer::GetStrProper(r).get());
+}
+
+void ParallelTuner::Update(long long bytes,int active,int conn_limit)
+{
+   if(bytes>last_bytes) {
+      long long d=bytes-last_bytes;
+      rate.Add(d>INT_MAX?INT_MAX:int(d));
+   }
+   last_bytes=bytes;
+
+   // the server refuses more connections (see ftp:too-many-re),
+   // back off at once and don't probe above the limit.
+   if(conn_limit!=server_limit) {
+      server_limit=conn_limit;
+      if(server_limit>0 && level>server_limit) {
+	 level=server_limit;
+	 probing=false;
+	 hold_count=0;
+	 base_rate=0;
+	 check_timer.Reset();
+	 Report(rate.Get(),"server connection limit is %d, backing off to %d",
+	    server_limit,level);
+	 return;
+      }
+   }
+
+   if(!check_timer.Stopped())
+      return;
+   check_timer.Reset();
+
+   float r=rate.Get();
+   if(probing) {
+      probing=false;
+      if(r<base_rate*PROBE_GAIN) {
+	 level--;
+	 base_rate=r;
+	 hold_count=0;
+	 Report(r,"no gain from the last transfer, holding at %d",level);
+	 return;
+      }
+      // it helped, try one more right away.
+   } else if(base_rate>0 && r<base_rate*DROP_RATIO && level>1) {
+      level--;
+      base_rate=r;
+      hold_count=0;
+      Report(r,"rate dropped, backing off to %d",level);
+      return;
+   } else if(base_rate>0 && hold_count<HOLD_CHECKS) {
+      hold_count++;
+      base_rate=r;
+      return;
+   }
+
+   base_rate=r;
+   hold_count=0;
+   // adding a transfer makes sense only when all slots are busy.
+   if(active<level || level>=max_level
+   || (server_limit>0 && level>=server_limit))
+      return;
+   level++;
+   probing=true;
+   Report(r,"trying %d parallel transfers",level);
+}
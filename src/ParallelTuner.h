@@ -0,0 +1,60 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLELTUNER_H
+#define PARALLELTUNER_H
+
+#include "Speedometer.h"
+#include "Timer.h"
+
+/* Chooses the number of parallel transfers by aggregate throughput.
+ * It starts with a few transfers and adds one more while the rate keeps
+ * growing; when an added transfer does not help, it is taken back and
+ * the level is held for a while before probing again. */
+class ParallelTuner
+{
+   const char *name;	// for logging
+   int level;
+   int max_level;
+   int server_limit;	// last seen connection limit of the server
+
+   Speedometer rate;
+   Timer check_timer;
+   long long last_bytes;
+
+   float base_rate;	// rate before the last probe
+   bool probing;	// level was just increased
+   int hold_count;
+
+   void Report(float r,const char *fmt,...) PRINTF_LIKE(3,4);
+
+public:
+   ParallelTuner(const char *name);
+
+   int Get() const { return level; }
+
+   /* bytes is the total transferred so far, active is the number of
+      running transfers, conn_limit is the server connection limit
+      (0 if unknown). */
+   void Update(long long bytes,int active,int conn_limit);
+
+   static bool IsAuto(const char *s);
+};
+
+#endif//PARALLELTUNER_H
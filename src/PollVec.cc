@@ -18,6 +18,7 @@
  */
 
 #include <config.h>
+#include <errno.h>
 #include "trio.h"
 #include "PollVec.h"
 
@@ -28,6 +29,59 @@ static inline bool operator<(const timeval& a,const timeval& b)
    return a.tv_usec<b.tv_usec;
 }
 
+PollVec::PollVec()
+{
+#if defined(SOCKS) && !defined(HAVE_RPOLL)
+   // SOCKS library wraps select only.
+   backend=SELECT;
+#else
+   backend=POLL;
+#endif
+#ifdef USE_EPOLL
+   epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+   if(epoll_fd!=-1)
+      backend=EPOLL;
+#endif
+   Empty();
+}
+PollVec::~PollVec()
+{
+#ifdef USE_EPOLL
+   if(epoll_fd!=-1)
+      close(epoll_fd);
+#endif
+}
+
+const char *PollVec::GetBackendName() const
+{
+   switch(backend)
+   {
+   case SELECT: return "select";
+   case POLL:	return "poll";
+   case EPOLL:	return "epoll";
+   }
+   return "?";
+}
+
+PollVec::fd_state& PollVec::State(int fd)
+{
+   if(fd>=fds.count())
+   {
+      static const fd_state zero={0,0,0,0};
+      fds.allocate(fd+1-fds.count(),zero);
+   }
+   return fds[fd];
+}
+
+void PollVec::Empty()
+{
+   for(int i=0; i<wanted.count(); i++)
+      fds[wanted[i]].want=0;
+   wanted.truncate();
+   tv_timeout.tv_sec=-1;
+   tv_timeout.tv_usec=0;
+}
+
 void PollVec::AddTimeoutU(unsigned t)
 {
    struct timeval new_timeout={static_cast<time_t>(t/1000000),static_cast<suseconds_t>(t%1000000)};
@@ -37,43 +91,228 @@ void PollVec::AddTimeoutU(unsigned t)
 
 void PollVec::AddFD(int fd,int mask)
 {
-   if(mask&IN)
-      FD_SET(fd,&in);
-   if(mask&OUT)
-      FD_SET(fd,&out);
-   if(nfds<=fd)
-      nfds=fd+1;
+   mask&=(IN|OUT);
+   if(fd<0 || !mask)
+      return;
+   fd_state& st=State(fd);
+   if(!st.want)
+      wanted.append(fd);
+   st.want|=mask;
 }
 bool PollVec::FDReady(int fd,int mask)
 {
+   if(fd<0 || fd>=fds.count())
+      return true;   // was not polled
+   const fd_state& st=fds[fd];
    bool res=false;
    if(mask&IN)
-      res|=(!FD_ISSET(fd,&in_polled) || FD_ISSET(fd,&in_ready));
+      res|=(!(st.polled&IN) || (st.ready&IN));
    if(mask&OUT)
-      res|=(!FD_ISSET(fd,&out_polled) || FD_ISSET(fd,&out_ready));
+      res|=(!(st.polled&OUT) || (st.ready&OUT));
    return res;
 }
 void PollVec::FDSetNotReady(int fd,int mask)
 {
-   if(mask&IN)
-      FD_CLR(fd,&in_ready);
-   if(mask&OUT)
-      FD_CLR(fd,&out_ready);
+   if(fd<0 || fd>=fds.count())
+      return;
+   fds[fd].ready&=~mask;
+}
+// The kernel silently drops a closed fd from the epoll set, so when the
+// number is given to a new descriptor, it has to be registered again.
+void PollVec::FDOpened(int fd)
+{
+   if(fd<0 || fd>=fds.count())
+      return;
+   fds[fd].registered=0;
+}
+void PollVec::SetReady(int fd,int mask)
+{
+   fd_state& st=fds[fd];
+   if(!st.ready && (mask&st.polled))
+      ready.append(fd);
+   st.ready|=(mask&st.polled);
 }
 
-void  PollVec::Block()
+int PollVec::TimeoutMS() const
 {
-   if(nfds<1 && tv_timeout.tv_sec<0)
+   if(tv_timeout.tv_sec<0)
+      return -1;
+   return tv_timeout.tv_sec*1000+(tv_timeout.tv_usec+999)/1000;
+}
+
+int PollVec::Block()
+{
+   if(wanted.count()<1 && tv_timeout.tv_sec<0)
    {
       /* dead lock */
       fprintf(stderr,_("%s: BUG - deadlock detected\n"),"PollVec::Block");
       tv_timeout.tv_sec=1;
    }
 
-   in_ready=in_polled=in;
-   out_ready=out_polled=out;
+   // forget the results of previous Block; the fds which are no longer
+   // wanted are removed from the epoll set right away, so that it
+   // always matches the set of wanted fds and does not report stale events.
+   for(int i=0; i<polled.count(); i++)
+   {
+      fd_state& st=fds[polled[i]];
+      st.polled=st.ready=0;
+#ifdef USE_EPOLL
+      if(st.registered && !st.want)
+      {
+	 struct epoll_event ev={0,{0}};
+	 epoll_ctl(epoll_fd,EPOLL_CTL_DEL,polled[i],&ev);
+	 st.registered=0;
+      }
+#endif
+   }
+   polled.nset(wanted.get(),wanted.count());
+   ready.truncate();
+   for(int i=0; i<wanted.count(); i++)
+   {
+      fd_state& st=fds[wanted[i]];
+      st.polled=st.want;
+   }
+
+   switch(backend)
+   {
+   case SELECT:
+      return BlockSelect();
+   case POLL:
+      return BlockPoll();
+   case EPOLL:
+      return BlockEpoll();
+   }
+   return 0;
+}
+
+int PollVec::BlockSelect()
+{
+   fd_set in,out;
+   FD_ZERO(&in);
+   FD_ZERO(&out);
+   int nfds=0;
+   for(int i=0; i<wanted.count(); i++)
+   {
+      int fd=wanted[i];
+      if(fd>=FD_SETSIZE)
+      {
+	 // cannot be selected, let the task find it out.
+	 SetReady(fd,IN|OUT);
+	 NoWait();
+	 continue;
+      }
+      int want=fds[fd].want;
+      if(want&IN)
+	 FD_SET(fd,&in);
+      if(want&OUT)
+	 FD_SET(fd,&out);
+      if(nfds<=fd)
+	 nfds=fd+1;
+   }
    timeval *select_timeout=0;
    if(tv_timeout.tv_sec!=-1)
       select_timeout=&tv_timeout;
-   select(nfds,&in_ready,&out_ready,0,select_timeout);
+   int res=select(nfds,&in,&out,0,select_timeout);
+   if(res<=0)
+      return res;
+   for(int i=0; i<wanted.count(); i++)
+   {
+      int fd=wanted[i];
+      if(fd>=FD_SETSIZE)
+	 continue;
+      if(FD_ISSET(fd,&in))
+	 SetReady(fd,IN);
+      if(FD_ISSET(fd,&out))
+	 SetReady(fd,OUT);
+   }
+   return res;
+}
+
+int PollVec::BlockPoll()
+{
+   xarray<struct pollfd>& pfd=poll_fds;
+   pfd.truncate();
+   for(int i=0; i<wanted.count(); i++)
+   {
+      struct pollfd p;
+      p.fd=wanted[i];
+      p.events=fds[p.fd].want;
+      p.revents=0;
+      pfd.append(p);
+   }
+   int res=poll(pfd.get_non_const(),pfd.count(),TimeoutMS());
+   if(res<=0)
+      return res;
+   for(int i=0; i<pfd.count(); i++)
+   {
+      int re=pfd[i].revents;
+      if(!re)
+	 continue;
+      // errors make the fd ready both ways, as select does.
+      if(re&(POLLERR|POLLHUP|POLLNVAL))
+	 re|=IN|OUT;
+      SetReady(pfd[i].fd,re);
+   }
+   return res;
+}
+
+int PollVec::BlockEpoll()
+{
+#ifdef USE_EPOLL
+   // An fd stays registered while it is wanted; a new descriptor with
+   // the same number is reported by FDOpened, and an fd which was not
+   // wanted by the previous Block has been removed from the set there.
+   for(int i=0; i<wanted.count(); i++)
+   {
+      int fd=wanted[i];
+      fd_state& st=fds[fd];
+      if(st.registered==st.want)
+	 continue;
+      struct epoll_event ev;
+      ev.events=0;
+      if(st.want&IN)
+	 ev.events|=EPOLLIN;
+      if(st.want&OUT)
+	 ev.events|=EPOLLOUT;
+      ev.data.fd=fd;
+      int op=(st.registered?EPOLL_CTL_MOD:EPOLL_CTL_ADD);
+      int res=epoll_ctl(epoll_fd,op,fd,&ev);
+      if(res==-1 && errno==ENOENT && op==EPOLL_CTL_MOD)
+	 res=epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev);
+      else if(res==-1 && errno==EEXIST && op==EPOLL_CTL_ADD)
+	 res=epoll_ctl(epoll_fd,EPOLL_CTL_MOD,fd,&ev);
+      if(res==-1)
+      {
+	 // EPERM for regular files; they are always ready for select.
+	 // EBADF and others: let the task find out the error.
+	 st.registered=0;
+	 SetReady(fd,IN|OUT);
+	 NoWait();
+	 continue;
+      }
+      st.registered=st.want;
+   }
+
+   int max_events=wanted.count();
+   if(max_events<1)
+      max_events=1;
+   xarray<struct epoll_event>& events=epoll_events;
+   events.grow_space(max_events);
+   int n=epoll_wait(epoll_fd,events.get_non_const(),max_events,TimeoutMS());
+   for(int i=0; i<n; i++)
+   {
+      unsigned re=events[i].events;
+      int mask=0;
+      if(re&(EPOLLERR|EPOLLHUP))
+	 mask|=IN|OUT;
+      if(re&EPOLLIN)
+	 mask|=IN;
+      if(re&EPOLLOUT)
+	 mask|=OUT;
+      SetReady(events[i].data.fd,mask);
+   }
+   return n;
+#else
+   return 0;
+#endif
 }
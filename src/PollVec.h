@@ -27,41 +27,63 @@
 CDECL_BEGIN
 #include <poll.h>
 CDECL_END
+#include "xarray.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1) && !defined(SOCKS)
+# define USE_EPOLL 1
+# include <sys/epoll.h>
+#endif
 
 class PollVec
 {
-   fd_set in;
-   fd_set out;
-   fd_set in_polled;
-   fd_set out_polled;
-   fd_set in_ready;
-   fd_set out_ready;
-   int nfds;
-   struct timeval tv_timeout;
-
 public:
-   PollVec() {
-      Empty();
-      FD_ZERO(&in_polled);
-      FD_ZERO(&out_polled);
-      FD_ZERO(&in_ready);
-      FD_ZERO(&out_ready);
-   }
-
-   void	 Empty()
-      {
-	 FD_ZERO(&in);
-	 FD_ZERO(&out);
-	 nfds=0;
-	 tv_timeout.tv_sec=-1;
-	 tv_timeout.tv_usec=0;
-      }
-   void	 Block();
-
    enum {
       IN=POLLIN,
       OUT=POLLOUT,
    };
+   enum backend_t {
+      SELECT,
+      POLL,
+      EPOLL
+   };
+
+private:
+   struct fd_state {
+      unsigned char want;	 // events requested for the next Block
+      unsigned char polled;	 // events polled by the last Block
+      unsigned char ready;	 // events found ready by the last Block
+      unsigned char registered;	 // events registered in the epoll set
+   };
+   xarray<fd_state> fds;   // indexed by fd
+   xarray<int> wanted;	   // fds with non-zero want
+   xarray<int> polled;	   // fds polled by the last Block
+   xarray<int> ready;	   // fds found ready by the last Block
+   struct timeval tv_timeout;
+
+   backend_t backend;
+   xarray<struct pollfd> poll_fds;
+#ifdef USE_EPOLL
+   int epoll_fd;
+   xarray<struct epoll_event> epoll_events;
+#endif
+
+   fd_state& State(int fd);
+   void SetReady(int fd,int events);
+   int TimeoutMS() const;
+
+   int BlockSelect();
+   int BlockPoll();
+   int BlockEpoll();
+
+   PollVec(const PollVec&);	  // disable cloning
+   void operator=(const PollVec&);  // and assignment
+
+public:
+   PollVec();
+   ~PollVec();
+
+   void	 Empty();
+   int	 Block();  // returns -1 if the wait was interrupted
 
    void SetTimeout(const timeval &t) { tv_timeout=t; }
    void SetTimeoutU(unsigned t) {
@@ -72,8 +94,13 @@ public:
    void AddFD(int fd,int events);
    bool FDReady(int fd,int events);
    void FDSetNotReady(int fd,int events);
+   void FDOpened(int fd);
+   const xarray<int>& ReadyFDs() const { return ready; }
    void NoWait() { tv_timeout.tv_sec=tv_timeout.tv_usec=0; }
    bool WillNotBlock() { return tv_timeout.tv_sec==0 && tv_timeout.tv_usec==0; }
+
+   backend_t GetBackend() const { return backend; }
+   const char *GetBackendName() const;
 };
 
 #endif /* POLLVEC_H */
@@ -38,6 +38,7 @@
 #include "SignalHook.h"
 #include "ArgV.h"
 #include "misc.h"
+#include "SMTask.h"
 
 int PtyShell::getfd()
 {
@@ -165,6 +166,7 @@ int PtyShell::getfd()
 
    close(ttyfd);
    fd=ptyfd;
+   SMTask::FDOpened(fd);
 
    fcntl(fd,F_SETFD,FD_CLOEXEC);
    fcntl(fd,F_SETFL,O_NONBLOCK);
@@ -175,6 +177,8 @@ int PtyShell::getfd()
       pipe_out=pipe0[1];
       close(pipe1[1]);
       pipe_in=pipe1[0];
+      SMTask::FDOpened(pipe_out);
+      SMTask::FDOpened(pipe_in);
       fcntl(pipe_in,F_SETFD,FD_CLOEXEC);
       fcntl(pipe_in,F_SETFL,O_NONBLOCK);
       fcntl(pipe_out,F_SETFD,FD_CLOEXEC);
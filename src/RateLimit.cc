@@ -116,6 +116,13 @@ bool RateLimit::Relaxed(dir_t dir)
    return parent_relaxed;
 }
 
+bool RateLimit::Unlimited(dir_t dir) const
+{
+   if(pool[dir].rate!=0)
+      return false;
+   return parent?parent->Unlimited(dir):true;
+}
+
 void RateLimit::BytesPool::Used(int bytes)
 {
    if(pool<bytes)
@@ -66,6 +66,7 @@ public:
    void BytesGot(int b) { BytesUsed(b,GET); }
    void BytesPut(int b) { BytesUsed(b,PUT); }
    bool Relaxed(dir_t dir);
+   bool Unlimited(dir_t dir) const;
    void Reset();
 
    void Reconfig(const char *name,const char *c);
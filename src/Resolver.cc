@@ -111,6 +111,11 @@ Resolver::Resolver(const char *h,const char *p,const char *defp,
    timeout_timer.SetResource("dns:fatal-timeout",hostname);
    Reconfig();
    use_fork=ResMgr::QueryBool("dns:use-fork",0);
+   use_builtin=ResMgr::QueryBool("dns:use-builtin",hostname) && DnsLookup::Configured();
+#ifdef DNSSEC_LOCAL_VALIDATION
+   use_builtin=false;	// the answers have to be validated
+#endif
+   builtin_started=false;
 
    error=0;
 
@@ -153,6 +158,13 @@ int   Resolver::Do()
       no_cache=true;
    }
 
+   if(use_builtin)
+   {
+      m=DoBuiltin();
+      if(use_builtin || done)
+	 return m;
+   }
+
    if(use_fork)
    {
       if(pipe_to_child[0]==-1)
@@ -165,6 +177,7 @@ int   Resolver::Do()
 	    MakeErrMsg("pipe()");
 	    return MOVED;
 	 }
+	 SMTask::FDOpened(pipe_to_child[0]);
 	 fcntl(pipe_to_child[0],F_SETFL,O_NONBLOCK);
 	 fcntl(pipe_to_child[0],F_SETFD,FD_CLOEXEC);
 	 fcntl(pipe_to_child[1],F_SETFD,FD_CLOEXEC);
@@ -273,6 +286,13 @@ int   Resolver::Do()
       return MOVED;
    }
    addr.nset((const sockaddr_u*)s,n/addr.get_element_size());
+   Finish();
+   return MOVED;
+}
+
+// caches and reports the found addresses.
+void Resolver::Finish()
+{
    done=true;
    if(!cache)
       cache=new ResolverCache;
@@ -289,8 +309,6 @@ int   Resolver::Do()
       }
    }
    LogNote(4,"%s",report.get());
-
-   return MOVED;
 }
 
 void Resolver::MakeErrMsg(const char *f)
@@ -459,6 +477,7 @@ int extract_domain(const unsigned char *answer,const unsigned char *scan,int len
    return consumed;
 #endif // DN_EXPAND
 }
+#endif // RES_SEARCH
 
 #ifndef NS_MAXDNAME
 # define NS_MAXDNAME 1025
@@ -493,7 +512,59 @@ int SRV_compare(const SRV *sa,const SRV *sb)
       return 1;
    return 0;
 }
-#endif // RES_SEARCH
+
+// sorts the records by priority and orders them randomly by weight.
+static
+void SRV_order(xarray<SRV>& SRVs)
+{
+   SRVs.qsort(SRV_compare);
+
+   srand(time(0));
+
+   int SRVscan;
+   int base=0;
+   int curr_priority=-1;
+   int weight_sum=0;
+   for(SRVscan=0; ; SRVscan++)
+   {
+      if(SRVscan==SRVs.count() || SRVs[SRVscan].priority!=curr_priority)
+      {
+	 if(base)
+	 {
+	    int o=1;
+	    int s;
+	    while(weight_sum>0)
+	    {
+	       int r=int(rand()/(RAND_MAX+1.0)*weight_sum);
+	       if(r>=weight_sum)
+		  r=weight_sum-1;
+	       int w=0;
+	       for(s=base; s<SRVscan; s++)
+	       {
+		  if(SRVs[s].order!=0)
+		     continue;
+		  w+=SRVs[s].weight;
+		  if(r<w)
+		  {
+		     SRVs[s].order=o;
+		     o++;
+		     weight_sum-=SRVs[s].weight;
+		     break;
+		  }
+	       }
+	    }
+	 }
+	 if(SRVscan==SRVs.count())
+	    break;
+	 base=SRVscan;
+	 curr_priority=SRVs[SRVscan].priority;
+	 weight_sum=0;
+      }
+      weight_sum+=SRVs[SRVscan].weight;
+   }
+
+   SRVs.qsort(SRV_compare);
+}
 
 void Resolver::LookupSRV_RR()
 {
@@ -623,57 +694,10 @@ void Resolver::LookupSRV_RR()
 	 SRVs.append(t);
    }
 
-   // now sort and randomize the list.
-   SRVs.qsort(SRV_compare);
-
-   srand(time(0));
-
-   int SRVscan;
-   int base=0;
-   int curr_priority=-1;
-   int weight_sum=0;
-   for(SRVscan=0; ; SRVscan++)
-   {
-      if(SRVscan==SRVs.count() || SRVs[SRVscan].priority!=curr_priority)
-      {
-	 if(base)
-	 {
-	    int o=1;
-	    int s;
-	    while(weight_sum>0)
-	    {
-	       int r=int(rand()/(RAND_MAX+1.0)*weight_sum);
-	       if(r>=weight_sum)
-		  r=weight_sum-1;
-	       int w=0;
-	       for(s=base; s<SRVscan; s++)
-	       {
-		  if(SRVs[s].order!=0)
-		     continue;
-		  w+=SRVs[s].weight;
-		  if(r<w)
-		  {
-		     SRVs[s].order=o;
-		     o++;
-		     weight_sum-=SRVs[s].weight;
-		     break;
-		  }
-	       }
-	    }
-	 }
-	 if(SRVscan==SRVs.count())
-	    break;
-	 base=SRVscan;
-	 curr_priority=SRVs[SRVscan].priority;
-	 weight_sum=0;
-      }
-      weight_sum+=SRVs[SRVscan].weight;
-   }
-
-   SRVs.qsort(SRV_compare);
+   SRV_order(SRVs);
 
    int oldport=port_number;
-   for(SRVscan=0; SRVscan<SRVs.count(); SRVscan++)
+   for(int SRVscan=0; SRVscan<SRVs.count(); SRVscan++)
    {
       port_number=htons(SRVs[SRVscan].port);
       LookupOne(SRVs[SRVscan].domain);
@@ -883,27 +907,33 @@ void Resolver::LookupOne(const char *name)
    }
 }
 
-void Resolver::DoGethostbyname()
+bool Resolver::FindPort()
 {
-   if(port_number==0)
+   if(port_number!=0)
+      return true;
+
+   const char *tproto=proto?proto.get():"tcp";
+   const char *tport=portname?portname.get():defport.get();
+
+   if(isdigit((unsigned char)tport[0]))
+      port_number=htons(atoi(tport));
+   else
    {
-      const char *tproto=proto?proto.get():"tcp";
-      const char *tport=portname?portname.get():defport.get();
+      struct servent *se=getservbyname(tport,tproto);
+      if(!se)
+	 return false;
+      port_number=se->s_port;
+   }
+   return true;
+}
 
-      if(isdigit((unsigned char)tport[0]))
-	 port_number=htons(atoi(tport));
-      else
-      {
-	 struct servent *se=getservbyname(tport,tproto);
-	 if(se)
-	    port_number=se->s_port;
-	 else
-	 {
-	    buf->Put("P");
-	    buf->Format(_("no such %s service"),tproto);
-	    return;
-	 }
-      }
+void Resolver::DoGethostbyname()
+{
+   if(!FindPort())
+   {
+      buf->Put("P");
+      buf->Format(_("no such %s service"),proto?proto.get():"tcp");
+      return;
    }
 
    if(service && !portname && !isdigit((unsigned char)hostname[0]))
@@ -936,6 +966,164 @@ void Resolver::DoGethostbyname()
    addr.unset();
 }
 
+// false if the name cannot be looked up, error tells why.
+bool Resolver::StartLookup(const char *name,int port)
+{
+   int af_order[16];
+   ParseOrder(ResMgr::Query("dns:order",name),af_order);
+
+#if LIBIDN2
+   xstring_c ascii_name;
+   int rc=idn2_lookup_ul(name,ascii_name.buf_ptr(),0);
+   if(rc!=IDN2_OK) {
+      error=idn2_strerror(rc);
+      LogError(4,"%s: %s",name,error);
+      return false;
+   }
+   name=ascii_name;
+#endif//LIBIDN2
+
+   int types[16];
+   int n=0;
+   for(int i=0; af_order[i]!=-1; i++)
+      types[n++]=(af_order[i]==AF_INET ? DnsLookup::RR_A : DnsLookup::RR_AAAA);
+   lookups.append(new DnsLookup(name,types,n));
+   lookup_port.append(port);
+   return true;
+}
+
+// puts the lookups of the SRV targets before the lookups of the host name.
+void Resolver::StartSRVTargets()
+{
+   const xarray_p<DnsLookup::SRV>& rr=srv_lookup->GetSRV();
+   xarray<SRV> SRVs;
+   for(int i=0; i<rr.count(); i++)
+   {
+      // skip unless the service is available at this domain.
+      if(rr[i]->target.length()==0 || rr[i]->target.length()>=NS_MAXDNAME)
+	 continue;
+      SRV t;
+      strcpy(t.domain,rr[i]->target);
+      t.port=rr[i]->port;
+      t.priority=rr[i]->priority;
+      t.weight=rr[i]->weight;
+      t.order=0;
+      SRVs.append(t);
+   }
+   SRV_order(SRVs);
+
+   TaskRefArray<DnsLookup> names;
+   xarray<int> names_port;
+   for(int i=0; i<lookups.count(); i++)
+      names.append(lookups[i].borrow());
+   names_port.set(lookup_port);
+   lookups.unset();
+   lookup_port.unset();
+
+   for(int i=0; i<SRVs.count(); i++)
+      StartLookup(xstring::cat(SRVs[i].domain,".",NULL),htons(SRVs[i].port));
+   for(int i=0; i<names.count(); i++)
+   {
+      lookups.append(names[i].borrow());
+      lookup_port.append(names_port[i]);
+   }
+}
+
+// resolves all the names at once with the built-in resolver; turns
+// use_builtin off when the system resolver has to be tried instead.
+int Resolver::DoBuiltin()
+{
+   int m=STALL;
+   if(!builtin_started)
+   {
+      builtin_started=true;
+      if(!FindPort())
+      {
+	 const char *tproto=proto?proto.get():"tcp";
+	 const char *tport=portname?portname.get():defport.get();
+	 err_msg.vset(tport,": ",xstring::format(_("no such %s service"),tproto).get(),NULL);
+	 done=true;
+	 return MOVED;
+      }
+      LogNote(4,_("Resolving host address..."));
+
+      if(service && !portname && !isdigit((unsigned char)hostname[0])
+      && ResMgr::QueryBool("dns:SRV-query",hostname))
+      {
+	 const char *tproto=proto?proto.get():"tcp";
+	 const int srv_type=DnsLookup::RR_SRV;
+	 srv_lookup=new DnsLookup(xstring::format("_%s._%s.%s",
+	    service.get(),tproto,hostname.get()),&srv_type,1);
+      }
+      const char *h=ResMgr::Query("dns:name",hostname);
+      if(!h || !*h)
+	 h=hostname;
+      char *hs=alloca_strdup(h);
+      char *tok;
+      for(hs=strtok_r(hs,",",&tok); hs; hs=strtok_r(NULL,",",&tok))
+	 StartLookup(hs,port_number);
+      if(lookups.count()==0)
+      {
+	 // the SRV query name contains the same bad host name.
+	 srv_lookup=0;
+	 err_msg.set(error?error:_("No address found"));
+	 done=true;
+	 return MOVED;
+      }
+      m=MOVED;
+   }
+
+   if(timeout_timer.Stopped())
+   {
+      err_msg.set(_("host name resolve timeout"));
+      done=true;
+      return MOVED;
+   }
+
+   if(srv_lookup)
+   {
+      if(!srv_lookup->Done())
+	 return m;
+      if(srv_lookup->GetStatus()==DnsLookup::FOUND)
+	 StartSRVTargets();
+      srv_lookup=0;
+      m=MOVED;
+   }
+   for(int i=0; i<lookups.count(); i++)
+      if(!lookups[i]->Done())
+	 return m;
+
+   int oldport=port_number;
+   for(int i=0; i<lookups.count(); i++)
+   {
+      port_number=lookup_port[i];
+      const xarray<sockaddr_u>& a=lookups[i]->GetAddresses();
+      for(int j=0; j<a.count(); j++)
+      {
+	 if(a[j].family()==AF_INET)
+	    AddAddress(AF_INET,(const char*)&a[j].in.sin_addr,sizeof(a[j].in.sin_addr),0);
+#if INET6
+	 else if(a[j].family()==AF_INET6)
+	    AddAddress(AF_INET6,(const char*)&a[j].in6.sin6_addr,sizeof(a[j].in6.sin6_addr),0);
+#endif
+      }
+   }
+   port_number=oldport;
+   lookups.unset();
+   lookup_port.unset();
+
+   if(addr.count()==0)
+   {
+      // the name can still be known to the system resolver, e.g. via nsswitch.
+      LogNote(9,"no address found by the built-in resolver, trying the system one");
+      use_builtin=false;
+      error=0;
+      return MOVED;
+   }
+   Finish();
+   return MOVED;
+}
+
 void Resolver::Reconfig(const char *name)
 {
    if(!name || strncmp(name,"dns:",4))
@@ -953,9 +1141,16 @@ void ResolverCache::Reconfig(const char *r)
    || !xstrcmp(r,"dns:order"))
       Flush();
 }
+const xstring& ResolverCache::MakeKey(const char *h,const char *p,const char *defp,const char *ser,const char *pr)
+{
+   xstring& key=xstring::get_tmp(h?h:"");
+   key.c_lc();
+   key.vappend(" ",p?p:""," ",defp?defp:""," ",ser?ser:""," ",pr?pr:"",NULL);
+   return key;
+}
 ResolverCacheEntry *ResolverCache::Find(const char *h,const char *p,const char *defp,const char *ser,const char *pr)
 {
-   for(ResolverCacheEntry *c=IterateFirst(); c; c=IterateNext())
+   for(ResolverCacheEntry *c=FindFirst(MakeKey(h,p,defp,ser,pr)); c; c=c->NextSameKey())
    {
       if(c->Matches(h,p,defp,ser,pr))
 	 return c;
@@ -965,7 +1160,6 @@ ResolverCacheEntry *ResolverCache::Find(const char *h,const char *p,const char *
 void ResolverCache::Add(const char *h,const char *p,const char *defp,
 	 const char *ser,const char *pr,const sockaddr_u *a,int n)
 {
-   Trim();
    ResolverCacheEntry *c=Find(h,p,defp,ser,pr);
    if(c)
       c->SetData(a,n);
@@ -973,8 +1167,10 @@ void ResolverCache::Add(const char *h,const char *p,const char *defp,
    {
       if(!IsEnabled(h))
 	 return;
-      AddCacheEntry(new ResolverCacheEntry(h,p,defp,ser,pr,a,n));
+      c=new ResolverCacheEntry(h,p,defp,ser,pr,a,n);
+      AddCacheEntry(c,MakeKey(h,p,defp,ser,pr));
    }
+   Trim();
 }
 bool ResolverCacheEntryLoc::Matches(const char *h,const char *p,
 	 const char *defp,const char *ser,const char *pr)
@@ -996,13 +1192,16 @@ void ResolverCache::Find(const char *h,const char *p,const char *defp,
       return;
 
    ResolverCacheEntry *c=Find(h,p,defp,ser,pr);
-   if(c)
+   if(c && c->Stopped())
    {
-      if(c->Stopped())
-      {
-	 Trim();
-	 return;
-      }
-      c->GetData(a,n);
+      Expired(c);
+      c=0;
+   }
+   if(!c)
+   {
+      Miss();
+      return;
    }
+   Hit(c);
+   c->GetData(a,n);
 }
@@ -25,6 +25,7 @@
 #include "xarray.h"
 #include "Cache.h"
 #include "network.h"
+#include "DnsLookup.h"
 
 class Resolver : public SMTask, protected ProtoLog, protected Networker
 {
@@ -65,6 +66,18 @@ class Resolver : public SMTask, protected ProtoLog, protected Networker
    bool no_cache;
    bool use_fork;
 
+   bool use_builtin;
+   bool builtin_started;
+   SMTaskRef<DnsLookup> srv_lookup;
+   TaskRefArray<DnsLookup> lookups;
+   xarray<int> lookup_port;   // for the addresses of each lookup
+
+   bool FindPort();
+   int  DoBuiltin();
+   bool StartLookup(const char *name,int port);
+   void StartSRVTargets();
+   void Finish();
+
 public:
    int	 Do();
    bool	 Done() { return done; }
@@ -120,10 +133,13 @@ public:
 	 const sockaddr_u *a,int n) : ResolverCacheEntryLoc(h,p,defp,ser,pr), ResolverCacheEntryData(a,n) {
       SetResource("dns:cache-expire",GetClosure());
    }
+   ResolverCacheEntry *NextSameKey() const { return (ResolverCacheEntry*)CacheEntry::NextSameKey(); }
 };
 class ResolverCache : public Cache, public ResClient
 {
+   static const xstring& MakeKey(const char *h,const char *p,const char *defp,const char *ser,const char *pr);
    ResolverCacheEntry *Find(const char *h,const char *p,const char *defp,const char *ser,const char *pr);
+   ResolverCacheEntry *FindFirst(const xstring& key) const { return (ResolverCacheEntry*)Cache::FindFirst(key); }
    ResolverCacheEntry *IterateFirst() { return (ResolverCacheEntry*)Cache::IterateFirst(); }
    ResolverCacheEntry *IterateNext()  { return (ResolverCacheEntry*)Cache::IterateNext(); }
    ResolverCacheEntry *IterateDelete(){ return (ResolverCacheEntry*)Cache::IterateDelete(); }
@@ -794,6 +794,8 @@ public:
    ListInfo *MakeListInfo(const char *dir);
 
    bool NeedSizeDateBeforehand() { return false; }
+   bool CanStoreAt() { return true; }
+   bool StoreOpened() { return mode==STORE && state==FILE_SEND; }
 
    void SuspendInternal();
    void ResumeInternal();
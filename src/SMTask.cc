@@ -30,6 +30,15 @@
 #include "Timer.h"
 #include "misc.h"
 
+#if defined(__GXX_RTTI)
+# include <typeinfo>
+#elif defined(HAVE_DLADDR)
+# include <dlfcn.h>
+#endif
+#ifdef __GNUC__
+# include <cxxabi.h>
+#endif
+
 #ifdef TASK_DEBUG
 # define DEBUG(x) do{printf x;fflush(stdout);}while(0)
 #else
@@ -40,6 +49,17 @@ xlist_head<SMTask>  SMTask::all_tasks;
 xlist_head<SMTask>  SMTask::ready_tasks;
 xlist_head<SMTask>  SMTask::new_tasks;
 xlist_head<SMTask>  SMTask::deleted_tasks;
+xlist_head<SMTask>  SMTask::sleeping_tasks;
+int		    SMTask::sleeping_count;
+unsigned long long  SMTask::do_calls_avoided;
+unsigned long long  SMTask::schedule_count;
+bool		    SMTask::scheduling;
+xarray_p< xarray<SMTask*> > SMTask::fd_waiters;
+
+bool		    SMTask::profiling;
+xarray_p<SMTask::profile_entry> SMTask::profile;
+unsigned long long  SMTask::block_count;
+double		    SMTask::block_time;
 
 SMTask	 *SMTask::current;
 
@@ -54,13 +74,18 @@ static SMTask *init_task=new SMTaskInit;
 
 SMTask::SMTask()
  : all_tasks_node(this), ready_tasks_node(this),
-   new_tasks_node(this), deleted_tasks_node(this)
+   new_tasks_node(this), deleted_tasks_node(this),
+   sleeping_tasks_node(this)
 {
    // insert in the chain
    all_tasks.add(all_tasks_node);
 
    suspended=false;
    suspended_slave=false;
+   sleep_on_stall=false;
+   stay_awake=false;
+   wait_timeout=false;
+   slept_at=0;
    running=0;
    ref_count=0;
    deleting=false;
@@ -104,6 +129,7 @@ void  SMTask::ResumeSlave()
 }
 void SMTask::ResumeInternal()
 {
+   Wake();
    if(!new_tasks_node.listed() && !ready_tasks_node.listed())
       new_tasks.add_tail(new_tasks_node);
 }
@@ -119,6 +145,8 @@ SMTask::~SMTask()
       ready_tasks_node.remove();
    if(new_tasks_node.listed())
       new_tasks_node.remove();
+   if(sleeping_tasks_node.listed())
+      Unsleep();
    assert(!deleted_tasks_node.listed());
 
    // remove from the chain
@@ -132,6 +160,8 @@ void SMTask::DeleteLater()
    DEBUG(("DeleteLater(%p) from %p\n",this,current));
    deleting=true;
    deleted_tasks.add_tail(deleted_tasks_node);
+   if(sleeping_tasks_node.listed())
+      Unsleep();
    PrepareToDie();
 }
 void SMTask::Delete(SMTask *task)
@@ -168,9 +198,20 @@ int SMTask::Roll(SMTask *task)
    int m=STALL;
    if(task->running || task->deleting)
       return m;
+   task->Wake();
    Enter(task);
-   while(!task->deleting && task->Do()==MOVED)
+   while(!task->deleting)
+   {
+      Time start;
+      if(profiling)
+	 start.SetToCurrentTime();
+      int res=task->Do();
+      if(profiling)
+	 ProfileDo(task,res,start);
+      if(res!=MOVED)
+	 break;
       m=MOVED;
+   }
    Leave(task);
    return m;
 }
@@ -206,12 +247,135 @@ int SMTask::ScheduleThis()
       ready_tasks_node.remove();
       return STALL;
    }
+   if(sleep_on_stall)
+      ClearWaits();
+   Time start;
+   if(profiling)
+      start.SetToCurrentTime();
    Enter();	   // mark it current and running.
    int res=Do();   // let it run.
    Leave();	   // unmark it running and change current.
+   if(profiling)
+      ProfileDo(this,res,start);
+   if(res==STALL && sleep_on_stall && !stay_awake && !deleting && !new_tasks_node.listed()
+   && (wait_fds.count()>0 || wait_timeout))
+      Sleep();
    return res;
 }
 
+void SMTask::AddWaitFD(int fd,int mask)
+{
+   for(int i=0; i<wait_fds.count(); i++)
+   {
+      if(wait_fds[i].fd==fd)
+      {
+	 wait_fds[i].mask|=mask;
+	 return;
+      }
+   }
+   fd_wait w={fd,mask};
+   wait_fds.append(w);
+}
+void SMTask::AddWaitTime(const Time &t)
+{
+   if(!wait_timeout || t<wait_until)
+      wait_until=t;
+   wait_timeout=true;
+}
+
+void SMTask::Sleep()
+{
+   ready_tasks_node.remove();
+   sleeping_tasks.add_tail(sleeping_tasks_node);
+   sleeping_count++;
+   slept_at=schedule_count;
+   for(int i=0; i<wait_fds.count(); i++)
+   {
+      int fd=wait_fds[i].fd;
+      while(fd_waiters.count()<=fd)
+	 fd_waiters.append(0);
+      if(!fd_waiters[fd])
+	 fd_waiters[fd]=new xarray<SMTask*>;
+      fd_waiters[fd]->append(this);
+   }
+}
+void SMTask::Unsleep()
+{
+   for(int i=0; i<wait_fds.count(); i++)
+   {
+      xarray<SMTask*> *w=fd_waiters[wait_fds[i].fd];
+      w->remove(w->search(this));
+   }
+   sleeping_tasks_node.remove();
+   sleeping_count--;
+   // the passes which have not run the task; a task woken during a pass
+   // runs in the same pass.
+   unsigned long long skipped=schedule_count-slept_at;
+   if(scheduling && skipped>0)
+      skipped--;
+   if(!IsSuspended())
+      do_calls_avoided+=skipped;
+}
+void SMTask::Wake()
+{
+   if(!sleeping_tasks_node.listed())
+      return;
+   Unsleep();
+   if(!new_tasks_node.listed())
+      new_tasks.add_tail(new_tasks_node);
+}
+
+void SMTask::WakeFDWaiters()
+{
+   const xarray<int>& ready=block.ReadyFDs();
+   for(int i=0; i<ready.count(); i++)
+   {
+      int fd=ready[i];
+      if(fd>=fd_waiters.count() || !fd_waiters[fd])
+	 continue;
+      xarray<SMTask*>& w=*fd_waiters[fd];
+      for(int j=w.count()-1; j>=0; j--)
+      {
+	 if(j>=w.count())
+	    continue;
+	 SMTask *task=w[j];
+	 for(int k=0; k<task->wait_fds.count(); k++)
+	 {
+	    const fd_wait& fw=task->wait_fds[k];
+	    if(fw.fd==fd && block.FDReady(fd,fw.mask))
+	    {
+	       task->Wake();
+	       break;
+	    }
+	 }
+      }
+   }
+}
+void SMTask::WakeAll()
+{
+   xlist_for_each_safe(SMTask,sleeping_tasks,node,task,next)
+      task->Wake();
+}
+// keep the wakeup conditions of sleeping tasks in the poll set,
+// wake up the tasks with expired timeouts.
+void SMTask::AddSleepingWaits()
+{
+   xlist_for_each_safe(SMTask,sleeping_tasks,node,task,next)
+   {
+      if(task->wait_timeout)
+      {
+	 if(now>=task->wait_until)
+	 {
+	    task->Wake();
+	    continue;
+	 }
+	 block.AddTimeoutU(TimeDiff(task->wait_until,now).MicroSeconds());
+      }
+      for(int i=0; i<task->wait_fds.count(); i++)
+	 block.AddFD(task->wait_fds[i].fd,task->wait_fds[i].mask);
+   }
+}
+
 int SMTask::ScheduleNew()
 {
    int res=STALL;
@@ -240,6 +404,10 @@ void SMTask::Schedule()
    if(timer_timeout.tv_sec>=0)
       block.SetTimeout(timer_timeout);
 
+   schedule_count++;
+   scheduling=true;
+   AddSleepingWaits();
+
    int res=ScheduleNew();
    xlist_for_each_safe(SMTask,ready_tasks,node,task,next)
    {
@@ -251,6 +419,7 @@ void SMTask::Schedule()
       if(next_task)
 	 next_task->DecRefCount();
    }
+   scheduling=false;
    CollectGarbage();
    if(res)
       block.NoWait();
@@ -261,8 +430,23 @@ void SMTask::Block()
    // use timer to force periodic select to find out which FDs are ready.
    if(block.WillNotBlock() && last_block==now.UnixTime())
       return;
-   block.Block();
+   Time start;
+   if(profiling)
+      start.SetToCurrentTime();
+   int res=block.Block();
    last_block=now.UnixTime();
+   if(profiling)
+   {
+      Time end;
+      end.SetToCurrentTime();
+      block_time+=TimeDiff(end,start);
+      block_count++;
+   }
+   // a signal may have changed the state of any task.
+   if(res<0)
+      WakeAll();
+   else
+      WakeFDWaiters();
 }
 
 int SMTaskInit::Do()
@@ -328,7 +512,121 @@ void SMTask::PrintTasks()
    {
       const char *c=scan->GetLogContext();
       if(!c) c="";
-      printf("%p\t%c%c%c\t%d\t%s\n",scan,scan->running?'R':' ',
-	 scan->suspended?'S':' ',scan->deleting?'D':' ',scan->ref_count,c);
+      printf("%p\t%c%c%c%c\t%d\t%s\n",scan,scan->running?'R':' ',
+	 scan->suspended?'S':' ',scan->deleting?'D':' ',
+	 scan->IsSleeping()?'W':' ',scan->ref_count,c);
+   }
+}
+
+// the vtable pointer is different for each class even without RTTI
+static inline const void *task_vtbl(const SMTask *task)
+{
+   return *reinterpret_cast<const void *const*>(task);
+}
+
+const char *SMTask::TaskClassName(SMTask *task)
+{
+   const char *mangled=0;
+   xstring& name=xstring::get_tmp();
+#if defined(__GXX_RTTI)
+   mangled=typeid(*task).name();
+#elif defined(HAVE_DLADDR)
+   Dl_info info;
+   if(dladdr(task_vtbl(task),&info) && info.dli_sname
+   && !strncmp(info.dli_sname,"_ZTV",4))
+      mangled=info.dli_sname+4;  // skip the vtable prefix
+#endif
+   if(!mangled)
+      return name.setf("vtable@%p",task_vtbl(task));
+#ifdef __GNUC__
+   int status=0;
+   char *demangled=abi::__cxa_demangle(mangled,0,0,&status);
+   if(demangled)
+   {
+      name.set(demangled);
+      free(demangled);
+      return name;
+   }
+#endif
+   return name.set(mangled);
+}
+
+void SMTask::ProfileDo(SMTask *task,int res,const Time &start)
+{
+   Time end;
+   end.SetToCurrentTime();
+   double t=TimeDiff(end,start);
+
+   const void *vtbl=task_vtbl(task);
+   profile_entry *e=0;
+   for(int i=0; i<profile.count(); i++)
+   {
+      if(profile[i]->vtbl==vtbl)
+      {
+	 e=profile[i];
+	 break;
+      }
+   }
+   if(!e)
+   {
+      e=new profile_entry;
+      e->vtbl=vtbl;
+      e->name.set(TaskClassName(task));
+      e->calls=e->moved=0;
+      e->time=e->max_time=0;
+      profile.append(e);
+   }
+   e->calls++;
+   if(res==MOVED)
+      e->moved++;
+   e->time+=t;
+   if(t>e->max_time)
+      e->max_time=t;
+}
+
+void SMTask::ResetProfile()
+{
+   profile.truncate();
+   block_count=0;
+   block_time=0;
+}
+
+int SMTask::ProfileCmp(const profile_entry **a,const profile_entry **b)
+{
+   if((*a)->time>(*b)->time)
+      return -1;
+   if((*a)->time<(*b)->time)
+      return 1;
+   return strcmp((*a)->name,(*b)->name);
+}
+
+void SMTask::PrintProfile(bool machine_readable)
+{
+   profile.qsort(ProfileCmp);
+   if(machine_readable)
+   {
+      printf("profiling=%d block_calls=%llu block_time=%.6f poll_backend=%s\n",
+	 profiling,block_count,block_time,block.GetBackendName());
+      for(int i=0; i<profile.count(); i++)
+      {
+	 const profile_entry *e=profile[i];
+	 printf("class=%s calls=%llu moved=%llu stall=%llu time=%.6f max_time=%.6f\n",
+	    e->name.get(),e->calls,e->moved,e->calls-e->moved,e->time,e->max_time);
+      }
+      return;
+   }
+   if(!profiling && profile.count()==0)
+   {
+      printf("profiling is off, use `.tasks -p on' to turn it on\n");
+      return;
+   }
+   printf("PollVec::Block (%s): %llu calls, %.6fs\n",
+      block.GetBackendName(),block_count,block_time);
+   printf("%10s %7s %12s %10s  %s\n","calls","moved%","time","max","class");
+   for(int i=0; i<profile.count(); i++)
+   {
+      const profile_entry *e=profile[i];
+      printf("%10llu %6.2f%% %11.6fs %9.6fs  %s\n",e->calls,
+	 e->calls?100.*e->moved/e->calls:0.,e->time,e->max_time,e->name.get());
    }
 }
@@ -27,6 +27,7 @@
 #include "xlist.h"
 #include "misc.h"
 #include "Error.h"
+#include "xstring.h"
 #include <errno.h>
 
 class SMTask
@@ -49,6 +50,52 @@ class SMTask
    static xlist_head<SMTask> deleted_tasks;
    xlist<SMTask> deleted_tasks_node;
 
+   // tasks sleeping until one of their fds is ready, a timeout
+   // expires or they are explicitly woken up
+   static xlist_head<SMTask> sleeping_tasks;
+   xlist<SMTask> sleeping_tasks_node;
+   static int sleeping_count;
+   static unsigned long long do_calls_avoided;
+   static unsigned long long schedule_count;  // Schedule passes so far
+   static bool scheduling;
+   unsigned long long slept_at;	 // the pass the task went to sleep in
+
+   // wakeup conditions registered during the last Do
+   struct fd_wait { int fd; int mask; };
+   xarray<fd_wait> wait_fds;
+   Time wait_until;
+   bool wait_timeout;
+
+   // wakeup registry: sleeping tasks indexed by fd
+   static xarray_p< xarray<SMTask*> > fd_waiters;
+
+   void AddWaitFD(int fd,int mask);
+   void AddWaitTime(const Time &t);
+   void ClearWaits() { wait_fds.truncate(); wait_timeout=false; stay_awake=false; }
+   void Sleep();
+   void Unsleep();
+   static void WakeFDWaiters();
+   static void WakeAll();
+   static void AddSleepingWaits();
+
+   // scheduler profiling, see `.tasks -v'
+   struct profile_entry
+   {
+      const void *vtbl;	// identifies the task class
+      xstring_c name;
+      unsigned long long calls;
+      unsigned long long moved;
+      double time;
+      double max_time;
+   };
+   static bool profiling;
+   static xarray_p<profile_entry> profile;
+   static unsigned long long block_count;
+   static double block_time;
+   static void ProfileDo(SMTask *task,int res,const Time &start);
+   static const char *TaskClassName(SMTask *task);
+   static int ProfileCmp(const profile_entry **a,const profile_entry **b);
+
    static PollVec block;
    enum { SMTASK_MAX_DEPTH=64 };
    static SMTask *stack[SMTASK_MAX_DEPTH];
@@ -56,6 +103,8 @@ class SMTask
 
    bool	 suspended;
    bool	 suspended_slave;
+   bool	 sleep_on_stall;
+   bool	 stay_awake;
 
    int	 running;
    int	 ref_count;
@@ -80,13 +129,36 @@ protected:
    bool Deleted() const { return deleting; }
    virtual ~SMTask();
 
+   // Allow the scheduler to skip Do() after it returned STALL, until
+   // a fd or timeout registered in that Do() fires or Wake() is called.
+   // Only for tasks which do not poll the state of other tasks.
+   void SetSleepOnStall(bool s=true) { sleep_on_stall=s; }
+   // don't sleep after this Do(), the task waits for something
+   // which cannot wake it up.
+   void StayAwake() { stay_awake=true; }
+
 public:
-   static void Block(int fd,int mask) { block.AddFD(fd,mask); }
-   static void TimeoutU(int us) { block.AddTimeoutU(us); }
+   static void Block(int fd,int mask) {
+      block.AddFD(fd,mask);
+      if(current->sleep_on_stall)
+	 current->AddWaitFD(fd,mask);
+   }
+   static void TimeoutU(int us) {
+      block.AddTimeoutU(us);
+      if(current->sleep_on_stall)
+	 current->AddWaitTime(now+TimeDiff(0,0,us));
+   }
+   // called when the current task checks a timer expiring at t
+   static void WaitTimer(const Time &t) {
+      if(current && current->sleep_on_stall)
+	 current->AddWaitTime(t);
+   }
    static void Timeout(int ms) { TimeoutU(1000*ms); }
    static void TimeoutS(int s) { TimeoutU(1000000*s); }
    static bool Ready(int fd,int mask) { return block.FDReady(fd,mask); }
    static void SetNotReady(int fd,int mask) { block.FDSetNotReady(fd,mask); }
+   // must be called for each new descriptor which may be waited for
+   static void FDOpened(int fd) { block.FDOpened(fd); }
 
    static TimeDate now;
    static void UpdateNow() { now.SetToCurrentTime(); }
@@ -106,6 +178,12 @@ public:
 
    bool IsSuspended() { return suspended|suspended_slave; }
 
+   // make a sleeping task run again
+   void Wake();
+   bool IsSleeping() const { return sleeping_tasks_node.listed(); }
+   static int SleepingCount() { return sleeping_count; }
+   static unsigned long long DoCallsAvoided() { return do_calls_avoided; }
+
    virtual const char *GetLogContext() { return 0; }
    static const char *GetCurrentLogContext() { return current->GetLogContext(); }
 
@@ -132,6 +210,11 @@ public:
 
    static int TaskCount();
    static void PrintTasks();
+
+   static void SetProfiling(bool p) { profiling=p; }
+   static bool IsProfiling() { return profiling; }
+   static void ResetProfile();
+   static void PrintProfile(bool machine_readable);
    static bool NonFatalError(int err);
    static bool TemporaryNetworkError(int err) { return temporary_network_error(err); }
    static Error *SysError(int e=errno) { return new Error(e,strerror(e),!NonFatalError(e)); }
@@ -0,0 +1,355 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+#endif
+#include "ThreadPool.h"
+#include "ResMgr.h"
+#include "log.h"
+
+ResDecl res_worker_threads("xfer:worker-threads","4",ResMgr::UNumberValidate,ResMgr::NoClosure);
+
+SMTaskRef<ThreadPool> ThreadPool::pool;
+
+int ThreadPool::ThreadCount()
+{
+#ifdef USE_THREAD_POOL
+   return res_worker_threads.Query(0);
+#else
+   return 0;
+#endif
+}
+
+ThreadPool *ThreadPool::Get()
+{
+   if(!pool)
+      pool=new ThreadPool();
+   return pool.get_non_const();
+}
+
+ThreadPool::ThreadPool()
+{
+   notify_fd[0]=notify_fd[1]=-1;
+   in_flight=0;
+#ifdef USE_THREAD_POOL
+   running=0;
+   forked=false;
+   pthread_mutex_init(&mutex,0);
+   pthread_cond_init(&job_cond,0);
+   pthread_cond_init(&done_cond,0);
+   pthread_atfork(AtForkPrepare,AtForkParent,AtForkChild);
+#endif
+   SetSleepOnStall();
+}
+
+ThreadPool::~ThreadPool()
+{
+   // the pool lives until exit; the workers are left blocked in
+   // pthread_cond_wait and die with the process.
+   CloseNotify();
+}
+
+bool ThreadPool::OpenNotify()
+{
+   if(notify_fd[0]!=-1)
+      return true;
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_EVENTFD)
+   int fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+   if(fd!=-1) {
+      notify_fd[0]=notify_fd[1]=fd;
+      return true;
+   }
+#endif
+   if(pipe(notify_fd)==-1) {
+      Log::global->Format(0,"ThreadPool: pipe(): %s\n",strerror(errno));
+      notify_fd[0]=notify_fd[1]=-1;
+      return false;
+   }
+   for(int i=0; i<2; i++) {
+      fcntl(notify_fd[i],F_SETFL,O_NONBLOCK);
+      fcntl(notify_fd[i],F_SETFD,FD_CLOEXEC);
+   }
+   return true;
+}
+void ThreadPool::CloseNotify()
+{
+   if(notify_fd[0]!=-1)
+      close(notify_fd[0]);
+   if(notify_fd[1]!=notify_fd[0])
+      close(notify_fd[1]);
+   notify_fd[0]=notify_fd[1]=-1;
+}
+void ThreadPool::Notify()
+{
+   // called from worker threads; eventfd wants 8 bytes, a pipe takes any.
+   unsigned long long one=1;
+   int res;
+   do
+      res=write(notify_fd[1],&one,notify_fd[0]==notify_fd[1]?sizeof(one):1);
+   while(res==-1 && errno==EINTR);
+}
+void ThreadPool::DrainNotify()
+{
+   char buf[64];
+   while(read(notify_fd[0],buf,sizeof(buf))>0)
+      ;
+}
+
+// the waiter is the task which consumes the result, it is woken up
+// when the job is done.
+void ThreadPool::Submit(ThreadJob *j,SMTask *waiter)
+{
+   j->waiter=waiter;
+   j->done=false;
+   j->finished=false;
+   if(!Enabled() || !Get()->OpenNotify()) {
+      j->Run();
+      j->done=j->finished=true;
+      return;
+   }
+   pool->Queue(j);
+}
+
+void ThreadPool::Cancel(ThreadJob *j)
+{
+   if(j->done || !pool)
+      return;
+   pool->CancelJob(j);
+}
+
+#ifdef USE_THREAD_POOL
+
+void ThreadPool::Queue(ThreadJob *j)
+{
+   if(forked) {
+      j->Run();
+      j->done=j->finished=true;
+      return;
+   }
+   pthread_mutex_lock(&mutex);
+   queued.append(j);
+   pthread_cond_signal(&job_cond);
+   int busy=queued.count()+running;
+   pthread_mutex_unlock(&mutex);
+   in_flight++;
+   StartThreads(busy);
+}
+
+void ThreadPool::StartThreads(int max)
+{
+   int want=ThreadCount();
+   if(want>max)
+      want=max;
+   if(threads.count()>=want)
+      return;
+   // workers must not catch our signals
+   sigset_t all,old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_SETMASK,&all,&old);
+   while(threads.count()<want) {
+      pthread_t t;
+      int err=pthread_create(&t,0,ThreadMain,this);
+      if(err) {
+	 Log::global->Format(0,"ThreadPool: pthread_create(): %s\n",strerror(err));
+	 break;
+      }
+      pthread_detach(t);
+      threads.append(t);
+   }
+   pthread_sigmask(SIG_SETMASK,&old,0);
+   if(threads.count()==0) {
+      // no way to run the jobs in background, do it here.
+      pthread_mutex_lock(&mutex);
+      while(queued.count()>0) {
+	 ThreadJob *j=queued[0];
+	 queued.remove(0);
+	 j->Run();
+	 j->finished=true;
+	 finished.append(j);
+      }
+      pthread_mutex_unlock(&mutex);
+      Notify();
+   }
+}
+
+void *ThreadPool::ThreadMain(void *p)
+{
+   static_cast<ThreadPool*>(p)->Worker();
+   return 0;
+}
+
+void ThreadPool::Worker()
+{
+   pthread_mutex_lock(&mutex);
+   for(;;) {
+      while(queued.count()==0)
+	 pthread_cond_wait(&job_cond,&mutex);
+      ThreadJob *j=queued[0];
+      queued.remove(0);
+      running++;
+      pthread_mutex_unlock(&mutex);
+
+      j->Run();
+
+      pthread_mutex_lock(&mutex);
+      running--;
+      j->finished=true;
+      finished.append(j);
+      pthread_cond_broadcast(&done_cond);
+      Notify();
+   }
+}
+
+void ThreadPool::CancelJob(ThreadJob *j)
+{
+   if(forked) {
+      // no workers here, a job which was running at fork() is abandoned.
+      for(int i=0; i<queued.count(); i++)
+	 if(queued[i]==j)
+	    queued.remove(i--);
+      for(int i=0; i<finished.count(); i++)
+	 if(finished[i]==j)
+	    finished.remove(i--);
+      j->done=true;
+      in_flight--;
+      return;
+   }
+   pthread_mutex_lock(&mutex);
+   bool was_queued=false;
+   for(int i=0; i<queued.count(); i++) {
+      if(queued[i]==j) {
+	 queued.remove(i);
+	 was_queued=true;
+	 break;
+      }
+   }
+   if(!was_queued) {
+      while(!j->finished)
+	 pthread_cond_wait(&done_cond,&mutex);
+      for(int i=0; i<finished.count(); i++) {
+	 if(finished[i]==j) {
+	    finished.remove(i);
+	    break;
+	 }
+      }
+   }
+   pthread_mutex_unlock(&mutex);
+   j->done=true;
+   in_flight--;
+}
+
+// in a child the queues were left consistent by AtForkPrepare and
+// nobody else touches them, so the mutex is not needed (nor usable).
+void ThreadPool::RunQueuedInChild()
+{
+   CloseNotify();
+   while(queued.count()>0) {
+      ThreadJob *j=queued[0];
+      queued.remove(0);
+      j->Run();
+      j->finished=true;
+      finished.append(j);
+   }
+}
+
+int ThreadPool::Do()
+{
+   if(in_flight==0)
+      return STALL;
+   xarray<ThreadJob*> done_jobs;
+   if(forked) {
+      RunQueuedInChild();
+      done_jobs.move_here(finished);
+   } else {
+      DrainNotify();
+      pthread_mutex_lock(&mutex);
+      done_jobs.move_here(finished);
+      pthread_mutex_unlock(&mutex);
+   }
+   for(int i=0; i<done_jobs.count(); i++) {
+      ThreadJob *j=done_jobs[i];
+      j->done=true;
+      in_flight--;
+      if(j->waiter)
+	 j->waiter->Wake();
+   }
+   if(in_flight>0 && !forked)
+      Block(notify_fd[0],POLLIN);
+   return done_jobs.count()>0?MOVED:STALL;
+}
+
+// for code which forks and continues in the child.
+void ThreadPool::WaitAll()
+{
+   if(!pool || pool->in_flight==0 || pool->forked)
+      return;
+   ThreadPool *p=pool.get_non_const();
+   pthread_mutex_lock(&p->mutex);
+   while(p->queued.count()>0 || p->running>0)
+      pthread_cond_wait(&p->done_cond,&p->mutex);
+   pthread_mutex_unlock(&p->mutex);
+   p->Roll();
+}
+
+// fork() only clones the calling thread.  The mutex is held across
+// fork() so that the child gets consistent queues; the child only
+// marks the pool unusable, the rest is done in Do().
+void ThreadPool::AtForkPrepare()
+{
+   if(pool)
+      pthread_mutex_lock(&pool.get_non_const()->mutex);
+}
+void ThreadPool::AtForkParent()
+{
+   if(pool)
+      pthread_mutex_unlock(&pool.get_non_const()->mutex);
+}
+void ThreadPool::AtForkChild()
+{
+   if(pool)
+      pool.get_non_const()->forked=true;
+}
+
+#else // !USE_THREAD_POOL
+
+void ThreadPool::Queue(ThreadJob *j)
+{
+   j->Run();
+   j->done=j->finished=true;
+}
+void ThreadPool::CancelJob(ThreadJob *j)
+{
+   j->done=true;
+}
+int ThreadPool::Do()
+{
+   return STALL;
+}
+void ThreadPool::WaitAll()
+{
+}
+
+#endif // USE_THREAD_POOL
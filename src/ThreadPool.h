@@ -0,0 +1,110 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "SMTask.h"
+#include "xarray.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+# define USE_THREAD_POOL 1
+# include <pthread.h>
+#endif
+
+/* A piece of CPU-bound work to be run off the main loop.  Run() is called
+   in a worker thread and must only touch data owned by the job; the
+   result is picked up in the main thread after Done() becomes true.
+   Derived classes must call Cancel() in their destructor, so that the
+   job is not destroyed while a worker still runs it. */
+class ThreadJob
+{
+   friend class ThreadPool;
+
+   SMTask *waiter;   // woken up when the job is done, set by Submit
+   bool done;	     // main thread view
+   bool finished;    // worker view, guarded by the pool mutex
+
+protected:
+   void Cancel();
+
+public:
+   ThreadJob() : waiter(0), done(false), finished(false) {}
+   virtual ~ThreadJob() {}
+   virtual void Run()=0;
+   bool Done() const { return done; }
+};
+
+/* Fixed set of worker threads.  Completion is signalled to the main loop
+   through an eventfd (or a pipe) which the pool task polls.  When threads
+   are not available or xfer:worker-threads is 0, jobs are run
+   synchronously in Submit.  The workers do not survive fork(), in the
+   child the pool runs the jobs synchronously; code which continues
+   in the child must call WaitAll() before forking. */
+class ThreadPool : public SMTask
+{
+   static SMTaskRef<ThreadPool> pool;
+   static ThreadPool *Get();
+
+   int notify_fd[2];
+   int in_flight;    // submitted and not yet done, main thread only
+
+#ifdef USE_THREAD_POOL
+   pthread_mutex_t mutex;
+   pthread_cond_t job_cond;   // a job is queued
+   pthread_cond_t done_cond;  // a job is finished
+   xarray<pthread_t> threads;
+   xarray<ThreadJob*> queued;
+   xarray<ThreadJob*> finished;
+   int running;
+   bool forked;   // we are in a child process, the workers are gone
+
+   static void *ThreadMain(void *);
+   void Worker();
+   void StartThreads(int max);
+   void RunQueuedInChild();
+   static void AtForkPrepare();
+   static void AtForkParent();
+   static void AtForkChild();
+#endif
+
+   bool OpenNotify();
+   void CloseNotify();
+   void Notify();
+   void DrainNotify();
+
+   void Queue(ThreadJob *j);
+   void CancelJob(ThreadJob *j);
+
+   ThreadPool();
+   ~ThreadPool();
+
+public:
+   int Do();
+
+   static int ThreadCount();
+   static bool Enabled() { return ThreadCount()>0; }
+   static void Submit(ThreadJob *j,SMTask *waiter);
+   static void Cancel(ThreadJob *j);
+   static void WaitAll();
+};
+
+inline void ThreadJob::Cancel() { ThreadPool::Cancel(this); }
+
+#endif//THREADPOOL_H
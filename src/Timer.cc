@@ -116,7 +116,10 @@ bool Timer::Stopped() const
 {
    if(IsInfty())
       return false;
-   return now>=stop;
+   if(now>=stop)
+      return true;
+   SMTask::WaitTimer(stop);
+   return false;
 }
 void Timer::reconfig(const char *r)
 {
@@ -318,6 +318,7 @@ void Torrent::RemoveTorrent(Torrent *t)
 
 void Torrent::PrepareToDie()
 {
+   validate_jobs.truncate();
    metainfo_copy=0;
    building=0;
    peers.unset();
@@ -420,15 +421,25 @@ void Torrent::SHA1(const xstring& str,xstring& buf)
 void Torrent::ValidatePiece(unsigned p)
 {
    const xstring& buf=Torrent::RetrieveBlock(p,0,PieceLength(p));
+   if(buf.length()!=PieceLength(p)) {
+      ApplyPieceDigest(p,0);
+      return;
+   }
+   xstring& sha1=xstring::get_tmp();
+   SHA1(buf,sha1);
+   ApplyPieceDigest(p,&sha1);
+}
+
+// sha1==0 means the piece could not be read completely
+void Torrent::ApplyPieceDigest(unsigned p,const xstring *sha1)
+{
    bool valid=false;
-   if(buf.length()==PieceLength(p)) {
-      xstring& sha1=xstring::get_tmp();
-      SHA1(buf,sha1);
+   if(sha1) {
       if(building) {
-	 building->SetPiece(p,sha1);
+	 building->SetPiece(p,*sha1);
 	 valid=true;
       } else {
-	 valid=!memcmp(pieces->get()+p*SHA1_DIGEST_SIZE,sha1,SHA1_DIGEST_SIZE);
+	 valid=!memcmp(pieces->get()+p*SHA1_DIGEST_SIZE,sha1->get(),SHA1_DIGEST_SIZE);
       }
    }
    if(!valid) {
@@ -436,7 +447,7 @@ void Torrent::ValidatePiece(unsigned p)
 	 SetError("File validation error");
 	 return;
       }
-      if(buf.length()==PieceLength(p))
+      if(sha1)
 	 LogError(11,"piece %u digest mismatch",p);
       if(my_bitfield->get_bit(p)) {
 	 total_left+=PieceLength(p);
@@ -455,6 +466,44 @@ void Torrent::ValidatePiece(unsigned p)
    }
 }
 
+void TorrentPieceDigest::Run()
+{
+   sha1.get_space(SHA1_DIGEST_SIZE);
+   sha1_buffer(data.get(),data.length(),sha1.get_non_const());
+   sha1.set_length(SHA1_DIGEST_SIZE);
+}
+
+/* Pieces are read here and hashed by the worker threads, a few pieces
+   are kept in flight.  Returns true when all the pieces are validated. */
+bool Torrent::ContinueValidating(int &m)
+{
+   while(validate_jobs.count()>0 && validate_jobs[0]->Done()) {
+      const TorrentPieceDigest *j=validate_jobs[0];
+      ApplyPieceDigest(j->piece,&j->sha1);
+      recv_rate.Add(PieceLength(j->piece));
+      validate_jobs.remove(0);
+      m=MOVED;
+      if(invalid_cause)
+	 return false;
+   }
+   int max_jobs=ThreadPool::ThreadCount()*2;
+   if(validate_index<total_pieces && validate_jobs.count()<=max_jobs) {
+      unsigned p=validate_index++;
+      // read into a buffer of its own, the job takes it over
+      xstring buf;
+      if(!RetrieveBlock(buf,p,0,PieceLength(p)) || buf.length()!=PieceLength(p)) {
+	 ApplyPieceDigest(p,0);
+	 recv_rate.Add(PieceLength(p));
+      } else {
+	 TorrentPieceDigest *j=new TorrentPieceDigest(p,buf);
+	 validate_jobs.append(j);
+	 ThreadPool::Submit(j,this);
+      }
+      m=MOVED;
+   }
+   return validate_index>=total_pieces && validate_jobs.count()==0;
+}
+
 template<typename T>
 static inline int cmp(T a,T b)
 {
@@ -749,6 +798,7 @@ void Torrent::SetTotalLength(off_t tl)
 
 void Torrent::StartValidating()
 {
+   validate_jobs.truncate();
    validate_index=0;
    validating=true;
    recv_rate.Reset();
@@ -1362,12 +1412,8 @@ int Torrent::Do()
    if(peers_scan_timer.Stopped())
       ScanPeers();
    if(validating) {
-      ValidatePiece(validate_index++);
-      if(validate_index<total_pieces) {
-	 recv_rate.Add(piece_length);
-	 return MOVED;
-      }
-      recv_rate.Add(last_piece_length);
+      if(!ContinueValidating(m))
+	 return m;
       validating=false;
       recv_rate.Reset();
       if(total_left==0) {
@@ -1856,6 +1902,13 @@ void Torrent::SendTrackersRequest(const char *event) const
 const xstring& Torrent::RetrieveBlock(unsigned piece,unsigned begin,unsigned len)
 {
    static xstring buf;
+   if(!RetrieveBlock(buf,piece,begin,len))
+      return xstring::null;
+   return buf;
+}
+// returns false on error, buf can be short at end of file
+bool Torrent::RetrieveBlock(xstring& buf,unsigned piece,unsigned begin,unsigned len)
+{
    buf.truncate(0);
    buf.get_space(len);
 
@@ -1865,11 +1918,11 @@ const xstring& Torrent::RetrieveBlock(unsigned piece,unsigned begin,unsigned len
       const char *file=FindFileByPosition(piece,begin,&f_pos,&f_rest);
       int fd=OpenFile(file,O_RDONLY,validating?f_pos+f_rest:0);
       if(fd==-1)
-	 return xstring::null;
+	 return false;
       int w=pread(fd,buf.add_space(len),MIN(f_rest,len),f_pos);
       if(w==-1) {
 	 SetError(xstring::format("pread(%s): %s",file,strerror(errno)));
-	 return xstring::null;
+	 return false;
       }
       if(w==0) {
 // 	 buf.append_padding(len,'\0');
@@ -1881,7 +1934,7 @@ const xstring& Torrent::RetrieveBlock(unsigned piece,unsigned begin,unsigned len
       if(validating && w==f_rest)
 	 CloseFile(file);
    }
-   return buf;
+   return true;
 }
 
 TorrentPeer *Torrent::FindPeerById(const xstring& p_id)
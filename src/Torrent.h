@@ -29,6 +29,7 @@
 #include "Resolver.h"
 #include "FileCopy.h"
 #include "DHT.h"
+#include "ThreadPool.h"
 
 class FDCache;
 class TorrentBlackList;
@@ -222,6 +223,19 @@ public:
 
 class TorrentTracker;
 
+// hashes one piece in a worker thread during validation
+class TorrentPieceDigest : public ThreadJob
+{
+public:
+   unsigned piece;
+   xstring data;
+   xstring sha1;
+
+   TorrentPieceDigest(unsigned p,xstring& d) : piece(p) { data.move_here(d); }
+   ~TorrentPieceDigest() { Cancel(); }
+   void Run();
+};
+
 class Torrent : public SMTask, protected ProtoLog, public ResClient, protected Networker
 {
    friend class TorrentPeer;
@@ -241,6 +255,7 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient, protected N
    bool stop_if_known;
    bool md_saved;
    unsigned validate_index;
+   xarray_p<TorrentPieceDigest> validate_jobs;
    Ref<Error> invalid_cause;
 
    static const unsigned PEER_ID_LEN = 20;
@@ -407,6 +422,7 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient, protected N
 
    void StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *buf,TorrentPeer *src_peer);
    const xstring& RetrieveBlock(unsigned piece,unsigned begin,unsigned len);
+   bool RetrieveBlock(xstring& buf,unsigned piece,unsigned begin,unsigned len);
 
    Speedometer recv_rate;
    Speedometer send_rate;
@@ -483,6 +499,8 @@ public:
 
    static void SHA1(const xstring& str,xstring& buf);
    void ValidatePiece(unsigned p);
+   void ApplyPieceDigest(unsigned p,const xstring *sha1);
+   bool ContinueValidating(int &m);
    unsigned PieceLength(unsigned p) const { return p==total_pieces-1 ? last_piece_length : piece_length; }
    unsigned BlocksInPiece(unsigned p) const { return p==total_pieces-1 ? blocks_in_last_piece : blocks_in_piece; }
 
@@ -32,6 +32,8 @@ const char *Buffer::Get() const
 {
    if(Size()==0)
       return eof?0:"";
+   if(segs_size>0)
+      const_cast<Buffer*>(this)->JoinSegments();
    return buffer+buffer_ptr;
 }
 
@@ -41,6 +43,213 @@ void Buffer::Get(const char **buf,int *size) const
    *buf=Get();
 }
 
+void Buffer::GetChunk(const char **buf,int *size) const
+{
+   int linear=buffer.length()-buffer_ptr;
+   if(linear>0)
+   {
+      *buf=buffer+buffer_ptr;
+      *size=linear;
+      return;
+   }
+   for(int i=0; i<segs.count(); i++)
+   {
+      const segment &seg=segs[i];
+      if(seg.end>seg.begin)
+      {
+	 *buf=seg.data+seg.begin;
+	 *size=seg.end-seg.begin;
+	 return;
+      }
+   }
+   Get(buf,size);
+}
+
+int Buffer::GetIOV(struct iovec *iov,int max) const
+{
+   int n=0;
+   int linear=buffer.length()-buffer_ptr;
+   if(linear>0 && n<max)
+   {
+      iov[n].iov_base=const_cast<char*>(buffer+buffer_ptr);
+      iov[n].iov_len=linear;
+      n++;
+   }
+   for(int i=0; i<segs.count() && n<max; i++)
+   {
+      const segment &seg=segs[i];
+      if(seg.end>seg.begin)
+      {
+	 iov[n].iov_base=seg.data+seg.begin;
+	 iov[n].iov_len=seg.end-seg.begin;
+	 n++;
+      }
+   }
+   return n;
+}
+
+xarray<char*> Buffer::segment_pool;
+
+char *Buffer::AllocSegment()
+{
+   if(segment_pool.count()>0)
+   {
+      char *s=segment_pool.last();
+      segment_pool.chop();
+      return s;
+   }
+   return (char*)xmalloc(SEGMENT_SIZE);
+}
+void Buffer::FreeSegment(char *s)
+{
+   if(segment_pool.count()<SEGMENT_POOL_MAX)
+      segment_pool.append(s);
+   else
+      xfree(s);
+}
+
+void Buffer::ReleaseSegments()
+{
+   for(int i=0; i<segs.count(); i++)
+      FreeSegment(segs[i].data);
+   segs.truncate();
+   segs_size=0;
+   iov_pending=false;
+}
+
+// free the empty segments at the end, e.g. left by a failed readv.
+void Buffer::DropSpareSegments()
+{
+   iov_pending=false;
+   while(segs.count()>0 && segs.last().end==segs.last().begin)
+   {
+      FreeSegment(segs.last().data);
+      segs.chop();
+   }
+}
+
+void Buffer::AppendSegments(const char *buf,int size)
+{
+   while(size>0)
+   {
+      if(segs.count()==0 || segs.last().end==SEGMENT_SIZE)
+      {
+	 segment seg={AllocSegment(),0,0};
+	 segs.append(seg);
+      }
+      segment &seg=segs.last();
+      int len=SEGMENT_SIZE-seg.end;
+      if(len>size)
+	 len=size;
+      memcpy(seg.data+seg.end,buf,len);
+      seg.end+=len;
+      segs_size+=len;
+      buf+=len;
+      size-=len;
+   }
+}
+
+// copy everything to `buffer', for users needing contiguous data.
+void Buffer::JoinSegments()
+{
+   DropSpareSegments();
+   if(segs_size>0)
+   {
+      if(buffer.length()==(size_t)buffer_ptr && !save)
+      {
+	 buffer.truncate(0);
+	 buffer_ptr=0;
+      }
+      buffer.get_space2(buffer.length()+segs_size,BUFFER_INC);
+      for(int i=0; i<segs.count(); i++)
+      {
+	 const segment &seg=segs[i];
+	 buffer.append(seg.data+seg.begin,seg.end-seg.begin);
+      }
+   }
+   ReleaseSegments();
+}
+
+int Buffer::GetSpaceIOV(struct iovec *iov,int max,int size)
+{
+   DropSpareSegments();
+   if(!segmented || save || size<=0)
+   {
+      iov[0].iov_base=GetSpace(size);
+      iov[0].iov_len=size;
+      return 1;
+   }
+   int n=0;
+   iov_seg=segs.count();
+   if(segs.count()==0)
+   {
+      if(Size()==0)
+      {
+	 // nothing to move, use the linear storage.
+	 iov[0].iov_base=GetSpace(size);
+	 iov[0].iov_len=size;
+	 return 1;
+      }
+      int avail=buffer.available();
+      if(avail>0)
+      {
+	 iov[n].iov_base=buffer.get_non_const()+buffer.length();
+	 iov[n].iov_len=(avail<size?avail:size);
+	 size-=iov[n].iov_len;
+	 n++;
+	 iov_seg=-1;
+      }
+   }
+   else if(segs.last().end<SEGMENT_SIZE)
+   {
+      segment &seg=segs.last();
+      iov[n].iov_base=seg.data+seg.end;
+      iov[n].iov_len=SEGMENT_SIZE-seg.end;
+      if((int)iov[n].iov_len>size)
+	 iov[n].iov_len=size;
+      size-=iov[n].iov_len;
+      n++;
+      iov_seg=segs.count()-1;
+   }
+   while(size>0 && n<max)
+   {
+      segment seg={AllocSegment(),0,0};
+      segs.append(seg);
+      iov[n].iov_base=seg.data;
+      iov[n].iov_len=(size<SEGMENT_SIZE?size:SEGMENT_SIZE);
+      size-=iov[n].iov_len;
+      n++;
+   }
+   iov_pending=true;
+   return n;
+}
+
+void Buffer::SpaceAddIOV(int size)
+{
+   iov_pending=false;
+   int i=iov_seg;
+   if(i==-1)
+   {
+      int len=buffer.available();
+      if(len>size)
+	 len=size;
+      buffer.set_length(buffer.length()+len);
+      size-=len;
+      i=0;
+   }
+   for( ; size>0 && i<segs.count(); i++)
+   {
+      segment &seg=segs[i];
+      int len=SEGMENT_SIZE-seg.end;
+      if(len>size)
+	 len=size;
+      seg.end+=len;
+      segs_size+=len;
+      size-=len;
+   }
+   DropSpareSegments();
+}
+
 void Buffer::GetSaved(const char **buf,int *size) const
 {
    if(!save)
@@ -61,6 +270,7 @@ void Buffer::SaveRollback(off_t p)
    if(!save)
       p=0;
    buffer.truncate(buffer_ptr=p);
+   ReleaseSegments();
 }
 
 void Buffer::Allocate(int size)
@@ -109,6 +319,25 @@ void Buffer::Append(const char *buf,int size)
       buffer_ptr=0;
    }
 
+   if(segmented && !save)
+   {
+      // append to the linear part only when it does not require
+      // moving or reallocating the data.
+      if(segs.count()>0 || (Size()>0 && buffer.available()<(size_t)size))
+      {
+	 AppendSegments(buf,size);
+	 Changed();
+	 return;
+      }
+      if(Size()>0)
+      {
+	 memcpy(buffer.get_non_const()+buffer.length(),buf,size);
+	 buffer.set_length(buffer.length()+size);
+	 Changed();
+	 return;
+      }
+   }
+
    memmove(GetSpace(size),buf,size);
    SpaceAdd(size);
 }
@@ -121,6 +350,7 @@ void Buffer::Prepend(const char *buf,int size)
 {
    if(size==0)
       return;
+   Flatten();
    save=false;
    if(Size()==0)
    {
@@ -137,6 +367,7 @@ void Buffer::Prepend(const char *buf,int size)
    }
    memmove(buffer.get_non_const()+buffer_ptr-size,buf,size);
    buffer_ptr-=size;
+   Changed();
 }
 
 void Buffer::Format(const char *f,...)
@@ -168,12 +399,39 @@ void Buffer::vFormat(const char *f, va_list v)
    }
 }
 
+void Buffer::Consume(int len)
+{
+   int linear=buffer.length()-buffer_ptr;
+   if(len<=linear)
+   {
+      buffer_ptr+=len;
+      return;
+   }
+   buffer_ptr+=linear;
+   len-=linear;
+   while(len>0 && segs.count()>0)
+   {
+      segment &seg=segs[0];
+      int n=seg.end-seg.begin;
+      if(n>len)
+	 n=len;
+      seg.begin+=n;
+      segs_size-=n;
+      len-=n;
+      if(seg.begin==seg.end && !iov_pending)
+      {
+	 FreeSegment(seg.data);
+	 segs.remove(0);
+      }
+   }
+}
 void Buffer::Skip(int len)
 {
    if(len>Size())
       len=Size();
-   buffer_ptr+=len;
+   Consume(len);
    pos+=len;
+   Changed();
 }
 void Buffer::UnSkip(int len)
 {
@@ -185,30 +443,45 @@ void Buffer::UnSkip(int len)
 
 void Buffer::Empty()
 {
+   ReleaseSegments();
    buffer.truncate(0);
    buffer_ptr=0;
    if(save_max>0)
       save=true;
+   Changed();
 }
 
 // move data from other buffer, prepare for SpaceAdd.
 int Buffer::MoveDataHere(Buffer *o,int max_len)
 {
-   const char *b;
-   int size;
-   o->Get(&b,&size);
+   int size=o->Size();
    if(size>max_len)
       size=max_len;
    if(size>0) {
-      if(size>=64 && Size()==0 && o->Size()==size && !save && !o->save) {
+      if(size>=64 && Size()==0 && o->Size()==size && !save && !o->save
+      && segs.count()==0 && o->segs.count()==0) {
 	 // optimization by swapping buffers
 	 buffer.swap(o->buffer);
 	 buffer_ptr=replace_value(o->buffer_ptr,buffer_ptr);
 	 buffer.set_length_no_z(buffer_ptr);
 	 o->pos+=size;
+	 Changed();
+	 o->Changed();
       } else {
-	 memcpy(GetSpace(size),b,size);
-	 o->Skip(size);
+	 // copy piece by piece, joining o's segments would copy twice
+	 char *space=GetSpace(size);
+	 struct iovec iov[MAX_IOV];
+	 int n=o->GetIOV(iov,MAX_IOV);
+	 int moved=0;
+	 for(int i=0; i<n && moved<size; i++) {
+	    int len=iov[i].iov_len;
+	    if(len>size-moved)
+	       len=size-moved;
+	    memcpy(space+moved,iov[i].iov_base,len);
+	    moved+=len;
+	 }
+	 o->Skip(moved);
+	 size=moved;
       }
    }
    return size;
@@ -224,9 +497,14 @@ Buffer::Buffer()
    save=false;
    save_max=0;
    pos=0;
+   segmented=false;
+   segs_size=0;
+   iov_seg=0;
+   iov_pending=false;
 }
 Buffer::~Buffer()
 {
+   ReleaseSegments();
 }
 
 const char *Buffer::GetRateStrS()
@@ -246,6 +524,7 @@ void Buffer::SetError(const char *e,bool fatal)
 {
    error_text.set(e);
    error_fatal=fatal;
+   Changed();
 }
 void Buffer::SetErrorCached(const char *e)
 {
@@ -254,7 +533,7 @@ void Buffer::SetErrorCached(const char *e)
 }
 const char *Buffer::Dump() const
 {
-   if(buffer_ptr==0)
+   if(buffer_ptr==0 && segs_size==0)
       return buffer.dump();
    return xstring::get_tmp(Get(),Size()).dump();
 }
@@ -277,6 +556,8 @@ void DirectedBuffer::SetTranslator(DataTranslator *t)
       buffer.truncate(buffer_ptr);
       t->AppendTranslated(this,0,0);
    }
+   if(t)
+      t->SetWaiter(owner);
    translator=t;
 }
 
@@ -413,7 +694,14 @@ int DirectedBuffer::MoveDataHere(Buffer *buf,int size)
    if(size>buf->Size())
       size=buf->Size();
    if(mode==PUT && translator)
-      translator->PutTranslated(this,buf->Get(),size);
+   {
+      const char *b;
+      int len;
+      buf->GetChunk(&b,&len);
+      if(size>len)
+	 size=len;
+      translator->PutTranslated(this,b,size);
+   }
    else
       return Buffer::MoveDataHere(buf,size);
    return size;
@@ -421,9 +709,44 @@ int DirectedBuffer::MoveDataHere(Buffer *buf,int size)
 void DirectedBuffer::PutEOF()
 {
    if(mode==PUT && translator)
+   {
       translator->PutTranslated(this,0,0);
+      if(translator->TranslationPending())
+      {
+	 // eof will be set when the translator is flushed
+	 eof_pending=true;
+	 return;
+      }
+   }
    Buffer::PutEOF();
 }
+// collect data translated in background, returns true on any progress.
+bool DirectedBuffer::PollTranslator()
+{
+   if(mode!=PUT || !translator || !translator->TranslationPending())
+      return false;
+   int old_size=Size();
+   translator->PollTranslated(this);
+   if(eof_pending && !translator->TranslationPending())
+   {
+      eof_pending=false;
+      Buffer::PutEOF();
+      return true;
+   }
+   return Size()!=old_size || Error();
+}
+
+// space for Get_LL; translators need the new data in the linear part.
+int DirectedBuffer::GetReadIOV(struct iovec *iov,int max,int size)
+{
+   if(translator)
+   {
+      iov[0].iov_base=GetSpace(size);
+      iov[0].iov_len=size;
+      return 1;
+   }
+   return GetSpaceIOV(iov,max,size);
+}
 
 void DirectedBuffer::EmbraceNewData(int len)
 {
@@ -446,6 +769,7 @@ IOBuffer::IOBuffer(dir_t m)
    : DirectedBuffer(m), event_time(now),
      max_buf(0), get_size(GET_BUFSIZE)
 {
+   owner=this;
 }
 IOBuffer::~IOBuffer()
 {
@@ -492,17 +816,24 @@ int IOBuffer::Do()
       return STALL;
    int res=0;
    int remaining_size;
+   bool translated=false;
    switch(mode)
    {
    case PUT:
+      if(PollTranslator())
+      {
+	 event_time=now;
+	 translated=true;
+      }
       remaining_size = Size();
       if (remaining_size > 0) {
-         res=Put_LL(buffer+buffer_ptr, remaining_size);
+         struct iovec iov[MAX_IOV];
+         res=PutIOV_LL(iov, GetIOV(iov, MAX_IOV));
          if (res <= 0) {
-            return STALL;
+            return translated?MOVED:STALL;
          }
          RateAdd(res);
-         buffer_ptr+=res;
+         Consume(res);
          event_time=now;
          if (eof) {
             /* We do not have to check for return value of PutEOF_LL here as
@@ -538,7 +869,7 @@ int IOBuffer::Do()
       event_time=now;
       return MOVED;
    }
-   return STALL;
+   return translated?MOVED:STALL;
 }
 
 // IOBufferStacked implementation
@@ -558,6 +889,8 @@ int IOBufferStacked::Do()
 	 broken=true;
 	 return MOVED;
       }
+      if(PollTranslator())
+	 m=MOVED;
       if(down->Error())
       {
 	 SetError(down->ErrorText(),down->ErrorFatal());
@@ -565,10 +898,13 @@ int IOBufferStacked::Do()
       }
       if(Size()==0)
 	 return m;
-      res=Put_LL(buffer+buffer_ptr,Size());
+      const char *b;
+      int s;
+      GetChunk(&b,&s);
+      res=Put_LL(b,s);
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       break;
@@ -644,6 +980,14 @@ void IOBufferStacked::ResumeInternal()
 #undef super
 #define super IOBuffer
 int IOBufferFDStream::Put_LL(const char *buf,int size)
+{
+   struct iovec iov;
+   iov.iov_base=const_cast<char*>(buf);
+   iov.iov_len=size;
+   return PutIOV_LL(&iov,1);
+}
+
+int IOBufferFDStream::PutIOV_LL(const struct iovec *iov,int n)
 {
    if(put_ll_timer && !eof && Size()<PUT_LL_MIN
    && !put_ll_timer->Stopped())
@@ -662,11 +1006,12 @@ int IOBufferFDStream::Put_LL(const char *buf,int size)
       if(stream->error())
 	 goto stream_err;
       TimeoutS(1);
+      StayAwake();   // the stream does not tell when it gets ready
       event_time=now;
       return 0;
    }
 
-   res=write(fd,buf,size);
+   res=(n==1 ? write(fd,iov[0].iov_base,iov[0].iov_len) : writev(fd,iov,n));
    if(res==-1)
    {
       saved_errno=errno;
@@ -700,6 +1045,8 @@ int IOBufferFDStream::Get_LL(int size)
       return 0;
 
    int res=0;
+   struct iovec iov[MAX_IOV];
+   int n;
 
    int fd=stream->getfd();
    if(fd==-1)
@@ -707,6 +1054,7 @@ int IOBufferFDStream::Get_LL(int size)
       if(stream->error())
 	 goto stream_err;
       TimeoutS(1);
+      StayAwake();   // the stream does not tell when it gets ready
       return 0;
    }
 
@@ -716,7 +1064,8 @@ int IOBufferFDStream::Get_LL(int size)
       return 0;
    }
 
-   res=read(fd,GetSpace(size),size);
+   n=GetReadIOV(iov,MAX_IOV,size);
+   res=(n==1 ? read(fd,iov[0].iov_base,iov[0].iov_len) : readv(fd,iov,n));
    if(res==-1)
    {
       saved_errno=errno;
@@ -823,7 +1172,7 @@ unsigned Buffer::UnpackUINT32BE(int offset) const
 {
    if(Size()-offset<4)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return (b[0]<<24)|(b[1]<<16)|(b[2]<<8)|b[3];
 }
 int Buffer::UnpackINT32BE(int offset) const
@@ -837,14 +1186,14 @@ unsigned Buffer::UnpackUINT16BE(int offset) const
 {
    if(Size()-offset<2)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return (b[0]<<8)|b[1];
 }
 unsigned Buffer::UnpackUINT8(int offset) const
 {
    if(Size()-offset<1)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return b[0];
 }
 void Buffer::PackUINT64BE(unsigned long long data)
@@ -28,6 +28,7 @@
 #include "Speedometer.h"
 
 #include <stdarg.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_ICONV
 CDECL_BEGIN
@@ -52,6 +53,33 @@ protected:
 
    off_t pos;
 
+   /* Optional chain of pooled fixed-size segments following the data in
+      `buffer'.  Data stored there is never moved, it is written with
+      writev and read with readv; Get() joins it into `buffer' for the
+      users which need contiguous data (the slow path). */
+   struct segment
+   {
+      char *data;
+      int begin;
+      int end;
+   };
+   bool segmented;
+   xarray<segment> segs;
+   int segs_size;
+   int iov_seg;	  // first segment filled by GetSpaceIOV, -1 if `buffer' too
+   bool iov_pending;
+   enum { SEGMENT_SIZE=0x10000, SEGMENT_POOL_MAX=64, MAX_IOV=16 };
+   static xarray<char*> segment_pool;
+   static char *AllocSegment();
+   static void FreeSegment(char *);
+   void AppendSegments(const char *buf,int size);
+   void ReleaseSegments();
+   void DropSpareSegments();
+   void SpaceAddIOV(int size);
+   void JoinSegments();
+   void Flatten() { if(segs.count()>0) JoinSegments(); }
+   void Consume(int len); // like Skip, but does not advance pos
+
    Ref<Speedometer> rate;
    void RateAdd(int n);
 
@@ -59,18 +87,25 @@ protected:
 
    void SaveMaxCheck(int addsize);
 
+   // called when data is added or removed, or eof or error is set
+   virtual void Changed() {}
+
 public:
    bool Error() const { return error_text!=0; }
    bool ErrorFatal() const { return error_fatal; }
    void SetError(const char *e,bool fatal=false);
    void SetErrorCached(const char *e);
    const char *ErrorText() const { return error_text; }
-   int Size() const { return buffer.length()-buffer_ptr; }
+   int Size() const { return buffer.length()-buffer_ptr+segs_size; }
    bool Eof() const { return eof; }
    bool Broken() const { return broken; }
 
+   // Get() returns all the data contiguous; with segments it has to join
+   // them, which copies.  Data paths should use GetChunk or GetIOV.
    const char *Get() const;
    void Get(const char **buf,int *size) const;
+   void GetChunk(const char **buf,int *size) const; // first contiguous part
+   int GetIOV(struct iovec *iov,int max) const;
    void Skip(int len); // Get(); consume; Skip()
    void UnSkip(int len); // this only works if there were no Put's.
    void Append(const char *buf,int size);
@@ -81,13 +116,20 @@ public:
    void Put(char c) { Put(&c,1); }
    void Format(const char *f,...) PRINTF_LIKE(2,3);
    void vFormat(const char *f, va_list v);
-   void PutEOF() { eof=true; }
+   void PutEOF() { eof=true; Changed(); }
    char *GetSpace(int size) {
+      Flatten();
       Allocate(size);
       return buffer.get_non_const()+buffer.length();
    }
+   // same as GetSpace, but the space may be split; returns iovec count.
+   int GetSpaceIOV(struct iovec *iov,int max,int size);
    void SpaceAdd(int size) {
-      buffer.set_length(buffer.length()+size);
+      if(iov_pending)
+	 SpaceAddIOV(size);
+      else
+	 buffer.set_length(buffer.length()+size);
+      Changed();
    }
    void Prepend(const char *buf,int size);
    void Prepend(const char *buf) { Prepend(buf,strlen(buf)); }
@@ -114,7 +156,8 @@ public:
    void PackINT8(int data);
 
    // useful for cache.
-   void Save(int m) { save=true; save_max=m; }
+   void Save(int m) { Flatten(); save=true; save_max=m; }
+   void SetSegmented(bool s=true) { segmented=s; }
    bool IsSaving() const { return save; }
    void GetSaved(const char **buf,int *size) const;
    void SaveRollback(off_t p);
@@ -128,18 +171,27 @@ public:
    void Empty();
 
    Buffer();
-   ~Buffer();
+   virtual ~Buffer();
 
    const char *Dump() const;
 };
 
 class DataTranslator : public Buffer
 {
+protected:
+   SMTask *waiter;   // woken up when background translation is done
+
 public:
+   DataTranslator() : waiter(0) {}
+   void SetWaiter(SMTask *w) { waiter=w; }
    virtual void PutTranslated(Buffer *dst,const char *buf,int size)=0;
    virtual void ResetTranslation() { Empty(); }
    virtual ~DataTranslator() {}
 
+   // for translators doing the work in background (see ThreadPool).
+   virtual bool TranslationPending() const { return false; }
+   virtual void PollTranslated(Buffer *dst) {}
+
    // same as PutTranslated, but does not advance pos.
    void AppendTranslated(Buffer *dst,const char *buf,int size);
 };
@@ -164,10 +216,14 @@ public:
 protected:
    Ref<DataTranslator> translator;
    dir_t mode;
+   bool eof_pending; // PutEOF was called while translator was busy
+   SMTask *owner;    // the IOBuffer task, passed to the translator
    void EmbraceNewData(int len);
+   int GetReadIOV(struct iovec *iov,int max,int size);
+   bool PollTranslator();
 
 public:
-   DirectedBuffer(dir_t m) : mode(m) {}
+   DirectedBuffer(dir_t m) : mode(m), eof_pending(false), owner(0) {}
    void SetTranslator(DataTranslator *t);
    const Ref<DataTranslator>& GetTranslator() const { return translator; }
    void SetTranslation(const char *be_encoding,bool translit=true)
@@ -196,6 +252,8 @@ protected:
    // low-level for derived classes
    virtual int Get_LL(int size) { return 0; }
    virtual int Put_LL(const char *buf,int size) { return 0; }
+   virtual int PutIOV_LL(const struct iovec *iov,int n)
+      { return Put_LL((const char*)iov[0].iov_base,iov[0].iov_len); }
    virtual int PutEOF_LL() { return 0; }
 
    Time event_time; // used to detect timeouts
@@ -210,6 +268,9 @@ protected:
 
    virtual ~IOBuffer();
 
+   // the consumer or the producer has changed the buffer
+   void Changed() { if(IsSleeping()) Wake(); }
+
 public:
    IOBuffer(dir_t m);
    virtual const Time& EventTime()
@@ -235,7 +296,8 @@ public:
    void Put(const xstring &s) { Put(s.get(),s.length()); }
    void Put(char c) { Put(&c,1); }
    // anchor to PutEOF_LL
-   void PutEOF() { DirectedBuffer::PutEOF(); PutEOF_LL(); }
+   // Wake is for eof pending in the translator
+   void PutEOF() { DirectedBuffer::PutEOF(); if(eof) PutEOF_LL(); Wake(); }
 
    void SetMaxBuffered(int m) { max_buf=m; }
    bool IsFull() { return Size()+(translator?translator->Size():0) >= max_buf; }
@@ -268,16 +330,18 @@ class IOBufferFDStream : public IOBuffer
 
    int Get_LL(int size);
    int Put_LL(const char *buf,int size);
+   int PutIOV_LL(const struct iovec *iov,int n);
+   void Init() { SetSleepOnStall(); SetSegmented(); }
 
 public:
    IOBufferFDStream(FDStream *o,dir_t m)
-      : IOBuffer(m), my_stream(o), stream(my_stream) {}
+      : IOBuffer(m), my_stream(o), stream(my_stream) { Init(); }
    IOBufferFDStream(const Ref<FDStream>& o,dir_t m)
-      : IOBuffer(m), stream(o) {}
+      : IOBuffer(m), stream(o) { Init(); }
    IOBufferFDStream(FDStream *o,dir_t m,Timer *t)
-      : IOBuffer(m), my_stream(o), stream(my_stream), put_ll_timer(t) {}
+      : IOBuffer(m), my_stream(o), stream(my_stream), put_ll_timer(t) { Init(); }
    IOBufferFDStream(const Ref<FDStream>& o,dir_t m,Timer *t)
-      : IOBuffer(m), stream(o), put_ll_timer(t) {}
+      : IOBuffer(m), stream(o), put_ll_timer(t) { Init(); }
    ~IOBufferFDStream();
    bool Done();
    FgData *GetFgData(bool fg);
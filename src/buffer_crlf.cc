@@ -0,0 +1,314 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include "buffer_crlf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# define CRLF_SSE2 1
+# include <emmintrin.h>
+# if defined(__clang__) || __GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)
+#  define CRLF_AVX2 1
+#  include <immintrin.h>
+# endif
+#endif
+
+/* The vector variants compare a block of input with the wanted character
+   and walk the resulting bit mask, so every byte is looked at once and
+   runs without line ends are moved with a single memmove. */
+
+// copy w bytes at s, inserting CR before each LF marked in mask.
+static inline char *encode_block(char *d,const char *s,int w,unsigned mask)
+{
+   const char *b=s;
+   while(mask)
+   {
+      const char *nl=b+__builtin_ctz(mask);
+      mask&=mask-1;
+      memmove(d,s,nl-s);
+      d+=nl-s;
+      *d++='\r';
+      *d++='\n';
+      s=nl+1;
+   }
+   memmove(d,s,b+w-s);
+   return d+(b+w-s);
+}
+
+/* copy w bytes at *sp, dropping CR of each CRLF pair; CRs are marked in
+   mask.  Returns false if stopped at a CR which is the last input byte. */
+static inline bool decode_block(char *&d,const char *&sp,int w,unsigned mask,const char *end)
+{
+   const char *s=sp;
+   const char *b=s;
+   bool ok=true;
+   while(mask)
+   {
+      const char *cr=b+__builtin_ctz(mask);
+      mask&=mask-1;
+      memmove(d,s,cr-s);
+      d+=cr-s;
+      s=cr;
+      if(cr+1==end)
+      {
+	 ok=false;
+	 break;
+      }
+      if(cr[1]!='\n')
+	 *d++='\r';
+      s=cr+1;
+   }
+   if(ok)
+   {
+      memmove(d,s,b+w-s);
+      d+=b+w-s;
+      s=b+w;
+   }
+   sp=s;
+   return ok;
+}
+
+static int encode_scalar(char *dst,const char *s,int len)
+{
+   const char *end=s+len;
+   char *d=dst;
+   while(s<end)
+   {
+      const char *nl=(const char*)memchr(s,'\n',end-s);
+      if(!nl)
+	 nl=end;
+      memmove(d,s,nl-s);
+      d+=nl-s;
+      if(nl==end)
+	 break;
+      *d++='\r';
+      *d++='\n';
+      s=nl+1;
+   }
+   return d-dst;
+}
+
+static int decode_scalar(char *dst,const char *s,int *len)
+{
+   const char *begin=s;
+   const char *end=s+*len;
+   char *d=dst;
+   while(s<end)
+   {
+      const char *cr=(const char*)memchr(s,'\r',end-s);
+      if(!cr)
+	 cr=end;
+      memmove(d,s,cr-s);
+      d+=cr-s;
+      s=cr;
+      if(cr==end || cr+1==end)
+	 break;
+      if(cr[1]!='\n')
+	 *d++='\r';
+      s=cr+1;
+   }
+   *len=s-begin;
+   return d-dst;
+}
+
+#ifdef CRLF_SSE2
+static inline unsigned mask_sse2(const char *p,__m128i c)
+{
+   __m128i v=_mm_loadu_si128((const __m128i*)p);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(v,c));
+}
+static int encode_sse2(char *dst,const char *s,int len)
+{
+   const char *end=s+len;
+   const __m128i lf=_mm_set1_epi8('\n');
+   char *d=dst;
+   while(end-s>=16)
+   {
+      d=encode_block(d,s,16,mask_sse2(s,lf));
+      s+=16;
+   }
+   return d-dst+encode_scalar(d,s,end-s);
+}
+static int decode_sse2(char *dst,const char *s,int *len)
+{
+   const char *begin=s;
+   const char *end=s+*len;
+   const __m128i cr=_mm_set1_epi8('\r');
+   char *d=dst;
+   while(end-s>=16)
+   {
+      if(!decode_block(d,s,16,mask_sse2(s,cr),end))
+      {
+	 *len=s-begin;
+	 return d-dst;
+      }
+   }
+   int rest=end-s;
+   d+=decode_scalar(d,s,&rest);
+   *len=s+rest-begin;
+   return d-dst;
+}
+#endif // CRLF_SSE2
+
+#ifdef CRLF_AVX2
+__attribute__((target("avx2")))
+static inline unsigned mask_avx2(const char *p,__m256i c)
+{
+   __m256i v=_mm256_loadu_si256((const __m256i*)p);
+   return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,c));
+}
+__attribute__((target("avx2")))
+static int encode_avx2(char *dst,const char *s,int len)
+{
+   const char *end=s+len;
+   const __m256i lf=_mm256_set1_epi8('\n');
+   char *d=dst;
+   while(end-s>=32)
+   {
+      d=encode_block(d,s,32,mask_avx2(s,lf));
+      s+=32;
+   }
+   return d-dst+encode_sse2(d,s,end-s);
+}
+__attribute__((target("avx2")))
+static int decode_avx2(char *dst,const char *s,int *len)
+{
+   const char *begin=s;
+   const char *end=s+*len;
+   const __m256i cr=_mm256_set1_epi8('\r');
+   char *d=dst;
+   while(end-s>=32)
+   {
+      if(!decode_block(d,s,32,mask_avx2(s,cr),end))
+      {
+	 *len=s-begin;
+	 return d-dst;
+      }
+   }
+   int rest=end-s;
+   d+=decode_sse2(d,s,&rest);
+   *len=s+rest-begin;
+   return d-dst;
+}
+#endif // CRLF_AVX2
+
+CRLFTranslator::impl_t CRLFTranslator::impl=CRLFTranslator::DetectImpl();
+
+CRLFTranslator::impl_t CRLFTranslator::DetectImpl()
+{
+#ifdef CRLF_AVX2
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      return AVX2;
+#endif
+#ifdef CRLF_SSE2
+   return SSE2;
+#else
+   return SCALAR;
+#endif
+}
+CRLFTranslator::impl_t CRLFTranslator::GetImpl()
+{
+   return impl;
+}
+const char *CRLFTranslator::ImplName(impl_t i)
+{
+   static const char *const names[]={"scalar","sse2","avx2"};
+   return names[i];
+}
+
+int CRLFTranslator::Encode(char *dst,const char *src,int len)
+{
+   switch(impl)
+   {
+#ifdef CRLF_AVX2
+   case AVX2:
+      return encode_avx2(dst,src,len);
+#endif
+#ifdef CRLF_SSE2
+   case SSE2:
+      return encode_sse2(dst,src,len);
+#endif
+   default:
+      return encode_scalar(dst,src,len);
+   }
+}
+int CRLFTranslator::Decode(char *dst,const char *src,int *len)
+{
+   switch(impl)
+   {
+#ifdef CRLF_AVX2
+   case AVX2:
+      return decode_avx2(dst,src,len);
+#endif
+#ifdef CRLF_SSE2
+   case SSE2:
+      return decode_sse2(dst,src,len);
+#endif
+   default:
+      return decode_scalar(dst,src,len);
+   }
+}
+int CRLFTranslator::DecodedSpan(const char *src,int len,int out_len)
+{
+   int i=0;
+   while(out_len>0 && i<len)
+   {
+      if(src[i]=='\r' && i+1<len && src[i+1]=='\n')
+	 i++;
+      i++;
+      out_len--;
+   }
+   return i;
+}
+
+void CRLFTranslator::PutTranslated(Buffer *target,const char *put_buf,int size)
+{
+   off_t pos=target->GetPos()+size;
+   bool flush=(size==0);
+   bool from_untranslated=false;
+   if(Size()>0)
+   {
+      Put(put_buf,size);
+      Get(&put_buf,&size);
+      from_untranslated=true;
+   }
+   if(size>0)
+   {
+      int len=size;
+      if(dir==ENCODE)
+	 target->SpaceAdd(Encode(target->GetSpace(size*2),put_buf,size));
+      else
+      {
+	 target->SpaceAdd(Decode(target->GetSpace(size),put_buf,&len));
+	 if(len<size && flush)
+	 {
+	    // no more data, the held CR is a plain one.
+	    target->Append("\r",1);
+	    len=size;
+	 }
+      }
+      if(from_untranslated)
+	 Skip(len);
+      else if(len<size)
+	 Put(put_buf+len,size-len);
+   }
+   target->SetPos(pos);
+}
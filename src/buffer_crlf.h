@@ -0,0 +1,61 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFER_CRLF_H
+#define BUFFER_CRLF_H
+
+#include "buffer.h"
+
+/* LF <-> CRLF conversion for ascii mode transfers.  Encoding is meant for
+   the GET direction (local file -> wire), decoding for PUT (wire -> local
+   file); a PutTranslated with no data flushes a CR held at the end of the
+   input.  The target position advances by the untranslated size, as with
+   Buffer::Put, so it stays in wire units. */
+class CRLFTranslator : public DataTranslator
+{
+public:
+   enum dir_t { ENCODE, DECODE };
+   enum impl_t { SCALAR, SSE2, AVX2 };
+
+private:
+   dir_t dir;
+
+   static impl_t impl;
+   static impl_t DetectImpl();
+
+public:
+   CRLFTranslator(dir_t d) : dir(d) {}
+   void PutTranslated(Buffer *dst,const char *buf,int size);
+
+   // LF -> CRLF, dst needs room for 2*len bytes.  dst may overlap src
+   // if src-dst>=len, e.g. when the data were read into the upper half.
+   static int Encode(char *dst,const char *src,int len);
+   // CRLF -> LF, dst may be equal to src.  A CR at the end of the input
+   // is left alone as it can start a CRLF pair; *len is set to the number
+   // of bytes consumed.  Returns the number of bytes stored.
+   static int Decode(char *dst,const char *src,int *len);
+   // number of input bytes which decode to out_len bytes.
+   static int DecodedSpan(const char *src,int len,int out_len);
+
+   static impl_t GetImpl();
+   static void SetImpl(impl_t i) { impl=i; }  // for benchmarks
+   static const char *ImplName(impl_t i);
+};
+
+#endif //BUFFER_CRLF_H
@@ -34,6 +34,8 @@ int IOBufferSSL::Do()
    if(Done() || Error())
       return m;
 
+   if(PollTranslator())
+      m=MOVED;
    if(mode==PUT && Size()==0)
    {
       // nothing to write, but may need to do handshake
@@ -62,9 +64,11 @@ int IOBufferSSL::Get_LL(int size)
 {
    int total=0;
    int max_read=0;
-   char *space=GetSpace(size);
-   while(total<size-max_read) {
-      int res=ssl->read(space+total,size-total);
+   struct iovec iov[MAX_IOV];
+   int n=GetReadIOV(iov,MAX_IOV,size);
+   int i=0,off=0;
+   while(i<n && total<size-max_read) {
+      int res=ssl->read((char*)iov[i].iov_base+off,iov[i].iov_len-off);
       if(res<0)
       {
 	 if(res==ssl->RETRY) {
@@ -82,6 +86,11 @@ int IOBufferSSL::Get_LL(int size)
       total+=res;
       if(max_read<res)
 	 max_read=res;
+      off+=res;
+      if(off==(int)iov[i].iov_len) {
+	 i++;
+	 off=0;
+      }
    }
    return total;
 }
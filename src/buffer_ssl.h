@@ -38,8 +38,8 @@ class IOBufferSSL : public IOBuffer
    int dir_mask() const { return (mode==GET?POLLIN:POLLOUT); }
 
 public:
-   IOBufferSSL(lftp_ssl *s,dir_t m) : IOBuffer(m), my_ssl(s), ssl(my_ssl) {}
-   IOBufferSSL(const Ref<lftp_ssl>& s,dir_t m) : IOBuffer(m), ssl(s) {}
+   IOBufferSSL(lftp_ssl *s,dir_t m) : IOBuffer(m), my_ssl(s), ssl(my_ssl) { SetSegmented(); }
+   IOBufferSSL(const Ref<lftp_ssl>& s,dir_t m) : IOBuffer(m), ssl(s) { SetSegmented(); }
    ~IOBufferSSL();
    int Do();
    bool Done() { return IOBuffer::Done() && ssl->handshake_done && ssl->goodbye_done; }
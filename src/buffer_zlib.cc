@@ -104,6 +104,87 @@ void DataInflator::ResetTranslation()
 
 
 void DataDeflator::PutTranslated(Buffer *target,const char *put_buf,int size)
+{
+   if(!job && !finish && !ThreadPool::Enabled())
+   {
+      PutDeflated(target,put_buf,size);
+      return;
+   }
+   if(put_buf)
+      Put(put_buf,size);
+   else
+      finish=true;
+   PollTranslated(target);
+}
+
+bool DataDeflator::TranslationPending() const
+{
+   return job || Size()>0 || (finish && !finished);
+}
+
+void DataDeflator::PollTranslated(Buffer *target)
+{
+   if(job)
+   {
+      if(!job->Done())
+	 return;
+      target->Put(job->out);
+      int ret=job->ret;
+      bool last=(job->flush==Z_FINISH);
+      job=0;
+      if(ret==Z_STREAM_END)
+	 z_err=ret;
+      else if(ret!=Z_OK)
+      {
+	 z_err=ret;
+	 target->SetError(xstring::cat("zlib deflate error: ",z.msg,NULL),true);
+	 Empty();
+	 finished=true;
+	 return;
+      }
+      if(last)
+	 finished=true;
+   }
+   if(finished || (Size()==0 && !finish))
+      return;
+   const char *data;
+   int len;
+   Get(&data,&len);
+   if(len>JOB_CHUNK)
+      len=JOB_CHUNK;
+   int flush=(finish && len==Size()) ? Z_FINISH : Z_NO_FLUSH;
+   job=new DeflateJob(&z,flush);
+   job->in.nset(data,len);
+   Skip(len);
+   ThreadPool::Submit(job.get_non_const(),waiter);
+}
+
+void DataDeflator::DeflateJob::Run()
+{
+   z->next_in=(Bytef*)in.get();
+   z->avail_in=in.length();
+   size_t store_size=in.length()+256;
+   for(;;)
+   {
+      char *store_buf=out.add_space(store_size);
+      z->next_out=(Bytef*)store_buf;
+      z->avail_out=store_size;
+      ret=deflate(z,flush);
+      out.add_commit(store_size-z->avail_out);
+      if(ret==Z_BUF_ERROR)
+      {
+	 // no progress possible
+	 ret=Z_OK;
+	 break;
+      }
+      if(ret!=Z_OK)
+	 break;
+      if(z->avail_in==0 && z->avail_out>0)
+	 break;
+   }
+}
+
+void DataDeflator::PutDeflated(Buffer *target,const char *put_buf,int size)
 {
    const int flush=(put_buf?Z_NO_FLUSH:Z_FINISH);
    bool from_untranslated=false;
@@ -163,6 +244,7 @@ void DataDeflator::PutTranslated(Buffer *target,const char *put_buf,int size)
 }
 
 DataDeflator::DataDeflator(int level)
+   : finish(false), finished(false)
 {
    /* allocate deflate state */
    memset(&z,0,sizeof(z));
@@ -170,9 +252,13 @@ DataDeflator::DataDeflator(int level)
 }
 DataDeflator::~DataDeflator()
 {
+   job=0;   // wait for the worker to leave z alone
    (void)deflateEnd(&z);
 }
 void DataDeflator::ResetTranslation()
 {
+   job=0;
+   Empty();
+   finish=finished=false;
    z_err = deflateReset(&z);
 }
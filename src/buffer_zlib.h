@@ -25,6 +25,7 @@
 #include <assert.h>
 #include <zlib.h>
 #include "buffer.h"
+#include "ThreadPool.h"
 
 class DataInflator : public DataTranslator
 {
@@ -41,11 +42,34 @@ class DataDeflator : public DataTranslator
 {
    z_stream z;
    int z_err;
+
+   // compresses a chunk in a worker thread, z is not touched meanwhile.
+   class DeflateJob : public ThreadJob
+   {
+   public:
+      z_stream *z;
+      int flush;
+      int ret;
+      xstring in;
+      xstring out;
+      DeflateJob(z_stream *z,int flush) : z(z), flush(flush), ret(Z_OK) {}
+      ~DeflateJob() { Cancel(); }
+      void Run();
+   };
+   Ref<DeflateJob> job;
+   bool finish;	     // flush requested by PutEOF
+   bool finished;    // all data flushed
+
+   enum { JOB_CHUNK=0x40000 };
+   void PutDeflated(Buffer *dst,const char *buf,int size);
+
 public:
    DataDeflator(int level=Z_DEFAULT_COMPRESSION);
    ~DataDeflator();
    void PutTranslated(Buffer *dst,const char *buf,int size);
    void ResetTranslation();
+   bool TranslationPending() const;
+   void PollTranslated(Buffer *dst);
 };
 
 #endif //BUFFER_ZLIB_H
@@ -367,7 +367,18 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -n <maxconn>  set maximum number of connections (default is is taken from\n"
 	 "     pget:default-n setting)\n"
 	 " -O <base> specifies base directory where files should be placed\n"
-	 " --priority-ends  download first and last pieces first (useful for video)\n")},
+	 " --priority-ends  download first and last pieces first (useful for video)\n"
+	 " --mirror=<url>  get chunks from this URL of the same file too (repeatable)\n"
+	 " --metalink=<file>  take the file name, size and URLs from a metalink file\n")},
+   {"pput",    cmd_get,    N_("pput [OPTS] <lfile> [-o <rfile>]"),
+	 N_("Uploads the specified file using several connections, each one writing\n"
+	 "its own part of the remote file. The target protocol has to support writing\n"
+	 "at an offset (sftp, file).\n"
+	 "\nOptions:\n"
+	 " -c  continue transfer from the remote file size\n"
+	 " -n <maxconn>  set maximum number of connections (default is is taken from\n"
+	 "     pget:default-n setting)\n"
+	 " -O <base> specifies base directory or URL where files should be placed\n")},
    {"put",     cmd_get,    N_("put [OPTS] <lfile> [-o <rfile>]"),
 	 N_("Upload <lfile> with remote name <rfile>.\n"
 	 " -o <rfile> specifies remote file name (default - basename of lfile)\n"
@@ -1726,6 +1737,8 @@ CMD(get)
       {"parallel",optional_argument,0,'P'},
       {"use-pget-n",optional_argument,0,'n'},
       {"priority-ends",no_argument,0,256+'p'},
+      {"mirror",required_argument,0,256+'m'},
+      {"metalink",required_argument,0,256+'M'},
       {"glob",no_argument,0,256+'g'},
       {"reverse",no_argument,0,256+'R'},
       {0}
@@ -1738,6 +1751,7 @@ CMD(get)
    Ref<ArgV> get_args(new ArgV(op));
    int n_conn=1;
    int parallel=0;
+   bool auto_parallel=false;
    bool del=false;
    bool del_target=false;
    bool ascii=false;
@@ -1746,6 +1760,9 @@ CMD(get)
    bool reverse=false;
    bool quiet=false;
    bool priority_ends=false;
+   StringSet mirrors;
+   const char *metalink=0;
+   off_t expected_size=-1;
    const char *output_dir=0;
 
    if(!strncmp(op,"re",2))
@@ -1753,10 +1770,11 @@ CMD(get)
       cont=true;
       opts="+EaO:qP:";
    }
-   if(!strcmp(op,"pget"))
+   if(!strcmp(op,"pget") || !strcmp(op,"pput"))
    {
       opts="+n:ceO:q";
       n_conn=0; // default, which means to take pget:default-n
+      reverse=(op[1]=='p');
    }
    else if(!strcmp(op,"put") || !strcmp(op,"reput"))
    {
@@ -1812,14 +1830,22 @@ CMD(get)
 	 break;
       case('P'):
 	 if(optarg) {
+	    if(ParallelTuner::IsAuto(optarg))
+	    {
+	       auto_parallel=true;
+	       break;
+	    }
 	    if(!isdigit((unsigned char)optarg[0]))
 	    {
 	       eprintf(_("%s: %s: Number expected. "),"-P",op);
 	       goto err;
 	    }
 	    parallel=atoi(optarg);
-	 } else
+	    auto_parallel=false;
+	 } else {
 	    parallel=3;
+	    auto_parallel=false;
+	 }
 	 break;
       case(256+'R'):
 	 reverse=!reverse;
@@ -1827,6 +1853,17 @@ CMD(get)
       case(256+'p'):
 	 priority_ends=true;
 	 break;
+      case(256+'m'):
+	 if(!url::is_url(optarg))
+	 {
+	    eprintf(_("%s: %s: URL expected.\n"),op,optarg);
+	    goto err;
+	 }
+	 mirrors.Append(optarg);
+	 break;
+      case(256+'M'):
+	 metalink=optarg;
+	 break;
       case(256+'g'):
 	 glob=true;
 	 break;
@@ -1844,6 +1881,10 @@ CMD(get)
       eprintf(_("%s: --priority-ends can only be used with pget.\n"),op);
       return 0;
    }
+   if((mirrors.Count()>0 || metalink) && strcmp(op,"pget")) {
+      eprintf(_("%s: --mirror and --metalink can only be used with pget.\n"),op);
+      return 0;
+   }
    JobRef<GetJob> j;
    if(glob)
    {
@@ -1863,7 +1904,36 @@ CMD(get)
    {
       args->back();
       const char *a=args->getnext();
-      if(a==0)
+      if(metalink)
+      {
+	 // the first URL is the main source, the rest are mirrors.
+	 xstring ml_name;
+	 StringSet ml_urls;
+	 const char *e=pgetJob::ParseMetalink(metalink,ml_name,ml_urls,&expected_size);
+	 if(e)
+	 {
+	    eprintf("%s: %s: %s\n",op,metalink,e);
+	    return 0;
+	 }
+	 const char *dst=0;
+	 if(a && !strcmp(a,"-o"))
+	    dst=args->getnext();
+	 else if(a)
+	 {
+	    eprintf(_("%s: file names cannot be given with --metalink.\n"),op);
+	    goto err;
+	 }
+	 if(!dst && ml_name)
+	    dst=ml_name;
+	 const char *src=ml_urls[0];
+	 dst=output_file_name(src,dst,true,output_dir,false);
+	 get_args->Append(src);
+	 get_args->Append(dst);
+	 for(int i=1; i<ml_urls.Count(); i++)
+	    mirrors.Append(ml_urls[i]);
+	 a=0;
+      }
+      else if(a==0)
 	 goto file_name_missed;
       while(a)
       {
@@ -1881,6 +1951,11 @@ CMD(get)
 	 get_args->Append(src);
 	 get_args->Append(dst);
       }
+      if(mirrors.Count()>0 && get_args->count()>3)
+      {
+	 eprintf(_("%s: --mirror can only be used with a single file.\n"),op);
+	 return 0;
+      }
       j=new GetJob(session->Clone(),get_args.borrow(),cont);
    }
    if(reverse)
@@ -1896,9 +1971,14 @@ CMD(get)
       pCopyJobCreator *creator=new pCopyJobCreator(n_conn);
       if(priority_ends)
 	 creator->priority_ends=true;
+      for(int i=0; i<mirrors.Count(); i++)
+	 creator->mirrors.Append(mirrors[i]);
+      creator->expected_size=expected_size;
       j->SetCopyJobCreator(creator);
    }
-   if(parallel>0)
+   if(auto_parallel)
+      j->AutoParallel();
+   else if(parallel>0)
       j->SetParallel(parallel);
    j->Quiet(quiet);
    return j.borrow();
@@ -3588,9 +3668,52 @@ CMD(slot)
 
 CMD(tasks)
 {
+   int opt;
+   bool verbose=false;
+   bool machine=false;
+   while((opt=args->getopt("+vmp:"))!=EOF)
+   {
+      switch(opt)
+      {
+      case('v'):
+	 verbose=true;
+	 break;
+      case('m'):
+	 machine=true;
+	 break;
+      case('p'):
+	 if(!strcmp(optarg,"on"))
+	    SMTask::SetProfiling(true);
+	 else if(!strcmp(optarg,"off"))
+	    SMTask::SetProfiling(false);
+	 else if(!strcmp(optarg,"reset"))
+	    SMTask::ResetProfile();
+	 else
+	 {
+	    eprintf(_("%s: -p must be one of on, off, reset\n"),args->a0());
+	    return 0;
+	 }
+	 exit_code=0;
+	 return 0;
+      case('?'):
+	 eprintf(_("Usage: %s [-v|-m|-p on|off|reset]\n"),args->a0());
+	 return 0;
+      }
+   }
+   exit_code=0;
+   if(machine)
+   {
+      printf("task_count=%d sleeping_count=%d do_calls_avoided=%llu\n",
+	 SMTask::TaskCount(),SMTask::SleepingCount(),SMTask::DoCallsAvoided());
+      SMTask::PrintProfile(true);
+      return 0;
+   }
    printf("task_count=%d\n",SMTask::TaskCount());
+   printf("sleeping_count=%d do_calls_avoided=%llu\n",
+      SMTask::SleepingCount(),SMTask::DoCallsAvoided());
    SMTask::PrintTasks();
-   exit_code=0;
+   if(verbose)
+      SMTask::PrintProfile(false);
    return 0;
 }
 
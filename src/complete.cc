@@ -492,10 +492,12 @@ static completion_type cmd_completion_type(const char *cmd,int start)
    if(!strcmp(buf,"mget"))
       if(!was_O)
 	 return REMOTE_FILE;
-   if(!strcmp(buf,"put"))
+   if(!strcmp(buf,"put")
+   || !strcmp(buf,"pput"))
       if(was_o)
 	 return REMOTE_FILE;
    if(!strcmp(buf,"put")
+   || !strcmp(buf,"pput")
    || !strcmp(buf,"mput"))
       if(was_O)
 	 return REMOTE_DIR;
@@ -61,6 +61,9 @@
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 
 CDECL_BEGIN
 #include "regex.h"
@@ -866,6 +869,34 @@ Ftp::pasv_state_t Ftp::Handle_EPSV_CEPR()
    return PASV_HAVE_ADDRESS;
 }
 
+// the payloads of 213 replies to SIZE and MDTM, checked strictly while
+// pipelining so that a reply to the other command is noticed.
+static bool is_size_reply(const char *s)
+{
+   if(!is_ascii_digit(*s))
+      return false;
+   while(is_ascii_digit(*s))
+      s++;
+   return *s==0 || *s==' ';
+}
+static bool is_mdtm_reply(const char *s)
+{
+   int n=0;
+   while(is_ascii_digit(s[n]))
+      n++;
+   // 15 digits when the server has the y2k bug (19100 for 2000).
+   if(n!=14 && !(n==15 && !strncmp(s,"191",3)))
+      return false;
+   s+=n;
+   if(*s=='.')
+   {
+      s++;
+      while(is_ascii_digit(*s))
+	 s++;
+   }
+   return *s==0 || *s==' ';
+}
+
 void Ftp::CatchDATE(int act)
 {
    if(!fileset_for_info)
@@ -877,13 +908,29 @@ void Ftp::CatchDATE(int act)
 
    if(is2XX(act))
    {
+      time_t date=NO_DATE;
+      if(line.length()>4 && is_ascii_digit(line[4]))
+	 date=ConvertFtpDate(line+4);
+      if(ArrayInfoPipelined() && (date==NO_DATE || !is_mdtm_reply(line+4)))
+      {
+	 ArrayInfoPipelineFailed();
+	 return;
+      }
       if(line.length()>4 && is_ascii_digit(line[4]))
-	 fi->SetDate(ConvertFtpDate(line+4),0);
+	 fi->SetDate(date,0);
+      info_date_ok=true;
    }
    else	if(is5XX(act))
    {
       if(cmd_unsupported(act))
+      {
+	 if(info_date_ok && ArrayInfoPipelined())
+	 {
+	    ArrayInfoPipelineFailed();
+	    return;
+	 }
 	 conn->mdtm_supported=false;
+      }
    }
    else
    {
@@ -893,7 +940,7 @@ void Ftp::CatchDATE(int act)
 
    fi->NoNeed(fi->DATE);
    if(!(fi->need&fi->SIZE))
-      fileset_for_info->next();
+      NextArrayInfo();
 
    TrySuccess();
 }
@@ -932,11 +979,26 @@ void Ftp::CatchSIZE(int act)
 	 if(sscanf(line+4,"%lld",&size)!=1)
 	    size=NO_SIZE;
       }
+      // a date looks like a size, but not when MDTM is in flight too.
+      if(ArrayInfoPipelined() && (size==NO_SIZE || !is_size_reply(line+4)
+	    || (is_mdtm_reply(line+4) && expect->Has(Expect::MDTM))))
+      {
+	 ArrayInfoPipelineFailed();
+	 return;
+      }
+      info_size_ok=true;
    }
    else	if(is5XX(act))
    {
       if(cmd_unsupported(act))
+      {
+	 if(info_size_ok && ArrayInfoPipelined())
+	 {
+	    ArrayInfoPipelineFailed();
+	    return;
+	 }
 	 conn->size_supported=false;
+      }
    }
    else
    {
@@ -948,7 +1010,7 @@ void Ftp::CatchSIZE(int act)
       fi->SetSize(size);
    fi->NoNeed(fi->SIZE);
    if(!(fi->need&fi->DATE))
-      fileset_for_info->next();
+      NextArrayInfo();
 
    TrySuccess();
 }
@@ -990,6 +1052,9 @@ Ftp::Connection::Connection(const char *c)
    telnet_layer_send=0;
    data_sock=-1;
    aborted_data_sock=-1;
+   splice_pipe[0]=splice_pipe[1]=-1;
+   splice_pipe_len=0;
+   splicing=false;
 #if USE_SSL
    prot='C';  // current protection scheme 'C'lear or 'P'rivate
    auth_sent=false;
@@ -1075,6 +1140,14 @@ void Ftp::InitFtp()
    use_telnet_iac=true;
    use_mlsd=false;
 
+   info_pipeline_max=64;
+   info_pipeline_sync=true;
+   info_window=1;
+   info_next=0;
+   info_done=0;
+   info_size_ok=false;
+   info_date_ok=false;
+
    max_buf=0x10000;
 
    copy_mode=COPY_NONE;
@@ -1413,9 +1486,6 @@ int   Ftp::Do()
 	 SetError(SEE_ERRNO,str);
 	 return MOVED;
       }
-      if(QueryBool("use-ip-tos",hostname))
-	 MinimizeLatency(conn->control_sock);
-
       SayConnectingTo();
 
       res=SocketConnect(conn->control_sock,&conn->peer_sa);
@@ -1437,7 +1507,7 @@ int   Ftp::Do()
    /* fallthrough */
    case(CONNECTING_STATE):
       assert(conn && conn->control_sock!=-1);
-      res=Poll(conn->control_sock,POLLOUT,&error);
+      res=RaceConnect(&conn->control_sock,&conn->peer_sa,&error);
       if(res==-1) {
 	 LogError(0,_("Socket error (%s) - reconnecting"),error);
 	 Disconnect(error);
@@ -1446,6 +1516,9 @@ int   Ftp::Do()
       if(!(res&POLLOUT))
 	 goto usual_return;
 
+      if(QueryBool("use-ip-tos",hostname))
+	 MinimizeLatency(conn->control_sock);
+
 #if USE_SSL
       if(proxy && (!xstrcmp(proxy_proto,"ftps")
 	        || !xstrcmp(proxy_proto,"https")))
@@ -2076,6 +2149,19 @@ int   Ftp::Do()
 
       if(mode==ARRAY_INFO)
       {
+	 info_next=0;
+	 info_done=0;
+	 info_size_ok=info_date_ok=false;
+	 info_window=ArrayInfoWindowLimit();
+	 if(GetFlag(SYNC_MODE))
+	 {
+	    // start small, unless the site is known to cope with more.
+	    int w=GetSiteData()->GetInfoWindow();
+	    if(w<2)
+	       w=2;
+	    if(w<info_window)
+	       info_window=w;
+	 }
 	 SendArrayInfoRequests();
 	 goto pre_WAITING_STATE;
       }
@@ -2473,7 +2559,8 @@ int   Ftp::Do()
       if(state!=oldstate || Error())
 	 return MOVED;
 
-      timeout_timer.Reset(conn->data_iobuf->EventTime());
+      if(!conn->splicing)  // suspended data_iobuf has no events
+	 timeout_timer.Reset(conn->data_iobuf->EventTime());
       if(conn->data_iobuf->Error() && conn->data_sock!=-1)
       {
 	 LogError(0,"%s",conn->data_iobuf->ErrorText());
@@ -2519,7 +2606,7 @@ int   Ftp::Do()
 	    conn->data_iobuf->Suspend();
 	    m=MOVED;
 	 }
-	 else if(conn->data_iobuf->IsSuspended() && !IsSuspended())
+	 else if(conn->data_iobuf->IsSuspended() && !IsSuspended() && !conn->splicing)
 	 {
 	    conn->data_iobuf->Resume();
 	    if(conn->data_iobuf->Size()>0)
@@ -2570,11 +2657,9 @@ int   Ftp::Do()
          return MOVED;
 
       // more work to do?
-      if(expect->IsEmpty() && mode==ARRAY_INFO && fileset_for_info->curr())
-      {
-	 SendArrayInfoRequests();
+      if(mode==ARRAY_INFO && fileset_for_info->curr()
+      && expect->OnlyHas(Expect::MDTM,Expect::SIZE) && SendArrayInfoRequests())
 	 return MOVED;
-      }
 
       if(conn->data_iobuf)
       {
@@ -2817,11 +2902,22 @@ void Ftp::SendSiteCommands()
    }
 }
 
-void Ftp::SendArrayInfoRequests()
+bool Ftp::SendArrayInfoRequests()
 {
-   for(int i=fileset_for_info->curr_index(); i<fileset_for_info->count(); i++)
+   bool sync=GetFlag(SYNC_MODE);
+   int window=info_window;
+   // in sync mode, only pipeline behind our own requests.
+   if(sync && (conn->send_cmd_buffer.Size()>0 || !expect->OnlyHas(Expect::MDTM,Expect::SIZE)))
+      window=1;
+   bool moved=false;
+   if(info_next<fileset_for_info->curr_index())
+      info_next=fileset_for_info->curr_index();
+   for( ; info_next<fileset_for_info->count(); info_next++)
    {
-      FileInfo *fi=(*fileset_for_info)[i];
+      int first=fileset_for_info->curr_index();
+      if(info_next>=first+window)
+	 break;
+      FileInfo *fi=(*fileset_for_info)[info_next];
       bool sent=false;
       if((fi->need&fi->DATE) && conn->mdtm_supported && use_mdtm)
       {
@@ -2837,17 +2933,66 @@ void Ftp::SendArrayInfoRequests()
       }
       if(!sent)
       {
-	 if(i==fileset_for_info->curr_index())
+	 if(info_next==first)
 	    fileset_for_info->next();   // if it is the first one, just skip it.
 	 else
 	    break;	   // otherwise, wait until it is the first.
       }
-      else
-      {
-	 if(GetFlag(SYNC_MODE))
-	    break;	   // don't flood the queues.
-      }
+      moved=true;
    }
+   if(sync && window>1 && moved)
+      FlushSendQueue(true);   // the sync mode would send them one by one
+   return moved;
+}
+
+// true if the server has requests for more than the current file.
+bool Ftp::ArrayInfoPipelined() const
+{
+   return GetFlag(SYNC_MODE) && info_next-fileset_for_info->curr_index()>1;
+}
+
+int Ftp::ArrayInfoWindowLimit() const
+{
+   if(GetFlag(SYNC_MODE) && !info_pipeline_sync)
+      return 1;
+   int limit=(info_pipeline_max>1?info_pipeline_max:1);
+   int site_max=GetSiteData()->GetInfoWindowMax();
+   if(GetFlag(SYNC_MODE) && site_max && site_max<limit)
+      limit=site_max;
+   return limit;
+}
+
+// the current file is done; widen the window after a whole window
+// of files has been answered in order.
+void Ftp::NextArrayInfo()
+{
+   fileset_for_info->next();
+   if(!GetFlag(SYNC_MODE) || ++info_done<info_window)
+      return;
+   info_done=0;
+   int limit=ArrayInfoWindowLimit();
+   if(info_window>=limit)
+      return;
+   info_window*=2;
+   if(info_window>limit)
+      info_window=limit;
+   GetSiteData()->SetInfoWindow(info_window);
+   LogNote(10,"sending SIZE/MDTM for up to %d files at once",info_window);
+}
+
+// a reply does not fit its pipelined request, so the server must have
+// mixed them up. Don't trust the rest and retry with a smaller window.
+void Ftp::ArrayInfoPipelineFailed()
+{
+   int w=info_window/2;
+   if(w<1)
+      w=1;
+   LogError(1,"server does not handle pipelined SIZE/MDTM, limiting it to %d files",w);
+   SiteData *site=GetSiteData();
+   site->SetInfoWindow(w);
+   site->SetInfoWindowMax(w);
+   info_window=w;
+   Disconnect(line);
 }
 
 int Ftp::ReplyLogPriority(int code) const
@@ -3245,6 +3390,7 @@ void  Ftp::DataAbort()
 
 void Ftp::ControlClose()
 {
+   RaceStop();
    if(conn && conn->control_send)
       conn->control_send->PutEOF();
    conn=0;
@@ -3323,8 +3469,32 @@ void Ftp::Connection::CloseDataSocket()
    data_sock=-1;
 }
 
+void Ftp::Connection::StopSplicing()
+{
+   if(!splicing)
+      return;
+   splicing=false;
+   if(data_iobuf)
+   {
+      while(splice_pipe_len>0)
+      {
+	 int res=read(splice_pipe[0],data_iobuf->GetSpace(splice_pipe_len),splice_pipe_len);
+	 if(res<=0)
+	    break;
+	 data_iobuf->SpaceAdd(res);
+	 splice_pipe_len-=res;
+      }
+      data_iobuf->Resume();
+   }
+   close(splice_pipe[0]);
+   close(splice_pipe[1]);
+   splice_pipe[0]=splice_pipe[1]=-1;
+   splice_pipe_len=0;
+}
+
 void Ftp::Connection::CloseDataConnection()
 {
+   StopSplicing();
    data_iobuf=0;
    fixed_pasv=false;
    CloseDataSocket();
@@ -3680,6 +3850,13 @@ bool Ftp::ExpectQueue::FirstIs(Expect::expect_t cc) const
       return true;
    return false;
 }
+bool Ftp::ExpectQueue::OnlyHas(Expect::expect_t cc1,Expect::expect_t cc2) const
+{
+   for(const Expect *scan=first; scan; scan=scan->next)
+      if(cc1!=scan->check_case && cc2!=scan->check_case)
+	 return false;
+   return true;
+}
 void Ftp::ExpectQueue::Close()
 {
    for(Expect *scan=first; scan; scan=scan->next)
@@ -3815,6 +3992,8 @@ int   Ftp::CanRead()
 
 int   Ftp::Read(Buffer *buf,int size)
 {
+   if(conn && conn->splicing)
+      conn->StopSplicing();  // the caller went back to buffered reads
    int size1=CanRead();
    if(size1<=0)
       return size1;
@@ -3852,6 +4031,102 @@ int   Ftp::Read(Buffer *buf,int size)
    return(size);
 }
 
+bool Ftp::CanZeroCopy(RateLimit::dir_t dir)
+{
+   if(ascii || conn->data_sock==-1 || conn->data_iobuf->GetTranslator())
+      return false;
+#if USE_SSL
+   if(conn->prot=='P')
+      return false;
+#endif
+   return rate_limit->Unlimited(dir);
+}
+
+/*
+   ReadToFD - move data from the data socket to a local file
+   using splice(2) through a pipe, bypassing data_iobuf.
+*/
+int   Ftp::ReadToFD(int fd,int size)
+{
+#ifdef HAVE_SPLICE
+   if(Error() || mode!=RETRIEVE || eof)
+      return NOT_SUPP;
+
+   if(!conn || !conn->data_iobuf || state==DATASOCKET_CONNECTING_STATE
+   || (expect->Has(Expect::REST) && real_pos==-1))
+      return DO_AGAIN;
+
+   if(state!=DATA_OPEN_STATE || real_pos!=pos || !CanZeroCopy(RateLimit::GET)
+   || conn->data_iobuf->Size()>0 || conn->data_iobuf->Eof())
+   {
+      conn->StopSplicing();
+      return NOT_SUPP;
+   }
+
+   if(!conn->splicing)
+   {
+      if(pipe(conn->splice_pipe)==-1)
+	 return NOT_SUPP;
+      for(int i=0; i<2; i++)
+      {
+	 fcntl(conn->splice_pipe[i],F_SETFL,O_NONBLOCK);
+	 fcntl(conn->splice_pipe[i],F_SETFD,FD_CLOEXEC);
+      }
+      conn->splice_pipe_len=0;
+      conn->splicing=true;
+      conn->data_iobuf->Suspend();
+   }
+
+   if(conn->splice_pipe_len==0)
+   {
+      ssize_t res=splice(conn->data_sock,0,conn->splice_pipe[1],0,size,
+			 SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+      if(res==-1)
+      {
+	 if(errno==EAGAIN || errno==EINTR)
+	 {
+	    Block(conn->data_sock,POLLIN);
+	    return DO_AGAIN;
+	 }
+	 // let data_iobuf report the error
+	 conn->StopSplicing();
+	 return NOT_SUPP;
+      }
+      if(res==0)
+      {
+	 conn->data_iobuf->PutEOF();
+	 conn->StopSplicing();
+	 return DO_AGAIN;
+      }
+      conn->splice_pipe_len=res;
+   }
+
+   ssize_t res=splice(conn->splice_pipe[0],0,fd,0,conn->splice_pipe_len,SPLICE_F_MOVE);
+   if(res<=0)
+   {
+      // the rest goes through data_iobuf, so the error is reported by
+      // the regular write.
+      conn->StopSplicing();
+      return NOT_SUPP;
+   }
+   // data left in the pipe are accounted when they get to the file, or by
+   // Read after StopSplicing has handed them back to data_iobuf.
+   conn->splice_pipe_len-=res;
+   conn->data_iobuf->SetPos(conn->data_iobuf->GetPos()+res);
+   rate_limit->BytesGot(res);
+   real_pos+=res;
+   pos+=res;
+
+   TrySuccess();
+   flags|=IO_FLAG;
+   timeout_timer.Reset();
+
+   return(res);
+#else
+   return NOT_SUPP;
+#endif
+}
+
 /*
    Write - send data to ftp server
 
@@ -3907,6 +4182,54 @@ int   Ftp::Write(const void *buf,int size)
    return(size);
 }
 
+/*
+   WriteFromFD - send data from a local file using sendfile(2).
+   Only used while data_iobuf is empty, so the data stay in order.
+*/
+int   Ftp::WriteFromFD(int fd,int size)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+   if(Error() || mode!=STORE)
+      return NOT_SUPP;
+
+   if(!conn || !conn->data_iobuf || state!=DATA_OPEN_STATE
+   || (expect->Has(Expect::REST) && real_pos==-1))
+      return DO_AGAIN;
+
+   if(!CanZeroCopy(RateLimit::PUT)
+   || conn->data_iobuf->Size()>0 || conn->data_iobuf->Eof())
+      return NOT_SUPP;
+
+   ssize_t res=sendfile(conn->data_sock,fd,0,size);
+   if(res==-1)
+   {
+      if(errno==EAGAIN || errno==EINTR)
+      {
+	 Block(conn->data_sock,POLLOUT);
+	 return DO_AGAIN;
+      }
+      // not supported for this file or a real error, Write will tell.
+      return NOT_SUPP;
+   }
+   if(res==0)  // end of file, let the caller notice it
+      return NOT_SUPP;
+
+   conn->data_iobuf->SetPos(conn->data_iobuf->GetPos()+res);
+   rate_limit->BytesPut(res);
+   pos+=res;
+   real_pos+=res;
+   if(retries+persist_retries>0 && conn->data_iobuf->GetPos()>Buffered()+0x20000)
+      TrySuccess();
+
+   flags|=IO_FLAG;
+   timeout_timer.Reset();
+
+   return(res);
+#else
+   return NOT_SUPP;
+#endif
+}
+
 int   Ftp::StoreStatus()
 {
    if(Error())
@@ -4825,6 +5148,8 @@ void Ftp::Reconfig(const char *name)
    use_size = QueryBool("use-size");
    use_feat = QueryBool("use-feat");
    use_mlsd = QueryBool("use-mlsd");
+   info_pipeline_max = Query("info-pipeline-max");
+   info_pipeline_sync = QueryBool("info-pipeline-sync");
 
    use_telnet_iac = QueryBool("use-telnet-iac");
 
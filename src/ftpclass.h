@@ -77,6 +77,9 @@ class Ftp : public NetAccess
       int data_sock;
       SMTaskRef<IOBuffer> data_iobuf;
       int aborted_data_sock;
+      int splice_pipe[2];  // data_sock -> splice_pipe -> local file
+      int splice_pipe_len; // bytes sitting in splice_pipe
+      bool splicing;	   // data_iobuf is suspended, ReadToFD takes the data
       sockaddr_u peer_sa;
       sockaddr_u data_sa; // address for data accepting
       bool quit_sent;
@@ -168,6 +171,7 @@ class Ftp : public NetAccess
       void CloseDataConnection();
       void AbortDataConnection();
       void CloseAbortedDataConnection();
+      void StopSplicing(); // give the pipe contents back to data_iobuf
 
       void Send(const char *cmd);
       void SendURI(const char *u,const char *home);
@@ -278,6 +282,7 @@ class Ftp : public NetAccess
       bool IsEmpty() const { return count==0; }
       bool Has(Expect::expect_t) const;
       bool FirstIs(Expect::expect_t) const;
+      bool OnlyHas(Expect::expect_t,Expect::expect_t) const;
       void Close();
    };
 
@@ -301,6 +306,10 @@ class Ftp : public NetAccess
    void	 CatchSIZE(int);
    void	 CatchSIZE_opt(int);
    void	 TurnOffStatForList();
+   void	 NextArrayInfo();
+   bool	 ArrayInfoPipelined() const;
+   void	 ArrayInfoPipelineFailed();
+   int	 ArrayInfoWindowLimit() const;
 
    enum pasv_state_t
    {
@@ -338,7 +347,7 @@ private:
    void SendUrgentCmd(const char *cmd);
    int	FlushSendQueueOneCmd();
    int	FlushSendQueue(bool all=false);
-   void	SendArrayInfoRequests();
+   bool	SendArrayInfoRequests();
    void	SendSiteIdle();
    void	SendAcct();
    void	SendSiteGroup();
@@ -426,6 +435,15 @@ private:
    bool use_feat;
    bool use_mlsd;
 
+   // SIZE/MDTM requests of ARRAY_INFO sent without waiting for replies
+   int info_pipeline_max;
+   bool info_pipeline_sync;	// pipeline them in sync mode too
+   int info_window;	// files to have requests in flight for
+   int info_next;	// the next file to send requests for
+   int info_done;	// files answered since the window has grown
+   bool info_size_ok;	// the command has worked, so 500 means a mix-up
+   bool info_date_ok;
+
    bool use_telnet_iac;
 
    int max_buf;
@@ -435,8 +453,10 @@ private:
 
    typedef FileInfo *(*FtpLineParser)(char *line,int *err,const char *tz);
    static FtpLineParser line_parsers[];
+   friend class FtpLongListParser;
 
    int CanRead();
+   bool CanZeroCopy(RateLimit::dir_t dir);
 
    const char *path_to_send();
 
@@ -478,6 +498,8 @@ public:
 
    int   Read(Buffer *buf,int size);
    int   Write(const void *buf,int size);
+   int   WriteFromFD(int fd,int size);
+   int   ReadToFD(int fd,int size);
    int   Buffered();
    void  Close();
    bool	 IOReady();
@@ -516,6 +538,7 @@ public:
    Glob *MakeGlob(const char *pattern);
    DirList *MakeDirList(ArgV *args);
    FileSet *ParseLongList(const char *buf,int len,int *err=0) const;
+   LongListParser *MakeLongListParser() const;
 
    void SetCopyMode(copy_mode_t cm,bool rp,bool prot,bool sscn,int rnum,time_t tt)
       {
@@ -48,6 +48,7 @@
 #include "misc.h"
 #include "ArgV.h"
 #include "attach.h"
+#include "ThreadPool.h"
 
 #include "configmake.h"
 
@@ -435,6 +436,9 @@ static void move_to_background()
    fflush(stdout);
    fflush(stderr);
 
+   // the child continues the jobs, but the worker threads stay behind.
+   ThreadPool::WaitAll();
+
    pid_t pid=fork();
    switch(pid)
    {
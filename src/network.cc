@@ -271,6 +271,7 @@ int Networker::SocketCreateUnbound(int af,int type,int proto,const char *hostnam
    if(s<0)
       return s;
 
+   SMTask::FDOpened(s);
    NonBlock(s);
    CloseOnExec(s);
    SetSocketBuffer(s,ResMgr::Query("net:socket-buffer",hostname));
@@ -352,6 +353,7 @@ int Networker::SocketAccept(int fd,sockaddr_u *u,const char *hostname)
    int a=accept(fd,&u->sa,&len);
    if(a<0)
       return a;
+   SMTask::FDOpened(a);
    NonBlock(a);
    CloseOnExec(a);
    KeepAlive(a);
@@ -24,15 +24,24 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
 #include "pgetJob.h"
 #include "url.h"
 #include "misc.h"
 #include "log.h"
+#include "ascii_ctype.h"
+
+#if USE_EXPAT
+# include <expat.h>
+#endif
 
 ResType pget_vars[] = {
    {"pget:save-status",	"10s",   ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
    {"pget:default-n",   "5",	 ResMgr::UNumberValidate,ResMgr::NoClosure},
    {"pget:min-chunk-size", "1M", ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"pget:multi-range", "yes",	 ResMgr::BoolValidate,ResMgr::NoClosure},
    {0}
 };
 ResDecls pget_vars_register(pget_vars);
@@ -40,6 +49,11 @@ ResDecls pget_vars_register(pget_vars);
 #undef MIN
 #define MIN(a,b) ((a)<(b)?(a):(b))
 
+// a mirror is dropped if it is this much slower than the best source
+#define SLOW_SOURCE_RATIO  0.1
+// ...after its connections have been running for this many seconds.
+#define SLOW_SOURCE_TIME   30
+
 #define super CopyJob
 
 int pgetJob::Do()
@@ -72,6 +86,8 @@ int pgetJob::Do()
 
    if(chunks_done && chunks && c->GetPos()>=limit0)
    {
+      if(upload && !CheckUploadedSize())
+	 return m;
       c->SetRangeLimit(limit0);    // make it stop.
       c->Resume();
       c->Do();
@@ -112,7 +128,8 @@ int pgetJob::Do()
 	 no_parallel=true;
 	 c->Resume();
       }
-      else if(!chunks[0]->Done() && chunks[0]->GetBytesCount()<limit0/16)
+      else if(!main_dropped && !chunks[0]->Done() && chunks[0]->GetBytesCount()<limit0/16
+	 && chunks[0]->ranges.count()==2 && chunks[0]->start==limit0)
       {
 	 c->Resume();
 	 if(chunks.count()==1)
@@ -142,13 +159,21 @@ int pgetJob::Do()
       if(size==NO_SIZE_YET)
 	 return m;
 
-      if(size==NO_SIZE || (c->put && c->put->GetLocal()==0))
+      bool bad_target=(upload ? !c->put->CanStoreAt()
+			      : (c->put && c->put->GetLocal()==0));
+      if(size==NO_SIZE || bad_target)
       {
-	 Log::global->Write(0,_("pget: falling back to plain get"));
+	 if(upload)
+	    Log::global->Write(0,_("pput: falling back to plain put"));
+	 else
+	    Log::global->Write(0,_("pget: falling back to plain get"));
 	 Log::global->Write(0," (");
-	 if(c->put && c->put->GetLocal()==0)
+	 if(bad_target)
 	 {
-	    Log::global->Write(0,_("the target file is remote"));
+	    if(upload)
+	       Log::global->Write(0,_("the target does not support writing at an offset"));
+	    else
+	       Log::global->Write(0,_("the target file is remote"));
 	    if(size==NO_SIZE)
 	       Log::global->Write(0,", ");
 	 }
@@ -160,12 +185,28 @@ int pgetJob::Do()
 	 return m;
       }
 
+      if(!CheckMirrors(size))
+	 return m;
+
       // Make sure the destination file is open before starting chunks,
       // it disables temp-name creation in the chunk's Init.
-      if(c->put->GetLocal()->getfd()==-1)
+      if(Local()->getfd()==-1)
 	 return m;
 
-      c->put->NeedSeek(); // seek before writing
+      if(upload)
+      {
+	 // the main transfer creates (and maybe truncates) the remote file
+	 // when it opens it, the chunks must not write before that.
+	 if(!target_opened)
+	 {
+	    if(!c->put->StoreOpened())
+	       return m;
+	    target_opened=true;
+	 }
+	 c->get->NeedSeek(); // seek before reading
+      }
+      else
+	 c->put->NeedSeek(); // seek before writing
 
       if(pget_cont)
 	 LoadStatus();
@@ -185,7 +226,7 @@ int pgetJob::Do()
       {
 	 SaveStatus();
 	 status_timer.Reset();
-	 if(ResMgr::QueryBool("file:use-fallocate",0)) {
+	 if(!upload && ResMgr::QueryBool("file:use-fallocate",0)) {
 	    // allocate space after creating *.lftp-pget-status file,
 	    // so that the incomplete status is more obvious.
 	    const Ref<FDStream>& local=c->put->GetLocal();
@@ -197,6 +238,32 @@ int pgetJob::Do()
       }
    }
 
+   /* a failed connection is retried from another source */
+   if(mirrors.count()>0)
+   {
+      for(int i=0; i<chunks.count(); i++)
+      {
+	 if(chunks[i]->Error())
+	    DropSource(chunks[i]->source,chunks[i]->ErrorText());
+      }
+      UpdateSourceRates();
+      if(ReplaceDroppedChunks())
+	 m=MOVED;
+   }
+
+   /* let a finished chunk help with the largest remaining range */
+   if(!ends_pending)
+   {
+      for(int i=0; i<chunks.count(); i++)
+      {
+	 if(chunks[i]->Done() && !chunks[i]->Error() && ReuseChunk(i))
+	 {
+	    m=MOVED;
+	    break;
+	 }
+      }
+   }
+
    /* cycle through the chunks */
    chunks_done=true;
    total_xferred=MIN(offset,limit0);
@@ -217,11 +284,11 @@ int pgetJob::Do()
 	 no_parallel=true;
 	 break;
       }
+      off_t chunk_size=chunks[i]->Remaining(0);
+      total_xferred+=chunks[i]->Got();
+      got_already-=chunk_size;
       if(!chunks[i]->Done())
       {
-	 if(chunks[i]->GetPos()>=chunks[i]->start)
-	    total_xferred+=MIN(chunks[i]->GetPos(),chunks[i]->limit)
-			   -chunks[i]->start;
 	 if(total_eta>=0)
 	 {
 	    long eta=chunks[i]->GetETA();
@@ -233,11 +300,6 @@ int pgetJob::Do()
 	 total_xfer_rate+=chunks[i]->GetRate();
 	 chunks_done=false;
       }
-      else  // done
-      {
-	 total_xferred+=chunks[i]->limit-chunks[i]->start;
-      }
-      got_already-=chunks[i]->limit-chunks[i]->start;
    }
    total_xferred+=got_already;
 
@@ -285,12 +347,17 @@ void pgetJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
 
    for(int chunk=0; chunk<chunks.count(); chunk++)
    {
-      p=(chunks[chunk]->Done()?chunks[chunk]->limit:chunks[chunk]->GetPos())*w/size;
-      for(i=chunks[chunk]->start*w/size; i<p; i++)
-	 bar[i]='o';
-      p=chunks[chunk]->limit*w/size;
-      for( ; i<p; i++)
-	 bar[i]='.';
+      const xarray<off_t>& r=chunks[chunk]->ranges;
+      off_t pos=(chunks[chunk]->Done()?chunks[chunk]->limit:chunks[chunk]->GetPos());
+      for(int j=0; j<r.count(); j+=2)
+      {
+	 p=MIN(pos,r[j+1])*w/size;
+	 for(i=r[j]*w/size; i<p; i++)
+	    bar[i]='o';
+	 p=r[j+1]*w/size;
+	 for( ; i<p; i++)
+	    bar[i]='.';
+      }
    }
 
    status.Append(bar);
@@ -340,9 +407,52 @@ void pgetJob::free_chunks()
    }
 }
 
+/* All chunks of an upload are done; make sure the remote file has got
+   the right size before the main transfer completes (and renames it). */
+bool pgetJob::CheckUploadedSize()
+{
+   if(size_checked)
+      return true;
+   if(!size_session)
+   {
+      const FileAccessRef& session=c->put->GetSession();
+      if(!session->GetFile())
+      {
+	 size_checked=true;  // the session was closed, nothing to check.
+	 return true;
+      }
+      FileInfo *fi=new FileInfo(session->GetFile());
+      fi->Need(fi->SIZE);
+      size_info.Empty();
+      size_info.Add(fi);
+      size_session=session->Clone();
+      size_session->GetInfoArray(&size_info);
+   }
+   int res=size_session->Done();
+   if(res==FA::IN_PROGRESS)
+      return false;
+   size_checked=true;
+   if(res<0)
+   {
+      c->SetError(size_session->StrError(res));
+      size_session=0;
+      return true;
+   }
+   size_session=0;
+   const FileInfo *fi=size_info[0];
+   off_t size=GetSize();
+   if(fi && fi->Has(fi->SIZE) && fi->size!=size)
+      c->SetError(xstring::format(_("uploaded file size %lld does not match the source size %lld"),
+	 (long long)fi->size,(long long)size));
+   return true;
+}
+
 pgetJob::pgetJob(FileCopy *c1,const char *n,int m)
-   : CopyJob(c1,n,"pget")
+   : CopyJob(c1,n,c1->get->GetLocal()?"pput":"pget")
 {
+   upload=(c->get->GetLocal()!=0);
+   size_checked=false;
+   target_opened=false;
    chunks_bytes=0;
    start0=limit0=0;
    total_xferred=0;
@@ -351,9 +461,14 @@ pgetJob::pgetJob(FileCopy *c1,const char *n,int m)
    chunks_done=false;
    priority_ends=false;
    ends_pending=false;
-   pget_cont=c->SetContinue(false);
+   // an upload continues from the remote file size, there is no status file.
+   pget_cont=(upload ? false : c->SetContinue(false));
    max_chunks=m?m:ResMgr::Query("pget:default-n",0);
    total_eta=-1;
+   expected_size=-1;
+   next_source=1;
+   main_rate=0;
+   main_dropped=false;
    status_timer.SetResource("pget:save-status",0);
    const Ref<FDStream>& local=c->put->GetLocal();
    if(local && local->full_name)
@@ -372,32 +487,467 @@ pgetJob::~pgetJob()
 {
 }
 
-pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit)
+pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit,int src)
 {
-   const Ref<FDStream>& local=c->put->GetLocal();
-   FileCopyPeerFDStream
-		*dst_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
-   dst_peer->NeedSeek(); // seek before writing
-   dst_peer->SetBase(0);
+   xarray<off_t> r;
+   r.append(start);
+   r.append(limit);
+   return NewChunk(remote,r,src);
+}
+pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,const xarray<off_t>& r,int src)
+{
+   const Ref<FDStream>& local=Local();
+   FileCopyPeer *src_peer;
+   FileCopyPeer *dst_peer;
+   if(upload)
+   {
+      FileCopyPeerFDStream *local_peer=new FileCopyPeerFDStream(local,FileCopyPeer::GET);
+      local_peer->NeedSeek(); // seek before reading
+      local_peer->SetBase(0);
+      src_peer=local_peer;
+      dst_peer=c->put->Clone();
+   }
+   else
+   {
+      FileCopyPeerFDStream *local_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
+      local_peer->NeedSeek(); // seek before writing
+      local_peer->SetBase(0);
+      dst_peer=local_peer;
+      if(src>0)
+      {
+	 src_peer=mirrors[src-1]->peer->Clone();
+	 remote=mirrors[src-1]->url;
+      }
+      else
+	 src_peer=c->get->Clone();
+   }
 
-   FileCopy *c1=FileCopy::New(c->get->Clone(),dst_peer,false);
-   c1->SetRange(start,limit);
+   FileCopy *c1=FileCopy::New(src_peer,dst_peer,false);
+   c1->SetRange(r[0],r[1]);
+   for(int i=2; i<r.count(); i+=2)
+      c1->AddRange(r[i],r[i+1]);
    c1->SetSize(GetSize());
    c1->DontCopyDate();
    c1->DontVerify();
    c1->FailIfCannotSeek();
 
-   ChunkXfer *chunk=new ChunkXfer(c1,remote,start,limit);
-   chunk->cmdline.setf("\\chunk %lld-%lld",(long long)start,(long long)(limit-1));
-   return chunk;
+   return new ChunkXfer(c1,remote,r,src);
+}
+
+// position up to which the data have been requested already
+static off_t xfer_read_pos(const SMTaskRef<FileCopy>& c)
+{
+   return c->get->GetPos()+c->get->Size();
+}
+
+/* The chunk `done' has finished. Split the largest range which is still
+   being transferred and start a new chunk for the second part, so that
+   fast connections do not stay idle waiting for slow ones. With mirrors
+   the new chunk is given to the fastest source and the range is split
+   in proportion to the rates. The finished chunk is dropped, its range
+   is accounted as already got. */
+bool pgetJob::ReuseChunk(int done)
+{
+   off_t min_chunk_size=ResMgr::Query("pget:min-chunk-size",0).to_unumber(LLONG_MAX);
+   if(min_chunk_size<1)
+      min_chunk_size=1;
+
+   ChunkXfer *victim=0;
+   int victim_src=0;
+   off_t best_pos=0;
+   off_t best_rem=0;
+   if(!main_dropped && c->GetPos()<limit0 && !c->Done())
+   {
+      best_pos=xfer_read_pos(c);
+      best_rem=limit0-best_pos;
+   }
+   for(int i=0; i<chunks.count(); i++)
+   {
+      ChunkXfer *x=chunks[i].get_non_const();
+      if(x->Done() || x->IsSuspended())
+	 continue;
+      off_t pos=xfer_read_pos(x->c);
+      off_t rem=x->Remaining(pos);
+      if(rem>best_rem)
+      {
+	 victim=x;
+	 victim_src=x->source;
+	 best_pos=pos;
+	 best_rem=rem;
+      }
+   }
+   if(best_rem<2*min_chunk_size)
+      return false;
+
+   chunks_bytes+=chunks[done]->GetBytesCount();
+   chunks.remove(done);
+
+   int src=FastestSource();
+   off_t part=best_rem/2;
+   float victim_rate=SourceRate(victim_src);
+   float new_rate=SourceRate(src);
+   if(victim_rate>0 && new_rate>0)
+   {
+      part=(off_t)(best_rem*(new_rate/(new_rate+victim_rate)));
+      if(part<min_chunk_size)
+	 part=min_chunk_size;
+      if(part>best_rem-min_chunk_size)
+	 part=best_rem-min_chunk_size;
+   }
+   // the new chunk gets the last `part' bytes of the victim's ranges
+   xarray<off_t> tail;
+   off_t split;
+   if(!victim)
+   {
+      split=best_pos+best_rem-part;
+      tail.append(split);
+      tail.append(limit0);
+      limit0=split;
+   }
+   else
+   {
+      const xarray<off_t>& r=victim->ranges;
+      int i=r.count()-2;
+      while(r[i+1]-r[i]<part)
+      {
+	 part-=r[i+1]-r[i];
+	 i-=2;
+      }
+      split=r[i+1]-part;
+      tail.append(split);
+      tail.append(r[i+1]);
+      for(int j=i+2; j<r.count(); j++)
+	 tail.append(r[j]);
+      victim->SetLimit(split);
+   }
+   Log::global->Format(10,"pget: splitting %lld-%lld at %lld\n",
+      (long long)(victim?victim->start:start0),(long long)tail.last(),(long long)split);
+
+   ChunkXfer *chunk=NewChunk(GetName(),tail,src);
+   chunk->SetParentFg(this,false);
+   InsertChunk(chunk);
+   return true;
+}
+
+/* `chunks' is kept sorted by start, so that chunks[0] is the one the
+   main transfer can take over when it reaches limit0. */
+void pgetJob::InsertChunk(ChunkXfer *chunk)
+{
+   int i=chunks.count();
+   while(i>0 && chunks[i-1]->start>chunk->start)
+      i--;
+   chunks.insert(chunk,i);
+}
+
+/* Restart the unfinished part of chunk i from the fastest live source. */
+void pgetJob::ReplaceChunk(int i)
+{
+   ChunkXfer *old=chunks[i].get_non_const();
+   off_t pos=old->GetPos();
+   xarray<off_t> rest;
+   for(int j=0; j<old->ranges.count(); j+=2)
+   {
+      if(old->ranges[j+1]<=pos)
+	 continue;
+      rest.append(old->ranges[j]>pos?old->ranges[j]:pos);
+      rest.append(old->ranges[j+1]);
+   }
+   if(rest.count()==0)
+   {
+      if(chunks.count()>1)
+      {
+	 chunks_bytes+=old->GetBytesCount();
+	 chunks.remove(i);
+      }
+      return;
+   }
+   bool suspended=old->IsSuspended();
+   chunks_bytes+=old->GetBytesCount();
+   chunks.remove(i);
+
+   ChunkXfer *chunk=NewChunk(GetName(),rest,FastestSource());
+   chunk->SetParentFg(this,false);
+   if(suspended)
+      chunk->Suspend();
+   InsertChunk(chunk);
 }
 
 pgetJob::ChunkXfer::ChunkXfer(FileCopy *c1,const char *name,
-			      off_t s,off_t lim)
+			      const xarray<off_t>& r,int src)
    : CopyJob(c1,name,"pget-chunk")
 {
-   start=s;
-   limit=lim;
+   ranges.set(r);
+   start=r[0];
+   limit=ranges.last();
+   source=src;
+   UpdateCmdline();
+}
+
+void pgetJob::ChunkXfer::UpdateCmdline()
+{
+   cmdline.set("\\chunk");
+   for(int i=0; i<ranges.count(); i+=2)
+      cmdline.appendf("%c%lld-%lld",i?',':' ',
+	 (long long)ranges[i],(long long)(ranges[i+1]-1));
+   if(source>0)
+      cmdline.appendf(" %s",GetName());
+}
+
+// the data of the ranges before the transfer position
+off_t pgetJob::ChunkXfer::Got()
+{
+   off_t pos=(Done()?limit:GetPos());
+   off_t got=0;
+   for(int i=0; i<ranges.count() && ranges[i]<pos; i+=2)
+      got+=MIN(pos,ranges[i+1])-ranges[i];
+   return got;
+}
+
+off_t pgetJob::ChunkXfer::Remaining(off_t pos) const
+{
+   off_t rem=0;
+   for(int i=0; i<ranges.count(); i+=2)
+   {
+      if(ranges[i+1]>pos)
+	 rem+=ranges[i+1]-(ranges[i]>pos?ranges[i]:pos);
+   }
+   return rem;
+}
+
+// cut the ranges at lim, it can be in a range or at the start of one.
+void pgetJob::ChunkXfer::SetLimit(off_t lim)
+{
+   while(ranges.count()>2 && ranges[ranges.count()-2]>=lim)
+      ranges.remove(ranges.count()-2,ranges.count());
+   if(ranges.last()>lim)
+      ranges.last()=lim;
+   limit=ranges.last();
+   c->SetRangeLimit(limit);
+   UpdateCmdline();
+}
+
+pgetJob::Source::Source(const char *u)
+   : url(u), checked(false), dropped(false), rate(0)
+{
+   ParsedURL pu(u,true);
+   peer=new FileCopyPeerFA(&pu,FA::RETRIEVE);
+   peer->DontStartTransferYet();
+   peer->WantSize();
+}
+pgetJob::Source::~Source()
+{
+}
+
+void pgetJob::AddMirror(const char *url)
+{
+   mirrors.append(new Source(url));
+}
+
+/* Wait for the mirrors to report the file size and drop the ones which
+   have a different file. Returns false while some mirror is still being
+   checked. */
+bool pgetJob::CheckMirrors(off_t size)
+{
+   if(expected_size>=0 && size!=expected_size)
+   {
+      c->SetError(xstring::format(_("file size %lld does not match the expected %lld"),
+	 (long long)size,(long long)expected_size));
+      return false;
+   }
+   bool waiting=false;
+   for(int i=0; i<mirrors.count(); i++)
+   {
+      Source *s=mirrors[i];
+      if(s->checked || s->dropped)
+	 continue;
+      if(s->peer->Error())
+      {
+	 DropSource(i+1,s->peer->ErrorText());
+	 continue;
+      }
+      off_t msize=s->peer->GetSize();
+      if(msize==NO_SIZE_YET)
+      {
+	 s->peer->Resume();
+	 waiting=true;
+	 continue;
+      }
+      s->peer->Suspend();
+      if(msize!=size)
+      {
+	 DropSource(i+1,msize==NO_SIZE?_("the file size is unknown")
+	    :xstring::format(_("file size %lld does not match the expected %lld"),
+	       (long long)msize,(long long)size).get());
+	 continue;
+      }
+      Log::global->Format(9,"pget: using mirror %s\n",s->url.get());
+      s->checked=true;
+   }
+   return !waiting;
+}
+
+/* Stop using a source. Only marks it, the chunks are moved to other
+   sources by ReplaceDroppedChunks. The last live source is kept. */
+void pgetJob::DropSource(int src,const char *reason)
+{
+   if(SourceAlive(src) && AliveSources()<2)
+      return;
+   if(src==0)
+   {
+      if(main_dropped)
+	 return;
+      main_dropped=true;
+      Log::global->Format(0,"pget: dropping the main source: %s\n",reason);
+      return;
+   }
+   Source *s=mirrors[src-1];
+   if(s->dropped)
+      return;
+   s->dropped=true;
+   s->peer->Suspend();
+   Log::global->Format(0,"pget: dropping mirror %s: %s\n",s->url.get(),reason);
+}
+
+/* Move the unfinished chunks of dropped sources to live ones; the rest of
+   the main transfer goes to a new chunk. Called after the scans of
+   `chunks' in Do, as it changes the array. */
+bool pgetJob::ReplaceDroppedChunks()
+{
+   bool moved=false;
+   if(main_dropped && c->GetPos()<limit0 && !c->Done())
+   {
+      off_t split=xfer_read_pos(c);
+      if(split<limit0)
+      {
+	 xarray<off_t> tail;
+	 tail.append(split);
+	 tail.append(limit0);
+	 limit0=split;
+	 ChunkXfer *chunk=NewChunk(GetName(),tail,FastestSource());
+	 chunk->SetParentFg(this,false);
+	 InsertChunk(chunk);
+	 moved=true;
+      }
+   }
+   for(int i=chunks.count()-1; i>=0; i--)
+   {
+      ChunkXfer *x=chunks[i].get_non_const();
+      if(!SourceAlive(x->source) && (x->Error() || !x->Done()))
+      {
+	 ReplaceChunk(i);
+	 moved=true;
+      }
+   }
+   return moved;
+}
+
+int pgetJob::AliveSources() const
+{
+   int n=0;
+   for(int src=0; src<=mirrors.count(); src++)
+      if(SourceAlive(src))
+	 n++;
+   return n;
+}
+
+bool pgetJob::SourceAlive(int src) const
+{
+   if(src==0)
+      return !main_dropped;
+   const Source *s=mirrors[src-1];
+   return s->checked && !s->dropped;
+}
+
+float pgetJob::SourceRate(int src) const
+{
+   return src==0 ? main_rate : mirrors[src-1]->rate;
+}
+
+// round-robin over the live sources
+int pgetJob::NextSource()
+{
+   int n=mirrors.count()+1;
+   for(int i=0; i<n; i++)
+   {
+      int src=(next_source++)%n;
+      if(SourceAlive(src))
+	 return src;
+   }
+   return 0;
+}
+
+int pgetJob::FastestSource()
+{
+   int best=-1;
+   float best_rate=0;
+   for(int src=0; src<=mirrors.count(); src++)
+   {
+      if(!SourceAlive(src))
+	 continue;
+      float r=SourceRate(src);
+      if(r>best_rate)
+      {
+	 best=src;
+	 best_rate=r;
+      }
+   }
+   if(best==-1) // no rates yet
+      return NextSource();
+   return best;
+}
+
+/* Average the per-connection rate of each source and drop the sources
+   (the main one too) which are much slower than the best one. */
+void pgetJob::UpdateSourceRates()
+{
+   int n=mirrors.count()+1;
+   float *sum=(float*)alloca(n*sizeof(*sum));
+   int *count=(int*)alloca(n*sizeof(*count));
+   double *min_time=(double*)alloca(n*sizeof(*min_time));
+   for(int src=0; src<n; src++)
+   {
+      sum[src]=0;
+      count[src]=0;
+      min_time[src]=-1;
+   }
+   if(c->GetPos()<limit0 && !c->Done() && !c->IsSuspended())
+   {
+      sum[0]+=c->GetRate();
+      count[0]++;
+      min_time[0]=GetTimeSpent();
+   }
+   for(int i=0; i<chunks.count(); i++)
+   {
+      ChunkXfer *x=chunks[i].get_non_const();
+      if(x->Done() || x->IsSuspended())
+	 continue;
+      int src=x->source;
+      sum[src]+=x->GetRate();
+      count[src]++;
+      double t=x->GetTimeSpent();
+      if(min_time[src]<0 || t<min_time[src])
+	 min_time[src]=t;
+   }
+   float best=0;
+   for(int src=0; src<n; src++)
+   {
+      if(!count[src])
+	 continue;
+      float r=sum[src]/count[src];
+      if(src==0)
+	 main_rate=r;
+      else
+	 mirrors[src-1]->rate=r;
+      if(r>best)
+	 best=r;
+   }
+   for(int src=0; src<n; src++)
+   {
+      if(!count[src] || !SourceAlive(src) || min_time[src]<SLOW_SOURCE_TIME)
+	 continue;
+      if(SourceRate(src)<best*SLOW_SOURCE_RATIO)
+	 DropSource(src,_("too slow"));
+   }
 }
 
 void pgetJob::SaveStatus()
@@ -421,9 +971,17 @@ void pgetJob::SaveStatus()
    {
       if(chunks[chunk]->Done())
 	 continue;
-      i++;
-      fprintf(f,"%d.pos=%lld\n",i,(long long)chunks[chunk]->GetPos());
-      fprintf(f,"%d.limit=%lld\n",i,(long long)chunks[chunk]->limit);
+      // each range of a multi-range chunk is saved as a chunk.
+      off_t pos=chunks[chunk]->GetPos();
+      const xarray<off_t>& r=chunks[chunk]->ranges;
+      for(int j=0; j<r.count(); j+=2)
+      {
+	 if(r[j+1]<=pos)
+	    continue;
+	 i++;
+	 fprintf(f,"%d.pos=%lld\n",i,(long long)(r[j]>pos?r[j]:pos));
+	 fprintf(f,"%d.limit=%lld\n",i,(long long)r[j+1]);
+      }
    }
 out_close:
    fclose(f);
@@ -518,11 +1076,14 @@ void pgetJob::LoadStatus()
    c->SetRange(pos[0],FILE_END);
    if(num_of_chunks<1)
       goto out_close;
-   for(i=0; i<num_of_chunks; i++)
    {
-      ChunkXfer *c=NewChunk(GetName(),pos[i+1],limit[i+1]);
-      c->SetParentFg(this,false);
-      chunks.append(c);
+      xarray<off_t> r;
+      for(i=0; i<num_of_chunks; i++)
+      {
+	 r.append(pos[i+1]);
+	 r.append(limit[i+1]);
+      }
+      StartChunks(r);
    }
    goto out_close;
 }
@@ -540,14 +1101,16 @@ void pgetJob::InitChunks(off_t offset,off_t size)
    start0=0;
    limit0=size-chunk_size*num_of_chunks;
    off_t curr_offs=limit0;
+   xarray<off_t> r;
    for(int i=0; i<num_of_chunks; i++)
    {
-      ChunkXfer *c=NewChunk(GetName(),curr_offs,curr_offs+chunk_size);
-      c->SetParentFg(this,false);
-      chunks.append(c);
+      r.append(curr_offs);
+      r.append(curr_offs+chunk_size);
       curr_offs+=chunk_size;
    }
    assert(curr_offs==size);
+   StartChunks(r);
+   num_of_chunks=chunks.count();
    if(priority_ends && num_of_chunks>=2)
    {
       ends_pending=true;
@@ -556,3 +1119,180 @@ void pgetJob::InitChunks(off_t offset,off_t size)
 	 chunks[i]->Suspend();
    }
 }
+
+/* Start the chunks for the ranges r (start,limit pairs). When the server
+   limits the number of connections, the ranges are spread over the
+   available ones and each connection gets its ranges in one multi-range
+   request, so that the parts of the file still progress out of order. */
+void pgetJob::StartChunks(const xarray<off_t>& r)
+{
+   int n=r.count()/2;
+   int conns=ChunkConnections(n);
+   if(conns<n)
+      Log::global->Format(9,"pget: getting %d ranges over %d connections\n",n,conns);
+   for(int j=0; j<conns; j++)
+   {
+      xarray<off_t> cr;
+      for(int i=j; i<n; i+=conns)
+      {
+	 cr.append(r[2*i]);
+	 cr.append(r[2*i+1]);
+      }
+      ChunkXfer *c=NewChunk(GetName(),cr,NextSource());
+      c->SetParentFg(this,false);
+      chunks.append(c);
+   }
+}
+
+// how many connections to use for n chunks
+int pgetJob::ChunkConnections(int n)
+{
+   if(upload || priority_ends || mirrors.count()>0
+   || !ResMgr::QueryBool("pget:multi-range",0))
+      return n;
+   FileAccess *session=c->get->GetSession().get_non_const();
+   if(!session || !session->CanMultiRange())
+      return n;
+   int limit=ResMgr::Query("net:connection-limit",session->GetHostName());
+   // one connection is used by the main transfer.
+   if(limit<2 || limit-1>=n)
+      return n;
+   return limit-1;
+}
+
+#if USE_EXPAT
+struct metalink_context
+{
+   bool in_file;     // inside the first <file>
+   bool file_done;
+   bool collect;     // collecting <url> or <size> text
+   xstring chardata;
+   xstring *name;
+   StringSet *urls;
+   off_t *size;
+};
+
+// the parser is created with ' ' as namespace separator
+static const char *xml_local_name(const char *el)
+{
+   const char *s=strrchr(el,' ');
+   return s?s+1:el;
+}
+
+static void metalink_start(void *data,const char *el,const char **attr)
+{
+   metalink_context *ctx=(metalink_context*)data;
+   if(ctx->file_done)
+      return;
+   el=xml_local_name(el);
+   if(!ctx->in_file)
+   {
+      if(strcmp(el,"file"))
+	 return;
+      ctx->in_file=true;
+      for(int i=0; attr[i]; i+=2)
+	 if(!strcmp(attr[i],"name"))
+	    ctx->name->set(basename_ptr(attr[i+1]));  // do not allow paths
+      return;
+   }
+   ctx->collect=(!strcmp(el,"url") || !strcmp(el,"size"));
+   ctx->chardata.truncate();
+}
+static void metalink_end(void *data,const char *el)
+{
+   metalink_context *ctx=(metalink_context*)data;
+   if(!ctx->in_file)
+      return;
+   el=xml_local_name(el);
+   if(!strcmp(el,"file"))
+   {
+      ctx->in_file=false;
+      ctx->file_done=true;
+      return;
+   }
+   if(!ctx->collect)
+      return;
+   ctx->collect=false;
+   const char *b=ctx->chardata;
+   const char *e=b+ctx->chardata.length();
+   while(b<e && is_ascii_space(*b))
+      b++;
+   while(e>b && is_ascii_space(e[-1]))
+      e--;
+   xstring text(b,e-b);
+   if(!strcmp(el,"size"))
+      *ctx->size=atoll(text);
+   else
+   {
+      ParsedURL pu(text,true);
+      if(pu.proto && pu.path)
+	 ctx->urls->Append(text);
+   }
+}
+static void metalink_chardata(void *data,const char *chardata,int len)
+{
+   metalink_context *ctx=(metalink_context*)data;
+   if(ctx->collect)
+      ctx->chardata.append(chardata,len);
+}
+#endif // USE_EXPAT
+
+/* Only the first <file> element is used. Both metalink 3.0 and 4.0 (RFC
+   5854) keep the file name in the `name' attribute, the size in <size>
+   and the URLs in <url> elements. */
+const char *pgetJob::ParseMetalink(const char *file,xstring& name,StringSet& urls,off_t *size)
+{
+#if USE_EXPAT
+   int fd=open(file,O_RDONLY);
+   if(fd==-1)
+      return strerror(errno);
+
+   XML_Parser p=XML_ParserCreateNS(0,' ');
+   if(!p)
+   {
+      close(fd);
+      return strerror(ENOMEM);
+   }
+   metalink_context ctx;
+   ctx.in_file=ctx.file_done=ctx.collect=false;
+   ctx.name=&name;
+   ctx.urls=&urls;
+   ctx.size=size;
+   *size=-1;
+   XML_SetUserData(p,&ctx);
+   XML_SetElementHandler(p,metalink_start,metalink_end);
+   XML_SetCharacterDataHandler(p,metalink_chardata);
+
+   const char *err=0;
+   for(;;)
+   {
+      char buf[0x2000];
+      int res=read(fd,buf,sizeof(buf));
+      if(res==-1)
+      {
+	 err=strerror(errno);
+	 break;
+      }
+      if(!XML_Parse(p,buf,res,/*eof*/res==0))
+      {
+	 err=xstring::format(_("invalid metalink file: line %d: %s"),
+	       (int)XML_GetCurrentLineNumber(p),
+	       XML_ErrorString(XML_GetErrorCode(p)));
+	 break;
+      }
+      if(res==0 || ctx.file_done)
+	 break;
+   }
+   XML_ParserFree(p);
+   close(fd);
+   if(err)
+      return err;
+   if(!ctx.file_done && !ctx.in_file)
+      return _("no file element found");
+   if(urls.Count()==0)
+      return _("no usable URLs found");
+   return 0;
+#else
+   return _("metalink support requires lftp built with expat");
+#endif
+}
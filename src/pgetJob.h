@@ -21,6 +21,7 @@
 #define PGETJOB_H
 
 #include "CopyJob.h"
+#include "StringSet.h"
 
 class pgetJob : public CopyJob
 {
@@ -30,14 +31,50 @@ class pgetJob : public CopyJob
 
       off_t start;
       off_t limit;
+      int source; // 0 is the main source, i>0 is mirrors[i-1]
+      xarray<off_t> ranges; // start,limit pairs; several with multi-range
+
+      ChunkXfer(FileCopy *c,const char *n,const xarray<off_t>& r,int source);
+      off_t Got();
+      off_t Remaining(off_t pos) const;
+      void SetLimit(off_t lim);
+      void UpdateCmdline();
+   };
 
-      ChunkXfer(FileCopy *c,const char *n,off_t start,off_t limit);
+   // an alternative URL of the same file
+   class Source
+   {
+   public:
+      xstring_c url;
+      SMTaskRef<FileCopyPeer> peer;  // checks the size, cloned for chunks
+      bool checked;
+      bool dropped;
+      float rate;   // per connection
+      Source(const char *u);
+      ~Source();
    };
+   xarray_p<Source> mirrors;
+   off_t expected_size;
+   int next_source;
+   float main_rate;
+   bool main_dropped;
+
+   bool CheckMirrors(off_t size);
+   void DropSource(int src,const char *reason);
+   bool ReplaceDroppedChunks();
+   int AliveSources() const;
+   void UpdateSourceRates();
+   float SourceRate(int src) const;
+   bool SourceAlive(int src) const;
+   int NextSource();
+   int FastestSource();
 
    TaskRefArray<ChunkXfer> chunks;
    int	 max_chunks;
    off_t chunks_bytes;
    void InitChunks(off_t offset,off_t size);
+   void StartChunks(const xarray<off_t>& r);
+   int ChunkConnections(int n);
 
    off_t start0;
    off_t limit0;
@@ -50,9 +87,22 @@ class pgetJob : public CopyJob
    bool pget_cont:1;
    bool priority_ends:1;
    bool ends_pending:1;
+   bool upload:1;	   // local file to a remote one (pput)
+   bool size_checked:1;
+   bool target_opened:1;   // the main transfer has created the remote file
+
+   const Ref<FDStream>& Local() const
+      { return upload ? c->get->GetLocal() : c->put->GetLocal(); }
+   FileAccessRef size_session;	// gets the remote size after an upload
+   FileSet size_info;
+   bool CheckUploadedSize();
 
    void free_chunks();
-   ChunkXfer *NewChunk(const char *remote,off_t start,off_t limit);
+   ChunkXfer *NewChunk(const char *remote,const xarray<off_t>& r,int src=0);
+   ChunkXfer *NewChunk(const char *remote,off_t start,off_t limit,int src=0);
+   void InsertChunk(ChunkXfer *chunk);
+   bool ReuseChunk(int done);
+   void ReplaceChunk(int i);
 
    long total_eta;
 
@@ -77,6 +127,13 @@ public:
 
    void SetMaxConn(int n) { max_chunks=n; }
    void SetPriorityEnds() { priority_ends=true; }
+   void AddMirror(const char *url);
+   void SetExpectedSize(off_t s) { expected_size=s; }
+
+   // reads file name, size and URLs from a metalink file, returns
+   // an error message or 0.
+   static const char *ParseMetalink(const char *file,xstring& name,
+				    StringSet& urls,off_t *size);
 
    off_t GetBytesCount() { return total_xferred; }
    double GetTransferRate() { return total_xfer_rate; }
@@ -87,11 +144,17 @@ class pCopyJobCreator : public CopyJobCreator
 public:
    int max_chunks;
    bool priority_ends;
-   pCopyJobCreator(int n) : max_chunks(n), priority_ends(false) {}
+   StringSet mirrors;
+   off_t expected_size;
+   pCopyJobCreator(int n) : max_chunks(n), priority_ends(false), expected_size(-1) {}
    CopyJob *New(FileCopy *c,const char *n,const char *o) const {
       pgetJob *j=new pgetJob(c,n,max_chunks);
       if(priority_ends)
 	 j->SetPriorityEnds();
+      for(int i=0; i<mirrors.Count(); i++)
+	 j->AddMirror(mirrors[i]);
+      if(expected_size>=0)
+	 j->SetExpectedSize(expected_size);
       return j;
    }
 };
@@ -160,11 +160,21 @@ const char *OrderValidate(xstring_c *s)
 static const char *SortByValidate(xstring_c *s)
 {
    static const char * const valid_set[]={
-      "name", "name-desc", "size", "size-desc", "date", "date-desc", 0
+      "name", "name-desc", "size", "size-desc", "date", "date-desc", "mixed", 0
    };
    return SetValidate(*s,valid_set,"mirror:order-by");
 }
 
+static const char *ParallelValidate(xstring_c *s)
+{
+   if(!strcasecmp(*s,"auto"))
+   {
+      s->set("auto");
+      return 0;
+   }
+   return ResMgr::UNumberValidate(s);
+}
+
 #if USE_SSL
 static
 const char *AuthArgValidate(xstring_c *s)
@@ -205,6 +215,8 @@ static ResType lftp_vars[] = {
    {"ftp:device-prefix",	 "no",	  ResMgr::BoolValidate,0},
    {"ftp:fix-pasv-address",	 "yes",   ResMgr::BoolValidate,0},
    {"ftp:ignore-pasv-address",	 "no",	  ResMgr::BoolValidate,0},
+   {"ftp:info-pipeline-max",	 "64",	  ResMgr::UNumberValidate,0},
+   {"ftp:info-pipeline-sync",	 "yes",	  ResMgr::BoolValidate,0},
    {"ftp:fxp-force",		 "no",	  ResMgr::BoolValidate,0},
    {"ftp:fxp-passive-source",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"ftp:fxp-passive-sscn",	 "yes",   ResMgr::BoolValidate,ResMgr::NoClosure},
@@ -286,6 +298,7 @@ static ResType lftp_vars[] = {
    {"hftp:use-head",		 "yes",   ResMgr::BoolValidate,0},
    {"hftp:use-mkcol",		 "no",	  ResMgr::BoolValidate,0},
    {"hftp:use-propfind",	 "no",	  ResMgr::BoolValidate,0},
+   {"hftp:use-multi-range",	 "no",    ResMgr::BoolValidate,0},
    {"hftp:use-range",		 "yes",   ResMgr::BoolValidate,0},
    {"hftp:use-allprop",		 "no",	  ResMgr::BoolValidate,0},
    {"hftp:use-type",		 "yes",   ResMgr::BoolValidate,0},
@@ -300,6 +313,7 @@ static ResType lftp_vars[] = {
    {"http:proxy",		 "",	  HttpProxyValidate,0},
    {"http:use-mkcol",		 "yes",   ResMgr::BoolValidate,0},
    {"http:use-propfind",	 "no",    ResMgr::BoolValidate,0},
+   {"http:use-multi-range",	 "yes",   ResMgr::BoolValidate,0},
    {"http:use-range",		 "yes",   ResMgr::BoolValidate,0},
    {"http:use-allprop",		 "no",	  ResMgr::BoolValidate,0},
    {"http:user-agent",		 PACKAGE "/" VERSION,0,0},
@@ -330,6 +344,7 @@ static ResType lftp_vars[] = {
    {"net:socket-bind-ipv6",	 "",	  ResMgr::IPv6AddrValidate,0},
 #endif
    {"net:timeout",		 "5m",	  ResMgr::TimeIntervalValidate,0},
+   {"net:connect-attempt-delay", "0.25",  ResMgr::TimeIntervalValidate,0},
    {"net:connection-limit",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:connection-limit-timer","5m",	  ResMgr::TimeIntervalValidate,0},
    {"net:connection-takeover",	 "yes",   ResMgr::BoolValidate,0},
@@ -337,10 +352,12 @@ static ResType lftp_vars[] = {
    {"mirror:sort-by",		 "name",  SortByValidate,ResMgr::NoClosure},
    {"mirror:order",		 "*.sfv *.sig *.md5* *.sum * */", 0,ResMgr::NoClosure},
    {"mirror:parallel-directories", "yes", ResMgr::BoolValidate,ResMgr::NoClosure},
-   {"mirror:parallel-transfer-count", "0",ResMgr::UNumberValidate,0},
+   {"mirror:parallel-transfer-count", "0",ParallelValidate,0},
+   {"mirror:parallel-listing-count", "0",ResMgr::UNumberValidate,0},
    {"mirror:exclude-regex",	 "(^|/)(\\.in\\.|\\.nfs)",ResMgr::ERegExpValidate,ResMgr::NoClosure},
    {"mirror:include-regex",	 "",	  ResMgr::ERegExpValidate,ResMgr::NoClosure},
    {"mirror:use-pget-n",	 "0",	  ResMgr::UNumberValidate,0},
+   {"mirror:pget-min-size",	 "0",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
    {"mirror:set-permissions",	 "yes",   ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:dereference",	 "no",    ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:skip-noaccess",	 "no",    ResMgr::BoolValidate,ResMgr::NoClosure},
@@ -348,6 +365,10 @@ static ResType lftp_vars[] = {
    {"mirror:require-source",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:overwrite",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
 
+   {"scache:max-idle",		 "64",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"scache:max-idle-per-host",	 "16",	  ResMgr::UNumberValidate,0},
+   {"scache:prewarm",		 "yes",	  ResMgr::BoolValidate,0},
+
    {"sftp:auto-confirm",	 "no",	  ResMgr::BoolValidate,0},
    {"sftp:max-packets-in-flight","16",	  ResMgr::UNumberValidate,0},
    {"sftp:protocol-version",	 "6",	  ResMgr::UNumberValidate,0},
@@ -375,6 +396,7 @@ static ResType lftp_vars[] = {
 #endif
    {"dns:order",		 DEFAULT_ORDER, OrderValidate,0},
    {"dns:SRV-query",		 "no",	  ResMgr::BoolValidate,0},
+   {"dns:use-builtin",		 "yes",	  ResMgr::BoolValidate,0},
    {"dns:use-fork",		 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
 #ifdef DNSSEC_LOCAL_VALIDATION
    {"dns:strict-dnssec",	 "no",	  ResMgr::BoolValidate,0},
@@ -399,7 +421,9 @@ static ResType lftp_vars[] = {
    {"xfer:make-backup",		 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"xfer:keep-backup",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"xfer:backup-suffix",	 "~%Y%m%d%H%M%S~",0,ResMgr::NoClosure},
-   {"xfer:parallel",		 "1",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"xfer:parallel",		 "1",	  ParallelValidate,ResMgr::NoClosure},
+   {"xfer:parallel-max",	 "8",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"xfer:parallel-tune-interval","10",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
 
    // deprecated settings
    {"xfer:log",		   "log:enabled/xfer",   0,ResMgr::AliasValidate},
@@ -196,6 +196,8 @@ public:
    void add_commit(int new_len) { len+=new_len; }
 
    size_t length() const { return len; }
+   // room for appending without reallocation
+   size_t available() const { return size>len ? size-len-1 : 0; }
 
    xstring& set(const xstring &s) { return nset(s,s.length()); }
    xstring& set(const char *s);
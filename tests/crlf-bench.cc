@@ -0,0 +1,159 @@
+/*
+	Checks CRLFTranslator against the old per-line conversion
+	and compares their speed.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "buffer_crlf.h"
+
+char *program_name;
+
+static double now()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+// the conversion LocalAccess::Read used to do
+static int old_encode(char *buf,int res)
+{
+   char *p=buf;
+   for(int i=res; i>0; i--)
+   {
+      if(*p=='\n')
+      {
+	 memmove(p+1,p,i);
+	 *p++='\r';
+	 res++;
+      }
+      p++;
+   }
+   return res;
+}
+// the line-by-line scan LocalAccess::Write used to do
+static int old_decode(char *dst,const char *buf,int len)
+{
+   char *d=dst;
+   while(len>0)
+   {
+      int n=len;
+      int skip_cr=0;
+      const char *cr=buf;
+      for(;;)
+      {
+	 cr=(const char *)memchr(cr,'\r',n-(cr-buf));
+	 if(!cr)
+	    break;
+	 if(cr-buf<n-1 && cr[1]=='\n')
+	 {
+	    skip_cr=1;
+	    n=cr-buf;
+	    break;
+	 }
+	 if(cr-buf==n-1)
+	    break;
+	 cr++;
+      }
+      memcpy(d,buf,n);
+      d+=n;
+      buf+=n+skip_cr;
+      len-=n+skip_cr;
+   }
+   return d-dst;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   // a quarter of megabyte is enough for `make check';
+   // give the size in megabytes to measure the speed.
+   const int chunk=0x10000;
+   int size=(argc>1?atoi(argv[1])<<20:4*chunk);
+   char *text=(char*)malloc(size);
+   srand(1);
+   for(int i=0; i<size; i++)
+   {
+      int r=rand()%64;
+      text[i]=(r==0?'\n':r==1?'\r':'a'+r%26);
+   }
+   char *enc=(char*)malloc(size*2);
+   char *ref=(char*)malloc(size*2);
+   char *work=(char*)malloc(chunk*2);
+
+   // reference results, chunk by chunk as Read does it
+   double t=now();
+   int ref_len=0;
+   for(int i=0; i<size; i+=chunk)
+   {
+      memcpy(work,text+i,chunk);
+      int n=old_encode(work,chunk);
+      memcpy(ref+ref_len,work,n);
+      ref_len+=n;
+   }
+   printf("%-8s encode %8.1f MB/s\n","old",size/(now()-t)/1e6);
+
+   int failed=0;
+   CRLFTranslator::impl_t best=CRLFTranslator::GetImpl();
+   for(int i=CRLFTranslator::SCALAR; i<=best; i++)
+   {
+      CRLFTranslator::impl_t impl=(CRLFTranslator::impl_t)i;
+      CRLFTranslator::SetImpl(impl);
+      t=now();
+      int len=0;
+      for(int j=0; j<size; j+=chunk)
+      {
+	 // in place, like LocalAccess::Read
+	 memcpy(work+chunk,text+j,chunk);
+	 int n=CRLFTranslator::Encode(work,work+chunk,chunk);
+	 memcpy(enc+len,work,n);
+	 len+=n;
+      }
+      printf("%-8s encode %8.1f MB/s\n",CRLFTranslator::ImplName(impl),size/(now()-t)/1e6);
+      if(len!=ref_len || memcmp(enc,ref,len))
+      {
+	 printf("%s: encode mismatch\n",CRLFTranslator::ImplName(impl));
+	 failed=1;
+      }
+   }
+
+   char *dec_ref=(char*)malloc(ref_len);
+   t=now();
+   int dec_ref_len=old_decode(dec_ref,ref,ref_len);
+   printf("%-8s decode %8.1f MB/s\n","old",ref_len/(now()-t)/1e6);
+
+   Buffer out;
+   for(int i=CRLFTranslator::SCALAR; i<=best; i++)
+   {
+      CRLFTranslator::impl_t impl=(CRLFTranslator::impl_t)i;
+      CRLFTranslator::SetImpl(impl);
+      out.Empty();
+      out.SetPos(0);
+      CRLFTranslator dec(CRLFTranslator::DECODE);
+      t=now();
+      // odd chunk size to split CRLF pairs sometimes
+      for(int j=0; j<ref_len; j+=chunk-1)
+	 dec.PutTranslated(&out,ref+j,j+chunk-1<ref_len?chunk-1:ref_len-j);
+      dec.PutTranslated(&out,0,0);
+      printf("%-8s decode %8.1f MB/s\n",CRLFTranslator::ImplName(impl),ref_len/(now()-t)/1e6);
+      const char *b;
+      int s;
+      out.Get(&b,&s);
+      if(s!=dec_ref_len || memcmp(b,dec_ref,s) || out.GetPos()!=ref_len)
+      {
+	 printf("%s: decode mismatch\n",CRLFTranslator::ImplName(impl));
+	 failed=1;
+      }
+      if(s!=size || memcmp(b,text,s))
+      {
+	 printf("%s: round trip mismatch\n",CRLFTranslator::ImplName(impl));
+	 failed=1;
+      }
+   }
+   return failed;
+}
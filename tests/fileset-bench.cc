@@ -0,0 +1,157 @@
+/*
+	Checks the merge-join FileSet subtractions against the old
+	per-entry FindByName lookup and compares their speed.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "FileSet.h"
+
+char *program_name;
+
+static double now()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+// a local and a remote listing as mirror sees them: most names are in
+// both sets, some only in one, and a part of the common files differ.
+static void fill(FileSet *local,FileSet *remote,int n)
+{
+   char name[32];
+   srand(1);
+   for(int i=0; i<n; i++)
+   {
+      snprintf(name,sizeof(name),"f%08d",i);
+      int r=rand()%16;
+      FileInfo *fi=new FileInfo(name);
+      fi->SetType(r==0?FileInfo::DIRECTORY:FileInfo::NORMAL);
+      fi->SetSize(i);
+      fi->SetDate(1000000000+i,0);
+      if(r!=1)
+	 local->Add(new FileInfo(*fi));
+      if(r==2)
+      {
+	 delete fi;
+	 continue;
+      }
+      if(r<6)
+	 fi->SetSize(i+1);
+      remote->Add(fi);
+   }
+}
+
+// the loops FileSet::SubtractSame and SubtractNotIn used to run
+static void old_subtract_same(FileSet *s,const FileSet *set,int ignore)
+{
+   s->rewind();
+   for(FileInfo *f=s->curr(); f; f=s->next())
+   {
+      FileInfo *m=set->FindByName(f->name);
+      if(m && f->SameAs(m,ignore))
+	 s->SubtractCurr();
+   }
+}
+static void old_subtract_not_in(FileSet *s,const FileSet *set)
+{
+   s->rewind();
+   for(FileInfo *f=s->curr(); f; f=s->next())
+      if(!set->FindByName(f->name))
+	 s->SubtractCurr();
+}
+
+static bool same_names(const FileSet *a,const FileSet *b)
+{
+   if(a->count()!=b->count())
+      return false;
+   for(int i=0; i<a->count(); i++)
+      if(strcmp((*a)[i]->name,(*b)[i]->name))
+	 return false;
+   return true;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   // the defaults keep `make check' quick; give e.g. 1000000 65536
+   // to measure the speed. Removing entries one by one is quadratic,
+   // so the old code can be given a smaller listing.
+   int n=(argc>1?atoi(argv[1]):20000);
+   int old_n=(argc>2?atoi(argv[2]):4096);
+   if(old_n>n)
+      old_n=n;
+   int failed=0;
+
+   FileSet local,remote;
+   fill(&local,&remote,n);
+   FileSet small_local,small_remote;
+   fill(&small_local,&small_remote,old_n);
+
+   const int ignore=FileInfo::IGNORE_DATE_IF_OLDER;
+
+   FileSet old_same(&small_local);
+   double t=now();
+   old_subtract_same(&old_same,&small_remote,ignore);
+   t=now()-t;
+   printf("%-6s same   %8d entries %8.1f ns/entry\n","old",old_n,t/old_n*1e9);
+
+   FileSet new_same(&small_local);
+   new_same.SubtractSame(&small_remote,ignore);
+   if(!same_names(&old_same,&new_same))
+   {
+      printf("SubtractSame mismatch\n");
+      failed=1;
+   }
+
+   FileSet old_not_in(&small_local);
+   t=now();
+   old_subtract_not_in(&old_not_in,&small_remote);
+   t=now()-t;
+   printf("%-6s not-in %8d entries %8.1f ns/entry\n","old",old_n,t/old_n*1e9);
+
+   FileSet new_not_in(&small_local);
+   new_not_in.SubtractNotIn(&small_remote);
+   if(!same_names(&old_not_in,&new_not_in))
+   {
+      printf("SubtractNotIn mismatch\n");
+      failed=1;
+   }
+
+   FileSet same(&local);
+   t=now();
+   same.SubtractSame(&remote,ignore);
+   t=now()-t;
+   printf("%-6s same   %8d entries %8.1f ns/entry\n","merge",n,t/n*1e9);
+
+   FileSet not_in(&local);
+   t=now();
+   not_in.SubtractNotIn(&remote);
+   t=now()-t;
+   printf("%-6s not-in %8d entries %8.1f ns/entry\n","merge",n,t/n*1e9);
+
+   // what has to be left of the big sets by construction
+   srand(1);
+   int same_left=0,not_in_left=0;
+   for(int i=0; i<n; i++)
+   {
+      int r=rand()%16;
+      if(r==1)
+	 continue;
+      if(r<6)
+	 same_left++;
+      if(r!=2)
+	 not_in_left++;
+   }
+   if(same.count()!=same_left || not_in.count()!=not_in_left)
+   {
+      printf("merge result counts mismatch\n");
+      failed=1;
+   }
+   return failed;
+}